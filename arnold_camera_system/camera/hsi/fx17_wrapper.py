@@ -1,10 +1,21 @@
 # Wrapper for controlling the Specim FX17 camera using the spectralcam module
+import logging
 import time
 from typing import Any
 
 from spectralcam.gentl import GCSystem
+from spectralcam.profile import load_profile
 from spectralcam.specim import FX17
 
+from arnold_camera_system.data_handling.compression import (
+    ChunkCompressor,
+    CompressedCube,
+    HypercubeCodec,
+)
+from arnold_camera_system.data_handling.dataset import CubeReader, CubeWriter
+
+logger = logging.getLogger(__name__)
+
 
 class FX17CameraWrapper:
     """
@@ -18,9 +29,12 @@ class FX17CameraWrapper:
         self.camera = None
         self.connected = False
 
-    def connect(self, auto_configure: bool = True) -> bool:
+    def connect(
+        self, auto_configure: bool = True, config_path: str | None = None
+    ) -> bool:
         """
-        Discover and connect to the FX17 camera. Optionally set default configuration.
+        Discover and connect to the FX17 camera. Optionally set default configuration,
+        or apply the [cameras.hsi] profile of config_path if it is given.
         Returns True if connected, False otherwise.
         """
         self.system = GCSystem()
@@ -29,7 +43,9 @@ class FX17CameraWrapper:
             self.camera = cam
             self.interface = intf
             self.connected = True
-            if auto_configure:
+            if config_path is not None:
+                self.apply_profile(config_path)
+            elif auto_configure:
                 self.set_defaults()
             return True
         return False
@@ -41,6 +57,18 @@ class FX17CameraWrapper:
         if self.camera is not None:
             self.camera.set_defaults(frame_rate=frame_rate, exposure_time=exposure_time)
 
+    def apply_profile(
+        self, config_path: str, section: str = "cameras.hsi", trust_cache: bool = False
+    ) -> dict:
+        """
+        Apply a camera profile from a TOML file. Only features that differ from the
+        current camera state are written. Returns the written features.
+        """
+        if self.camera is None:
+            return {}
+        profile = load_profile(config_path, section)
+        return self.camera.apply_profile(profile, trust_cache=trust_cache)
+
     def open_stream(self):
         """
         Open a stream for continuous image acquisition. Required to acquire images."
@@ -48,21 +76,95 @@ class FX17CameraWrapper:
         if self.camera is not None:
             self.camera.open_stream()
 
-    def start_timed_capture(self, duration: int) -> Any:
+    def start_timed_capture(
+        self,
+        duration: int,
+        codec: HypercubeCodec | None = None,
+        lines_per_chunk: int = 64,
+    ) -> Any:
         """
         Start a timed capture for a specified duration in ms.
+        If a codec is given, frames are compressed in chunks of lines_per_chunk lines on a
+        thread pool during acquisition and a CompressedCube is returned instead of an array.
         """
+        compressor = None
+        cube = None
+        old_cb = None
         if self.camera is not None:
             self.open_stream()
-            self.camera.start_acquire(True)
+            if codec is not None:
+                cube = CompressedCube(codec)
+                compressor = ChunkCompressor(codec, cube.append, lines_per_chunk)
+                old_cb = self.camera.frame_cb
+
+                def compress_frame(frame, bit_depth) -> bool:
+                    compressor.push(frame, bit_depth)
+                    return False
+
+                self.camera.frame_cb = compress_frame
+            self.camera.start_acquire(compressor is None)
 
         time.sleep(duration / 1000.0)
 
         if self.camera is not None:
             data = self.camera.stop_acquire()
             self.camera.close_stream()
+            if compressor is not None:
+                self.camera.frame_cb = old_cb
+                compressor.close()
+                logger.info(
+                    f"Compressed {compressor.lines} lines to {cube.nbytes} bytes"
+                )
+                return cube
             return data
 
+    def capture_to_file(
+        self,
+        path: str,
+        duration: int,
+        codec: HypercubeCodec | None = None,
+        chunks: tuple[int, int | None, int | None] | None = None,
+        append: bool = False,
+    ) -> CubeReader | None:
+        """
+        Capture for a specified duration in ms directly to a chunked cube on disk (see
+        CubeWriter). chunks gives the lines, bands and spatial pixels per chunk, None for all
+        (default 64 lines of all bands and pixels). With append=True the frames are added to an
+        existing cube, codec and chunks must match it if they are given.
+        """
+        if self.camera is None:
+            return None
+        layout = {}
+        if codec is not None or not append:
+            layout["codec"] = codec
+        if chunks is not None:
+            chunk_lines, band_chunk, spatial_chunk = chunks
+            layout.update(
+                chunk_lines=chunk_lines,
+                band_chunk=band_chunk,
+                spatial_chunk=spatial_chunk,
+            )
+        writer = CubeWriter(path, append=append, **layout)
+        old_cb = self.camera.frame_cb
+
+        def write_frame(frame, bit_depth) -> bool:
+            writer.push(frame, bit_depth)
+            return False
+
+        try:
+            self.open_stream()
+            self.camera.frame_cb = write_frame
+            self.camera.start_acquire(False)
+            time.sleep(duration / 1000.0)
+            self.camera.stop_acquire()
+            self.camera.close_stream()
+        except BaseException:
+            writer.abort()
+            raise
+        finally:
+            self.camera.frame_cb = old_cb
+        return CubeReader(writer.close())
+
     def close(self):
         """
         Close the camera and release resources.
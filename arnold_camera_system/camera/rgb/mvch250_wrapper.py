@@ -15,6 +15,7 @@ from MvCameraControl_class import (
     MVCC_ENUMVALUE,
     MVCC_FLOATVALUE,
     MVCC_INTVALUE,
+    MVCC_INTVALUE_EX,
     MvCamera,
 )
 from MvErrorDefine_const import MV_OK
@@ -224,6 +225,77 @@ class MVCH250CameraWrapper:
                 if ret != 0:
                     logger.warning(f"set enum value fail! {to_hex_str(ret)}")
 
+    def set_frame_callback(
+        self, frame_callback: Optional[Callable[[np.ndarray, Any], None]]
+    ) -> None:
+        """Replace the frame callback. The frame array is reused for the next frame, copy it to keep it."""
+        self._frame_callback = frame_callback
+
+    def enable_action_trigger(
+        self, device_key: int, group_key: int, group_mask: int, enable: bool = True
+    ) -> None:
+        """
+        Trigger frames with GigE Vision ACTION commands. Action 1 is set to the given keys
+        and used as the frame start trigger, so a broadcasted (scheduled) action triggers
+        this camera together with the other cameras configured with the same keys.
+        """
+        if self._is_open is False:
+            raise RuntimeError("Camera is not open")
+
+        if not enable:
+            ret = self.obj_cam.MV_CC_SetEnumValue("TriggerMode", MV_TRIGGER_MODE_OFF)
+            if ret != 0:
+                logger.warning(f"set trigger mode fail! {to_hex_str(ret)}")
+            return
+
+        for name, value in (
+            ("ActionSelector", 1),
+            ("ActionDeviceKey", device_key),
+            ("ActionGroupKey", group_key),
+            ("ActionGroupMask", group_mask),
+        ):
+            ret = self.obj_cam.MV_CC_SetIntValueEx(name, value)
+            if ret != 0:
+                raise RuntimeError(f"Unable to set {name}, err_num: {to_hex_str(ret)}")
+
+        for name, value in (
+            ("TriggerSelector", "FrameStart"),
+            ("TriggerSource", "Action1"),
+            ("TriggerMode", "On"),
+        ):
+            ret = self.obj_cam.MV_CC_SetEnumValueByString(name, value)
+            if ret != 0:
+                raise RuntimeError(f"Unable to set {name}, err_num: {to_hex_str(ret)}")
+
+    def get_timestamp(self) -> int:
+        """Latch and read the current device timestamp in ticks."""
+        if self._is_open is False:
+            raise RuntimeError("Camera is not open")
+
+        ret = self.obj_cam.MV_CC_SetCommandValue("GevTimestampControlLatch")
+        if ret != 0:
+            raise RuntimeError(f"Unable to latch timestamp, err_num: {to_hex_str(ret)}")
+        return self._get_int64("GevTimestampValue")
+
+    def get_timestamp_frequency(self) -> int:
+        """Device timestamp ticks per second."""
+        if self._is_open is False:
+            raise RuntimeError("Camera is not open")
+
+        try:
+            return self._get_int64("GevTimestampTickFrequency")
+        except RuntimeError:
+            # Timestamps of PTP capable devices are in nanoseconds
+            return 1_000_000_000
+
+    def _get_int64(self, name: str) -> int:
+        stIntParam = MVCC_INTVALUE_EX()
+        memset(byref(stIntParam), 0, sizeof(stIntParam))
+        ret = self.obj_cam.MV_CC_GetIntValueEx(name, stIntParam)
+        if ret != 0:
+            raise RuntimeError(f"Unable to get {name}, err_num: {to_hex_str(ret)}")
+        return stIntParam.nCurValue
+
     def start_grabbing(self) -> None:
         if self._is_open is False:
             raise RuntimeError("Camera is not open")
@@ -0,0 +1,208 @@
+# Synchronized capture of the FX17 and MV-CH250 cameras with broadcast scheduled action commands
+import logging
+import threading
+import time
+from dataclasses import dataclass
+from typing import Any, Callable, Optional
+
+import numpy as np
+
+from arnold_camera_system.camera.hsi.fx17_wrapper import FX17CameraWrapper
+from arnold_camera_system.camera.rgb.mvch250_wrapper import MVCH250CameraWrapper
+
+logger = logging.getLogger(__name__)
+
+
+@dataclass
+class DeviceClock:
+    """Maps device timestamps of a camera to host time (time.monotonic, in seconds)."""
+
+    ticks: int
+    host_time: float
+    frequency: int
+
+    @classmethod
+    def latch(cls, get_timestamp: Callable[[], int], frequency: int) -> "DeviceClock":
+        # Host time of the latch is taken as the middle of the round trip
+        before = time.monotonic()
+        ticks = get_timestamp()
+        after = time.monotonic()
+        return cls(ticks, (before + after) / 2, frequency)
+
+    def to_host(self, timestamp: int) -> float:
+        return self.host_time + (timestamp - self.ticks) / self.frequency
+
+    def to_device(self, host_time: float) -> int:
+        return self.ticks + round((host_time - self.host_time) * self.frequency)
+
+
+@dataclass
+class SyncedFrame:
+    """Frames of both cameras triggered by one action."""
+
+    action_time: float
+    hsi: Optional[np.ndarray] = None
+    hsi_timestamp: Optional[int] = None
+    rgb: Optional[np.ndarray] = None
+    rgb_timestamp: Optional[int] = None
+
+    @property
+    def complete(self) -> bool:
+        return self.hsi is not None and self.rgb is not None
+
+
+class SyncCapture:
+    """
+    Triggers the FX17 and the MV-CH250 with one broadcasted ACTION command on the FX17
+    interface and matches the resulting frames by their device timestamps.
+
+    Both cameras must be on the same interface. Scheduled actions (executed when the device
+    clocks reach the action time) need PTP synchronized clocks; if the clocks do not agree
+    after configure(), actions are executed on arrival instead. Frames are matched to the
+    action whose time is nearest to the frame timestamp, within the tolerance (in seconds).
+    """
+
+    def __init__(
+        self,
+        hsi: FX17CameraWrapper,
+        rgb: MVCH250CameraWrapper,
+        device_key: int = 0x1,
+        group_key: int = 0x1,
+        group_mask: int = 0x1,
+        lead_time: float = 0.05,
+        tolerance: float = 0.005,
+    ):
+        self.hsi = hsi
+        self.rgb = rgb
+        self.device_key = device_key
+        self.group_key = group_key
+        self.group_mask = group_mask
+        self.lead_time = lead_time
+        self.tolerance = tolerance
+
+        self.scheduled = False
+        self.frames: list[SyncedFrame] = []
+        self.unmatched = 0
+        self._clocks: dict[str, DeviceClock] = {}
+        self._lock = threading.Lock()
+        self._old_hsi_cb = None
+
+    def configure(self, scheduled: bool = True) -> None:
+        """
+        Set both cameras to trigger frames with action 1 and turn on frame timestamps.
+        Scheduled actions are used if requested, supported by the FX17 and the device
+        clocks of the cameras are synchronized.
+        """
+        camera = self.hsi.camera
+        if camera is None:
+            raise RuntimeError("FX17 is not connected")
+
+        camera.enable_action_trigger(self.device_key, self.group_key, self.group_mask)
+        camera.enable_timestamps(True)
+        self.rgb.enable_action_trigger(
+            self.device_key, self.group_key, self.group_mask
+        )
+        self.sync_clocks()
+
+        self.scheduled = False
+        if scheduled:
+            if not camera.scheduled_action_support:
+                logger.warning("FX17 does not support scheduled actions")
+            elif not self.clocks_synchronized():
+                logger.warning(
+                    "Device clocks are not synchronized (PTP), actions are not scheduled"
+                )
+            else:
+                self.scheduled = True
+        logger.info(f"Action trigger configured, scheduled={self.scheduled}")
+
+    def sync_clocks(self) -> None:
+        """Latch device timestamps of both cameras to map frame timestamps to host time."""
+        camera = self.hsi.camera
+        self._clocks["hsi"] = DeviceClock.latch(
+            camera.get_timestamp, camera.timestamp_frequency
+        )
+        self._clocks["rgb"] = DeviceClock.latch(
+            self.rgb.get_timestamp, self.rgb.get_timestamp_frequency()
+        )
+
+    def clocks_synchronized(self) -> bool:
+        """Check that the device clocks show the same time (e.g. both are PTP synchronized)."""
+        hsi, rgb = self._clocks["hsi"], self._clocks["rgb"]
+        hsi_time = hsi.ticks / hsi.frequency
+        rgb_time = rgb.to_device(hsi.host_time) / rgb.frequency
+        return abs(hsi_time - rgb_time) < self.tolerance
+
+    def start(self) -> None:
+        """Start acquisition on both cameras, frames are collected until stop()."""
+        camera = self.hsi.camera
+        with self._lock:
+            self.frames = []
+            self.unmatched = 0
+        self._old_hsi_cb = camera.frame_cb
+        camera.frame_cb = self._on_hsi_frame
+        self.rgb.set_frame_callback(self._on_rgb_frame)
+
+        if not camera.is_stream_open:
+            self.hsi.open_stream()
+        camera.start_acquire(False)
+        self.rgb.start_grabbing()
+
+    def trigger(self) -> SyncedFrame:
+        """
+        Broadcast one action to all cameras of the interface. Returns the entry the
+        frames of this action are matched to.
+        """
+        if not self._clocks:
+            raise RuntimeError("Call configure() first")
+        act_time = None
+        action_time = time.monotonic()
+        if self.scheduled:
+            action_time += self.lead_time
+            act_time = self._clocks["hsi"].to_device(action_time)
+
+        synced = SyncedFrame(action_time)
+        with self._lock:
+            self.frames.append(synced)
+        self.hsi.interface.gvcp_action(
+            self.device_key, self.group_key, self.group_mask, act_time
+        )
+        return synced
+
+    def stop(self) -> list[SyncedFrame]:
+        """Stop acquisition and return the frames of all actions."""
+        camera = self.hsi.camera
+        camera.stop_acquire()
+        self.rgb.stop_grabbing()
+        camera.frame_cb = self._old_hsi_cb
+        self.rgb.set_frame_callback(None)
+        if self.unmatched > 0:
+            logger.warning(f"{self.unmatched} frames did not match any action")
+        with self._lock:
+            return list(self.frames)
+
+    def _on_hsi_frame(self, frame: np.ndarray, bit_depth: Any) -> bool:
+        self._match("hsi", frame, self.hsi.camera.last_timestamp)
+        return False
+
+    def _on_rgb_frame(self, frame: np.ndarray, frame_info: Any) -> None:
+        timestamp = (frame_info.nDevTimeStampHigh << 32) | frame_info.nDevTimeStampLow
+        # Wrapper reuses the frame buffer
+        self._match("rgb", frame.copy(), timestamp)
+
+    def _match(self, name: str, frame: np.ndarray, timestamp: Optional[int]) -> None:
+        if timestamp is None:
+            self.unmatched += 1
+            return
+        frame_time = self._clocks[name].to_host(timestamp)
+        with self._lock:
+            free = [f for f in self.frames if getattr(f, name) is None]
+            best = min(
+                free, key=lambda f: abs(f.action_time - frame_time), default=None
+            )
+            if best is None or abs(best.action_time - frame_time) > self.tolerance:
+                self.unmatched += 1
+                logger.debug(f"No action for {name} frame at {frame_time:.6f}")
+                return
+            setattr(best, name, frame)
+            setattr(best, f"{name}_timestamp", timestamp)
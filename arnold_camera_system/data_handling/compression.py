@@ -0,0 +1,408 @@
+# Lossless compression of hyperspectral line scans, run on a thread pool during acquisition
+import logging
+import os
+import threading
+import zlib
+from collections import deque
+from concurrent.futures import Future, ThreadPoolExecutor
+from dataclasses import dataclass, field
+from typing import Callable, Optional
+
+import numpy as np
+
+try:
+    import zstandard
+except ImportError:
+    zstandard = None
+
+try:
+    import lz4.frame as lz4_frame
+except ImportError:
+    lz4_frame = None
+
+logger = logging.getLogger(__name__)
+
+CODECS = ("zstd", "lz4", "zlib", "none")
+
+
+def _module_available(codec: str) -> bool:
+    return not (
+        (codec == "zstd" and zstandard is None)
+        or (codec == "lz4" and lz4_frame is None)
+    )
+
+
+def pack_bits(data: np.ndarray, bit_depth: int) -> bytes:
+    """
+    Pack unsigned integers to bit_depth bits each (little endian bit order, padded to whole bytes).
+    8 and 16 bits are stored as bytes and 16-bit little endian, 10 and 12 bits have fast paths.
+    """
+    values = np.ascontiguousarray(data).reshape(-1)
+    if bit_depth == 8:
+        return values.astype(np.uint8).tobytes()
+    if bit_depth == 16:
+        return values.astype("<u2").tobytes()
+    values = values.astype(np.uint16)
+    if bit_depth == 12:
+        pairs = np.zeros(-(-len(values) // 2) * 2, dtype=np.uint16)
+        pairs[: len(values)] = values
+        pairs = pairs.reshape(-1, 2)
+        out = np.empty((len(pairs), 3), dtype=np.uint8)
+        out[:, 0] = pairs[:, 0] & 0xFF
+        out[:, 1] = (pairs[:, 0] >> 8) | ((pairs[:, 1] & 0x0F) << 4)
+        out[:, 2] = pairs[:, 1] >> 4
+        return out.tobytes()
+    if bit_depth == 10:
+        quads = np.zeros(-(-len(values) // 4) * 4, dtype=np.uint16)
+        quads[: len(values)] = values
+        quads = quads.reshape(-1, 4)
+        out = np.empty((len(quads), 5), dtype=np.uint8)
+        out[:, 0] = quads[:, 0] & 0xFF
+        out[:, 1] = (quads[:, 0] >> 8) | ((quads[:, 1] & 0x3F) << 2)
+        out[:, 2] = (quads[:, 1] >> 6) | ((quads[:, 2] & 0x0F) << 4)
+        out[:, 3] = (quads[:, 2] >> 4) | ((quads[:, 3] & 0x03) << 6)
+        out[:, 4] = quads[:, 3] >> 2
+        return out.tobytes()
+    bits = (values[:, np.newaxis] >> np.arange(bit_depth, dtype=np.uint16)) & 1
+    return np.packbits(bits.astype(np.uint8), bitorder="little").tobytes()
+
+
+def unpack_bits(buffer: bytes, bit_depth: int, count: int) -> np.ndarray:
+    """Inverse of pack_bits, returns count values as uint8 (bit_depth <= 8) or uint16."""
+    raw = np.frombuffer(buffer, dtype=np.uint8)
+    if bit_depth == 8:
+        return raw[:count].copy()
+    if bit_depth == 16:
+        return np.frombuffer(buffer, dtype="<u2", count=count).astype(np.uint16)
+    if bit_depth == 12:
+        b = raw.reshape(-1, 3).astype(np.uint16)
+        out = np.empty((len(b), 2), dtype=np.uint16)
+        out[:, 0] = b[:, 0] | ((b[:, 1] & 0x0F) << 8)
+        out[:, 1] = (b[:, 1] >> 4) | (b[:, 2] << 4)
+        return out.reshape(-1)[:count]
+    if bit_depth == 10:
+        b = raw.reshape(-1, 5).astype(np.uint16)
+        out = np.empty((len(b), 4), dtype=np.uint16)
+        out[:, 0] = b[:, 0] | ((b[:, 1] & 0x03) << 8)
+        out[:, 1] = (b[:, 1] >> 2) | ((b[:, 2] & 0x0F) << 6)
+        out[:, 2] = (b[:, 2] >> 4) | ((b[:, 3] & 0x3F) << 4)
+        out[:, 3] = (b[:, 3] >> 6) | (b[:, 4] << 2)
+        return out.reshape(-1)[:count]
+    bits = np.unpackbits(raw, bitorder="little")[: count * bit_depth]
+    weights = (1 << np.arange(bit_depth, dtype=np.uint32)).astype(np.uint32)
+    values = bits.reshape(count, bit_depth).astype(np.uint32) @ weights
+    return values.astype(np.uint8 if bit_depth <= 8 else np.uint16)
+
+
+class HypercubeCodec:
+    """
+    Lossless codec for chunks of line scan frames (lines x bands x spatial). Values are predicted
+    from the previous band (delta modulo 2^bit_depth, so the residuals keep the bit depth), packed to
+    the bit depth of the camera and compressed with zstd or lz4. Codecs whose module is not installed
+    fall back to zlib. Compression functions release the GIL, so chunks can be encoded in threads.
+    """
+
+    def __init__(
+        self,
+        codec: str = "zstd",
+        level: Optional[int] = None,
+        spectral_delta: bool = True,
+        pack: bool = True,
+    ):
+        if codec not in CODECS:
+            raise ValueError(f"Unknown codec {codec}, use one of {CODECS}")
+        if not _module_available(codec):
+            logger.warning(f"{codec} module not found, using zlib")
+            codec = "zlib"
+        self.codec = codec
+        self.level = level
+        self.spectral_delta = spectral_delta
+        self.pack = pack
+        self._local = threading.local()
+
+    @property
+    def config(self) -> dict:
+        """Parameters needed to decode the data."""
+        return {
+            "codec": self.codec,
+            "level": self.level,
+            "spectral_delta": self.spectral_delta,
+            "pack": self.pack,
+        }
+
+    @classmethod
+    def from_config(cls, config: dict) -> "HypercubeCodec":
+        return cls(
+            config["codec"], config["level"], config["spectral_delta"], config["pack"]
+        )
+
+    def encode(self, chunk: np.ndarray, bit_depth: int) -> bytes:
+        """Encode a chunk of frames, bands are the second last axis."""
+        data = np.asarray(chunk)
+        if self.spectral_delta:
+            data = self._delta(data, bit_depth)
+        if self.pack:
+            raw = pack_bits(data, bit_depth)
+        else:
+            raw = np.ascontiguousarray(
+                data, dtype=sample_dtype(bit_depth).newbyteorder("<")
+            )
+            raw = raw.tobytes()
+        return self._compress(raw)
+
+    def decode(self, data: bytes, shape: tuple, bit_depth: int) -> np.ndarray:
+        """Decode a chunk of the given shape."""
+        raw = self._decompress(data)
+        count = int(np.prod(shape))
+        if self.pack:
+            values = unpack_bits(raw, bit_depth, count)
+        else:
+            dtype = sample_dtype(bit_depth).newbyteorder("<")
+            values = np.frombuffer(raw, dtype=dtype, count=count).astype(
+                dtype.newbyteorder("=")
+            )
+        values = values.reshape(shape)
+        if self.spectral_delta:
+            values = self._undelta(values, bit_depth)
+        return values
+
+    def _delta(self, data: np.ndarray, bit_depth: int) -> np.ndarray:
+        mask = (1 << bit_depth) - 1
+        wide = data.astype(np.int32)
+        wide[..., 1:, :] -= data[..., :-1, :]
+        return (wide & mask).astype(sample_dtype(bit_depth))
+
+    def _undelta(self, data: np.ndarray, bit_depth: int) -> np.ndarray:
+        mask = (1 << bit_depth) - 1
+        return (np.cumsum(data, axis=-2, dtype=np.uint32) & mask).astype(
+            sample_dtype(bit_depth)
+        )
+
+    def _compress(self, raw: bytes) -> bytes:
+        if self.codec == "zstd":
+            # Compressor objects must not be shared between threads
+            if not hasattr(self._local, "zstd"):
+                self._local.zstd = zstandard.ZstdCompressor(level=self.level or 3)
+            return self._local.zstd.compress(raw)
+        if self.codec == "lz4":
+            return lz4_frame.compress(raw, compression_level=self.level or 0)
+        if self.codec == "zlib":
+            return zlib.compress(raw, 1 if self.level is None else self.level)
+        return raw
+
+    def _decompress(self, data: bytes) -> bytes:
+        if self.codec == "zstd":
+            return zstandard.ZstdDecompressor().decompress(data)
+        if self.codec == "lz4":
+            return lz4_frame.decompress(data)
+        if self.codec == "zlib":
+            return zlib.decompress(data)
+        return data
+
+
+def sample_dtype(bit_depth: int) -> np.dtype:
+    """Smallest unsigned integer type holding samples of bit_depth bits."""
+    return np.dtype(np.uint8 if bit_depth <= 8 else np.uint16)
+
+
+@dataclass
+class CompressedChunk:
+    index: int
+    first_line: int
+    shape: tuple
+    bit_depth: int
+    data: bytes
+
+
+class ChunkCompressor:
+    """
+    Collects frames from the acquisition stream to chunks of lines_per_chunk lines and compresses
+    them on a thread pool. push() never waits for compression: while the workers are behind by
+    more than the backlog limit, frames are dropped and counted in dropped. Finished chunks are
+    passed to on_chunk in order, from a worker thread.
+    """
+
+    def __init__(
+        self,
+        codec: HypercubeCodec,
+        on_chunk: Callable[[CompressedChunk], None],
+        lines_per_chunk: int = 64,
+        workers: Optional[int] = None,
+    ):
+        self.codec = codec
+        self.on_chunk = on_chunk
+        self.lines_per_chunk = lines_per_chunk
+        self.bit_depth: Optional[int] = None
+        self.lines = 0
+        self.dropped = 0
+        self._frames: list[np.ndarray] = []
+        self._next_index = 0
+        self._overloaded = False
+        # Appended by push() without locking, so acquisition never waits for on_chunk
+        self._pending: deque[Future] = deque()
+        self._emit_lock = threading.Lock()
+        workers = workers or os.cpu_count() or 1
+        self._executor = ThreadPoolExecutor(
+            max_workers=workers, thread_name_prefix="compress"
+        )
+        self._max_pending = 4 * workers
+        self._error: Optional[BaseException] = None
+
+    def push(self, frame, bit_depth) -> None:
+        """Add a frame (bands x spatial), multi-part frames are stacked along the bands."""
+        if isinstance(frame, tuple):
+            frame = np.concatenate(frame)
+            bit_depth = max(bit_depth)
+        if self._backlog_full():
+            return
+        if self.bit_depth is None:
+            self.bit_depth = bit_depth
+        self._frames.append(frame)
+        self.lines += 1
+        if len(self._frames) >= self.lines_per_chunk:
+            self._submit()
+
+    def flush(self) -> None:
+        """Compress the remaining lines and wait for all chunks to be passed to on_chunk."""
+        if self._frames:
+            self._submit()
+        while self._pending:
+            self._pending[0].exception()
+            self._emit()
+        if self.dropped:
+            logger.warning(
+                f"Dropped {self.dropped} frames, compression did not keep up"
+            )
+        if self._error is not None:
+            raise self._error
+
+    def close(self) -> None:
+        """Flush and stop the workers."""
+        try:
+            self.flush()
+        finally:
+            self._executor.shutdown()
+
+    def _submit(self) -> None:
+        chunk = np.stack(self._frames)
+        first_line = self.lines - len(self._frames)
+        self._frames = []
+        index = self._next_index
+        self._next_index += 1
+        future = self._executor.submit(self._encode, index, first_line, chunk)
+        self._pending.append(future)
+        future.add_done_callback(lambda _: self._emit())
+
+    def _backlog_full(self) -> bool:
+        # Waiting would stall the stream callback, the frame is lost instead
+        if len(self._pending) < self._max_pending:
+            self._overloaded = False
+            return False
+        if not self._overloaded:
+            logger.warning(
+                "Compression does not keep up with acquisition, dropping frames"
+            )
+            self._overloaded = True
+        self.dropped += 1
+        return True
+
+    def _encode(
+        self, index: int, first_line: int, chunk: np.ndarray
+    ) -> CompressedChunk:
+        data = self.codec.encode(chunk, self.bit_depth)
+        return CompressedChunk(index, first_line, chunk.shape, self.bit_depth, data)
+
+    def _emit(self) -> None:
+        # Chunks finish in any order, pass them on in order
+        with self._emit_lock:
+            while self._pending and self._pending[0].done():
+                future = self._pending.popleft()
+                try:
+                    self.on_chunk(future.result())
+                except BaseException as err:
+                    logger.error(f"Failed to compress or store chunk: {err}")
+                    self._error = self._error or err
+
+
+@dataclass
+class CompressedCube:
+    """In-memory compressed recording, chunks of lines in order."""
+
+    codec: HypercubeCodec
+    chunks: list[CompressedChunk] = field(default_factory=list)
+
+    def append(self, chunk: CompressedChunk) -> None:
+        self.chunks.append(chunk)
+
+    @property
+    def nbytes(self) -> int:
+        return sum(len(chunk.data) for chunk in self.chunks)
+
+    def to_array(self) -> np.ndarray:
+        """Decode the whole recording (lines x bands x spatial)."""
+        if not self.chunks:
+            return np.empty((0, 0, 0), dtype=np.uint16)
+        return np.concatenate(
+            [
+                self.codec.decode(chunk.data, chunk.shape, chunk.bit_depth)
+                for chunk in self.chunks
+            ]
+        )
+
+
+def self_check(seed: int = 0) -> None:
+    """
+    Check that packing, spectral delta and every available codec reproduce the data exactly,
+    for all bit depths and for counts that do not fill the last packed byte. Needs no camera.
+
+    :raises AssertionError: Decoded data differs from the original
+    """
+    rng = np.random.default_rng(seed)
+    for bit_depth in range(1, 17):
+        for count in (1, 2, 3, 4, 5, 7, 8, 9, 1001):
+            values = rng.integers(0, 1 << bit_depth, count).astype(
+                sample_dtype(bit_depth)
+            )
+            # Extreme values catch lost high bits
+            values[0] = (1 << bit_depth) - 1
+            unpacked = unpack_bits(pack_bits(values, bit_depth), bit_depth, count)
+            if not np.array_equal(unpacked, values):
+                raise AssertionError(f"Packing {count} values of {bit_depth} bits")
+
+    codecs = [codec for codec in CODECS if _module_available(codec)]
+    for bit_depth in (8, 10, 12, 16):
+        # Odd shape and full range, so the delta wraps around
+        chunk = rng.integers(0, 1 << bit_depth, (5, 13, 7)).astype(
+            sample_dtype(bit_depth)
+        )
+        chunk[0, 0, 0] = (1 << bit_depth) - 1
+        for name in codecs:
+            for spectral_delta in (True, False):
+                for pack in (True, False):
+                    codec = HypercubeCodec(name, None, spectral_delta, pack)
+                    data = codec.encode(chunk, bit_depth)
+                    decoded = codec.decode(data, chunk.shape, bit_depth)
+                    if not np.array_equal(decoded, chunk):
+                        raise AssertionError(
+                            f"{codec.config} with {bit_depth} bits does not round trip"
+                        )
+
+    # Chunks finish out of order on the pool but must be passed on in order
+    frames = rng.integers(0, 4096, (50, 13, 7)).astype(np.uint16)
+    codec = HypercubeCodec("zlib")
+    cube = CompressedCube(codec)
+    compressor = ChunkCompressor(codec, cube.append, lines_per_chunk=4, workers=4)
+    for frame in frames:
+        compressor.push(frame, 12)
+    compressor.close()
+    if [chunk.index for chunk in cube.chunks] != list(range(len(cube.chunks))):
+        raise AssertionError("Chunks are not in order")
+    if not np.array_equal(cube.to_array(), frames):
+        raise AssertionError("Compressed cube does not match the frames")
+
+
+if __name__ == "__main__":
+    # python -m arnold_camera_system.data_handling.compression
+    logging.basicConfig(level=logging.INFO)
+    self_check()
+    print("Compression round trip OK")
@@ -0,0 +1,431 @@
+# Chunked on-disk hypercubes (Zarr v2 directory layout), written from the acquisition stream
+import json
+import logging
+import os
+import shutil
+import threading
+from concurrent.futures import Future, ThreadPoolExecutor
+from itertools import product
+from typing import Any, Optional
+
+import numpy as np
+
+from arnold_camera_system.data_handling.compression import (
+    HypercubeCodec,
+    sample_dtype,
+)
+
+logger = logging.getLogger(__name__)
+
+PARTIAL_SUFFIX = ".partial"
+DEFAULT_CHUNK_LINES = 64
+_UNSET: Any = object()
+"""Default of the CubeWriter layout parameters: default of a new cube, stored value when appending"""
+HYPERCUBE_CODEC_ID = "arnold.hypercube"
+"""Compressor ID of HypercubeCodec with spectral delta or bit packing, unknown to other readers"""
+
+
+def _compressor_config(codec: Optional[HypercubeCodec]) -> Optional[dict]:
+    # Plain zlib and zstd are standard Zarr compressors, the other options need this module
+    if codec is None:
+        return None
+    plain = not (codec.pack or codec.spectral_delta)
+    if codec.codec == "none" and plain:
+        return None
+    if codec.codec in ("zlib", "zstd") and plain:
+        level = codec.level
+        if level is None:
+            level = 1 if codec.codec == "zlib" else 3
+        return {"id": codec.codec, "level": level}
+    return {"id": HYPERCUBE_CODEC_ID, **codec.config}
+
+
+def _codec_from_config(config: Optional[dict]) -> Optional[HypercubeCodec]:
+    if config is None:
+        return None
+    if config["id"] == HYPERCUBE_CODEC_ID:
+        return HypercubeCodec.from_config(config)
+    if config["id"] in ("zlib", "zstd"):
+        return HypercubeCodec(config["id"], config.get("level"), False, False)
+    raise ValueError(f"Unsupported compressor {config['id']}")
+
+
+def _write_atomic(path: str, data: bytes) -> None:
+    # Readers see either the old or the new file, never a partly written one
+    tmp_path = path + ".tmp"
+    with open(tmp_path, "wb") as f:
+        f.write(data)
+        f.flush()
+        os.fsync(f.fileno())
+    os.replace(tmp_path, path)
+
+
+class CubeReader:
+    """
+    Random access to a hypercube written by CubeWriter (lines x bands x spatial). Only the
+    chunks covering the requested region are read and decoded, e.g. cube[100:200, 40:50].
+    """
+
+    def __init__(self, path: str):
+        self.path = path
+        with open(os.path.join(path, ".zarray")) as f:
+            meta = json.load(f)
+        attrs_path = os.path.join(path, ".zattrs")
+        self.attrs: dict[str, Any] = {}
+        if os.path.exists(attrs_path):
+            with open(attrs_path) as f:
+                self.attrs = json.load(f)
+        self.shape = tuple(meta["shape"])
+        self.chunks = tuple(meta["chunks"])
+        self.dtype = np.dtype(meta["dtype"])
+        self.fill_value = meta["fill_value"] or 0
+        self.compressor = meta["compressor"]
+        self.codec = _codec_from_config(self.compressor)
+        self.bit_depth = self.attrs.get("bit_depth", self.dtype.itemsize * 8)
+
+    def __len__(self) -> int:
+        return self.shape[0]
+
+    def __getitem__(self, key) -> np.ndarray:
+        if not isinstance(key, tuple):
+            key = (key,)
+        if len(key) > len(self.shape):
+            raise IndexError("Too many indices for a hypercube")
+        key = key + (slice(None),) * (len(self.shape) - len(key))
+        ranges = []
+        steps = []
+        squeeze = []
+        for axis, (index, size) in enumerate(zip(key, self.shape)):
+            if isinstance(index, slice):
+                start, stop, step = index.indices(size)
+                if step < 0:
+                    # Read the covered range forwards and reverse it afterwards
+                    count = len(range(start, stop, step))
+                    start, stop = start + (count - 1) * step, start + 1
+                    if count == 0:
+                        start = stop = 0
+                ranges.append((start, max(start, stop)))
+                steps.append(step)
+            else:
+                index = int(index)
+                if index < 0:
+                    index += size
+                if not 0 <= index < size:
+                    raise IndexError(f"Index {index} is out of bounds for axis {axis}")
+                ranges.append((index, index + 1))
+                steps.append(1)
+                squeeze.append(axis)
+        data = self.read(ranges)
+        data = data[tuple(slice(None, None, step) for step in steps)]
+        return data.squeeze(axis=tuple(squeeze)) if squeeze else data
+
+    def read(self, ranges: list[tuple[int, int]]) -> np.ndarray:
+        """Read the region given as (start, stop) for every axis."""
+        out = np.full(
+            [stop - start for start, stop in ranges], self.fill_value, dtype=self.dtype
+        )
+        chunk_ranges = [
+            range(start // size, -(-stop // size)) if stop > start else range(0)
+            for (start, stop), size in zip(ranges, self.chunks)
+        ]
+        for index in product(*chunk_ranges):
+            chunk = self.read_chunk(index)
+            if chunk is None:
+                continue
+            src = []
+            dst = []
+            for i, (start, stop), size in zip(index, ranges, self.chunks):
+                first = max(start, i * size)
+                last = min(stop, (i + 1) * size)
+                src.append(slice(first - i * size, last - i * size))
+                dst.append(slice(first - start, last - start))
+            out[tuple(dst)] = chunk[tuple(src)]
+        return out
+
+    def read_chunk(self, index: tuple) -> Optional[np.ndarray]:
+        """Decode one chunk, None if it was never written (all fill value)."""
+        path = os.path.join(self.path, ".".join(str(i) for i in index))
+        try:
+            with open(path, "rb") as f:
+                data = f.read()
+        except FileNotFoundError:
+            return None
+        if self.codec is None:
+            chunk = np.frombuffer(data, dtype=self.dtype.newbyteorder("<"))
+            return chunk.reshape(self.chunks).astype(self.dtype)
+        chunk = self.codec.decode(data, self.chunks, self.bit_depth)
+        return chunk.astype(self.dtype, copy=False)
+
+    def to_array(self) -> np.ndarray:
+        """Read the whole cube."""
+        return self[:]
+
+
+class CubeWriter:
+    """
+    Writes line scan frames to a chunked hypercube on disk in the Zarr v2 directory layout:
+    chunks of chunk_lines lines along the scan axis, optionally split to chunks of band_chunk
+    bands and spatial_chunk pixels. Full chunks are encoded and written on a thread pool, so
+    push() can be called from the frame callback and the capture is bounded by disk, not RAM.
+    push() never waits: while writing is behind by more than the backlog limit, frames are
+    dropped and counted in dropped.
+
+    Plain zlib and zstd codecs are stored as standard Zarr compressors. Spectral delta and bit
+    packing are stored as the arnold.hypercube compressor, which only CubeReader can decode.
+
+    A new cube is written to path + ".partial" and renamed to path by close(), so path either
+    does not exist or holds a complete cube. With append=True frames are added to an existing
+    cube; its metadata is replaced only by close(), so readers see the old cube until then.
+    Codec and chunks of the cube are used, ValueError is raised if different ones are given.
+    """
+
+    def __init__(
+        self,
+        path: str,
+        codec: Optional[HypercubeCodec] = _UNSET,
+        chunk_lines: int = _UNSET,
+        band_chunk: Optional[int] = _UNSET,
+        spatial_chunk: Optional[int] = _UNSET,
+        attrs: Optional[dict] = None,
+        append: bool = False,
+        workers: Optional[int] = None,
+    ):
+        self.path = os.path.abspath(path)
+        self.codec = None if codec is _UNSET else codec
+        self.chunk_lines = DEFAULT_CHUNK_LINES if chunk_lines is _UNSET else chunk_lines
+        self.band_chunk = None if band_chunk is _UNSET else band_chunk
+        self.spatial_chunk = None if spatial_chunk is _UNSET else spatial_chunk
+        self.attrs = dict(attrs or {})
+        self.append = append
+        self.lines = 0
+        self.dropped = 0
+        self.frame_shape: Optional[tuple] = None
+        self.bit_depth: Optional[int] = None
+        self.dtype: Optional[np.dtype] = None
+        self._frames: list[np.ndarray] = []
+        self._block = 0
+        self._closed = False
+        self._overloaded = False
+        self._error: Optional[BaseException] = None
+        self._lock = threading.Lock()
+        self._pending: set[Future] = set()
+
+        if append and os.path.exists(self.path):
+            self._dir = self.path
+            self._open_existing()
+            self._check_layout(codec, chunk_lines, band_chunk, spatial_chunk)
+        else:
+            if os.path.exists(self.path):
+                raise FileExistsError(f"{self.path} already exists")
+            self.append = False
+            self._dir = self.path + PARTIAL_SUFFIX
+            if os.path.exists(self._dir):
+                logger.warning(f"Removing unfinished cube {self._dir}")
+                shutil.rmtree(self._dir)
+            os.makedirs(self._dir)
+
+        workers = workers or os.cpu_count() or 1
+        self._max_pending = 4 * workers
+        self._executor = ThreadPoolExecutor(
+            max_workers=workers, thread_name_prefix="cube-writer"
+        )
+
+    @property
+    def chunks(self) -> tuple[int, int, int]:
+        bands, spatial = self.frame_shape
+        return (
+            self.chunk_lines,
+            min(self.band_chunk or bands, bands),
+            min(self.spatial_chunk or spatial, spatial),
+        )
+
+    def push(self, frame, bit_depth) -> None:
+        """Add a frame (bands x spatial), multi-part frames are stacked along the bands."""
+        if isinstance(frame, tuple):
+            frame = np.concatenate(frame)
+            bit_depth = max(bit_depth)
+        if self.frame_shape is None:
+            self.frame_shape = frame.shape
+            self.bit_depth = bit_depth
+            self.dtype = sample_dtype(bit_depth)
+        elif frame.shape != self.frame_shape:
+            raise ValueError(
+                f"Frame shape {frame.shape} does not match the cube {self.frame_shape}"
+            )
+        if self._backlog_full():
+            return
+        self._frames.append(frame)
+        self.lines += 1
+        if len(self._frames) == self.chunk_lines:
+            self._submit()
+
+    def close(self) -> str:
+        """
+        Write the remaining lines, wait for all chunks and finalize the cube.
+        Returns the path of the cube.
+        """
+        if self._closed:
+            return self.path
+        self._closed = True
+        try:
+            if self._frames:
+                self._submit()
+            with self._lock:
+                pending = list(self._pending)
+            for future in pending:
+                future.exception()
+        finally:
+            self._executor.shutdown()
+        if self._error is not None:
+            self._discard()
+            raise self._error
+        if self.frame_shape is None:
+            self._discard()
+            raise ValueError("No frames were written")
+
+        meta = {
+            "zarr_format": 2,
+            "shape": [self.lines, *self.frame_shape],
+            "chunks": list(self.chunks),
+            "dtype": self.dtype.newbyteorder("<").str,
+            "compressor": _compressor_config(self.codec),
+            "fill_value": 0,
+            "order": "C",
+            "filters": None,
+            "dimension_separator": ".",
+        }
+        attrs = {**self.attrs, "bit_depth": self.bit_depth}
+        _write_atomic(
+            os.path.join(self._dir, ".zattrs"), json.dumps(attrs, indent=2).encode()
+        )
+        _write_atomic(
+            os.path.join(self._dir, ".zarray"), json.dumps(meta, indent=2).encode()
+        )
+        if not self.append:
+            os.rename(self._dir, self.path)
+        logger.info(f"Wrote {self.lines} lines to {self.path}")
+        if self.dropped:
+            logger.warning(f"Dropped {self.dropped} frames, writing did not keep up")
+        return self.path
+
+    def abort(self) -> None:
+        """Stop writing and leave path as it was before."""
+        self._closed = True
+        self._frames = []
+        self._executor.shutdown(cancel_futures=True)
+        self._discard()
+
+    def __enter__(self) -> "CubeWriter":
+        return self
+
+    def __exit__(self, exc_type, exc, tb) -> None:
+        if exc_type is None:
+            self.close()
+        else:
+            self.abort()
+
+    def _open_existing(self) -> None:
+        reader = CubeReader(self.path)
+        self.codec = reader.codec
+        self.chunk_lines, self.band_chunk, self.spatial_chunk = reader.chunks
+        self.attrs = {**reader.attrs, **self.attrs}
+        self.frame_shape = reader.shape[1:]
+        self.bit_depth = reader.bit_depth
+        self.dtype = reader.dtype
+        self.lines = reader.shape[0]
+        self._block = self.lines // self.chunk_lines
+        # Last chunks are not full, they are written again with the new lines
+        first_line = self._block * self.chunk_lines
+        if first_line < self.lines:
+            self._frames = list(reader[first_line:])
+
+    def _check_layout(self, codec, chunk_lines, band_chunk, spatial_chunk) -> None:
+        # Given parameters must describe the stored cube, they are not silently replaced
+        bands, spatial = self.frame_shape
+        checks = []
+        if codec is not _UNSET:
+            checks.append(
+                ("codec", _compressor_config(codec), _compressor_config(self.codec))
+            )
+        if chunk_lines is not _UNSET:
+            checks.append(("chunk_lines", chunk_lines, self.chunk_lines))
+        if band_chunk is not _UNSET:
+            checks.append(
+                ("band_chunk", min(band_chunk or bands, bands), self.band_chunk)
+            )
+        if spatial_chunk is not _UNSET:
+            checks.append(
+                (
+                    "spatial_chunk",
+                    min(spatial_chunk or spatial, spatial),
+                    self.spatial_chunk,
+                )
+            )
+        for name, value, stored in checks:
+            if value != stored:
+                raise ValueError(
+                    f"{name} {value} does not match {stored} of {self.path}"
+                )
+
+    def _submit(self) -> None:
+        block = np.stack(self._frames)
+        self._frames = []
+        index = self._block
+        self._block += 1
+        future = self._executor.submit(self._write_block, index, block)
+        with self._lock:
+            self._pending.add(future)
+        future.add_done_callback(self._done)
+
+    def _backlog_full(self) -> bool:
+        # Waiting would stall the stream callback, the frame is lost instead
+        with self._lock:
+            backlog = len(self._pending)
+        if backlog < self._max_pending:
+            self._overloaded = False
+            return False
+        if not self._overloaded:
+            logger.warning("Writing does not keep up with acquisition, dropping frames")
+            self._overloaded = True
+        self.dropped += 1
+        return True
+
+    def _done(self, future: Future) -> None:
+        err = future.exception() if not future.cancelled() else None
+        with self._lock:
+            self._pending.discard(future)
+            if err is not None:
+                self._error = self._error or err
+        if err is not None:
+            logger.error(f"Failed to write chunk: {err}")
+
+    def _write_block(self, index: int, block: np.ndarray) -> None:
+        lines, bands, spatial = self.chunks
+        # Chunks at the edges are stored full size, padded with the fill value
+        padded = np.zeros(
+            (
+                lines,
+                -(-block.shape[1] // bands) * bands,
+                -(-block.shape[2] // spatial) * spatial,
+            ),
+            dtype=self.dtype,
+        )
+        padded[: len(block), : block.shape[1], : block.shape[2]] = block
+        for b, s in product(
+            range(padded.shape[1] // bands), range(padded.shape[2] // spatial)
+        ):
+            chunk = padded[
+                :, b * bands : (b + 1) * bands, s * spatial : (s + 1) * spatial
+            ]
+            if self.codec is None:
+                data = np.ascontiguousarray(
+                    chunk, dtype=self.dtype.newbyteorder("<")
+                ).tobytes()
+            else:
+                data = self.codec.encode(chunk, self.bit_depth)
+            _write_atomic(os.path.join(self._dir, f"{index}.{b}.{s}"), data)
+
+    def _discard(self) -> None:
+        # Chunks appended to an existing cube are outside its shape and ignored by readers
+        if not self.append and os.path.exists(self._dir):
+            shutil.rmtree(self._dir)
@@ -0,0 +1,43 @@
+"""
+  Detection of defective pixels from dark and flat (white) reference statistics. Each band is
+  compared with the other pixels of the same band, as dark level and response change along the
+  spectral axis. The receiver replaces the detected pixels in every frame (see FXBase.set_bad_pixels).
+"""
+import numpy as np
+
+MAD_TO_SIGMA = 1.4826 # Median absolute deviation to standard deviation of normal distribution
+
+def _band_median(data: np.ndarray) -> np.ndarray:
+  return np.median(data, axis=1, keepdims=True)
+
+def detect_bad_pixels(dark: np.ndarray, noise: np.ndarray = None, white: np.ndarray = None, hot_sigma: float = 6.0, noise_factor: float = 5.0, dead_fraction: float = 0.5) -> np.ndarray:
+  """
+  Find hot, noisy and dead pixels.
+
+  :param dark: Mean dark frame (spectral x spatial), e.g. from FXBase.dark_ref_accumulate
+  :param noise: Standard deviation of the dark frames, noisy pixels are not detected if not given
+  :param white: Mean frame of a white reference, dead pixels are not detected if not given
+  :param hot_sigma: Dark level above the band median, in robust standard deviations of the band, of a hot pixel
+  :param noise_factor: Noise of a noisy pixel compared to the band median
+  :param dead_fraction: Response (white - dark) of a dead pixel compared to the band median
+  :returns: Bad pixel map, True for bad pixels
+  :raises ValueError: References have different shapes
+  """
+  dark = np.asarray(dark, dtype=np.float64)
+  if dark.ndim != 2:
+    raise ValueError("Dark reference must be a 2D array")
+  for other in (noise, white):
+    if other is not None and np.shape(other) != dark.shape:
+      raise ValueError("References must have the same shape")
+
+  # Robust spread of each band, at least one digital number
+  median = _band_median(dark)
+  sigma = np.maximum(_band_median(np.abs(dark - median)) * MAD_TO_SIGMA, 1.0)
+  mask = dark - median > hot_sigma * sigma
+  if noise is not None:
+    noise = np.asarray(noise, dtype=np.float64)
+    mask |= noise > noise_factor * np.maximum(_band_median(noise), 1.0)
+  if white is not None:
+    response = np.asarray(white, dtype=np.float64) - dark
+    mask |= response < dead_fraction * _band_median(response)
+  return mask
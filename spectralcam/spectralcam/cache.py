@@ -0,0 +1,261 @@
+"""
+  Persistent on-disk caches. Device description files are cached so reconnecting to a known camera
+  does not need to download the file from the camera memory again. Last applied configuration
+  profiles are cached per camera so an unchanged camera does not need to be configured again.
+  Bad pixel maps are kept per camera.
+"""
+import hashlib
+import json
+import os
+import tempfile
+from typing import Union
+
+import numpy as np
+
+CACHE_DIR_ENV = "SPECTRALCAM_CACHE_DIR"
+
+def cache_dir(subdir: str = None) -> str:
+  """
+  Get the cache directory and create it if it does not exist. Default is %LOCALAPPDATA%\\spectralcam
+  on Windows and $XDG_CACHE_HOME/spectralcam (~/.cache/spectralcam) elsewhere. It can be overridden
+  with SPECTRALCAM_CACHE_DIR environment variable.
+
+  :param subdir: Subdirectory inside the cache directory, optional
+  :returns: Path of the directory
+  :raises OSError: Directory cannot be created
+  """
+  path = os.environ.get(CACHE_DIR_ENV)
+  if path == None:
+    if os.name == "nt":
+      base = os.environ.get("LOCALAPPDATA", os.path.expanduser("~\\AppData\\Local"))
+    else:
+      base = os.environ.get("XDG_CACHE_HOME", os.path.expanduser("~/.cache"))
+    path = os.path.join(base, "spectralcam")
+  if subdir != None:
+    path = os.path.join(path, subdir)
+  os.makedirs(path, exist_ok=True)
+  return path
+
+def write_atomic(path: str, data: Union[bytes, str]) -> None:
+  """
+  Write a file so that readers see either the old or the new file, never a partially written one.
+
+  :param path: Path of the file
+  :param data: Content of the file
+  :returns: None
+  :raises OSError: File cannot be written
+  """
+  if type(data) == str:
+    data = data.encode("utf-8")
+  fd, tmp_path = tempfile.mkstemp(dir=os.path.dirname(path), prefix=".tmp-")
+  try:
+    with os.fdopen(fd, "wb") as file:
+      file.write(data)
+      file.flush()
+      os.fsync(file.fileno())
+    os.replace(tmp_path, path)
+  except:
+    os.remove(tmp_path)
+    raise
+
+class DeviceDescriptionCache:
+  """
+  Cache of raw device description files (zip or xml) keyed by the device description URL, model name
+  and device (firmware) version. Every file is stored with its SHA-256 checksum and corrupted files are
+  discarded on load.
+  """
+
+  def __init__(self, path: str = None) -> None:
+    """
+    :param path: Cache directory, default is device_descriptions in cache_dir()
+    """
+    self.path = path if path != None else cache_dir("device_descriptions")
+    self.verbose = False
+
+  def key(self, url: str, model: str, version: str) -> str:
+    """Get the file name (without extension) used for a device description."""
+    return hashlib.sha256(f"{url}\n{model}\n{version}".encode("utf-8")).hexdigest()
+
+  def get(self, url: str, model: str, version: str) -> Union[bytes, None]:
+    """
+    Get a cached device description file.
+
+    :param url: Device description URL read from the camera
+    :param model: Model name of the camera
+    :param version: Device version of the camera
+    :returns: Raw device description file or None if it is not cached (or it is corrupted)
+    """
+    base = os.path.join(self.path, self.key(url, model, version))
+    try:
+      with open(base + ".json", "r") as file:
+        meta = json.load(file)
+      with open(base + ".bin", "rb") as file:
+        data = file.read()
+    except (OSError, ValueError):
+      return None
+    if meta.get("url") != url or meta.get("model") != model or meta.get("version") != version:
+      return None
+    if hashlib.sha256(data).hexdigest() != meta.get("sha256"):
+      if self.verbose:
+        print(f"CACHE: Checksum mismatch, discarding device description of {model} {version}")
+      self.remove(url, model, version)
+      return None
+    if self.verbose:
+      print(f"CACHE: Device description of {model} {version} found")
+    return data
+
+  def put(self, url: str, model: str, version: str, data: bytes) -> None:
+    """
+    Save a device description file to the cache.
+
+    :param url: Device description URL read from the camera
+    :param model: Model name of the camera
+    :param version: Device version of the camera
+    :param data: Raw device description file
+    :returns: None
+    :raises OSError: File cannot be written
+    """
+    base = os.path.join(self.path, self.key(url, model, version))
+    meta = {"url": url, "model": model, "version": version, "sha256": hashlib.sha256(data).hexdigest(), "size": len(data)}
+    # Data first: metadata is the commit marker, so a half written entry is never valid
+    write_atomic(base + ".bin", data)
+    write_atomic(base + ".json", json.dumps(meta, indent=2))
+    if self.verbose:
+      print(f"CACHE: Device description of {model} {version} saved")
+
+  def remove(self, url: str, model: str, version: str) -> None:
+    """
+    Remove a device description file from the cache (if it exists).
+
+    :param url: Device description URL read from the camera
+    :param model: Model name of the camera
+    :param version: Device version of the camera
+    :returns: None
+    """
+    base = os.path.join(self.path, self.key(url, model, version))
+    for ext in (".json", ".bin"):
+      try:
+        os.remove(base + ext)
+      except FileNotFoundError:
+        pass
+
+  def clear(self) -> None:
+    """
+    Remove all cached device description files.
+
+    :returns: None
+    """
+    for name in os.listdir(self.path):
+      if name.endswith(".json") or name.endswith(".bin"):
+        os.remove(os.path.join(self.path, name))
+
+class ProfileCache:
+  """
+  Last applied configuration profile of each camera keyed by the serial number of the camera.
+  """
+
+  def __init__(self, path: str = None) -> None:
+    """
+    :param path: Cache directory, default is profiles in cache_dir()
+    """
+    self.path = path if path != None else cache_dir("profiles")
+
+  def get(self, serial: str) -> Union[dict, None]:
+    """
+    Get the last applied profile of a camera.
+
+    :param serial: Serial number of the camera
+    :returns: Profile (feature names and values) or None if it is not cached
+    """
+    try:
+      with open(self._file(serial), "r") as file:
+        data = json.load(file)
+    except (OSError, ValueError):
+      return None
+    if data.get("serial") != serial or type(data.get("profile")) != dict:
+      return None
+    return data["profile"]
+
+  def put(self, serial: str, profile: dict) -> None:
+    """
+    Save the applied profile of a camera.
+
+    :param serial: Serial number of the camera
+    :param profile: Profile (feature names and values)
+    :returns: None
+    :raises OSError: File cannot be written
+    """
+    write_atomic(self._file(serial), json.dumps({"serial": serial, "profile": profile}, indent=2))
+
+  def remove(self, serial: str) -> None:
+    """
+    Remove the cached profile of a camera (if it exists).
+
+    :param serial: Serial number of the camera
+    :returns: None
+    """
+    try:
+      os.remove(self._file(serial))
+    except FileNotFoundError:
+      pass
+
+  def _file(self, serial: str) -> str:
+    return os.path.join(self.path, hashlib.sha256(serial.encode("utf-8")).hexdigest() + ".json")
+
+class BadPixelCache:
+  """
+  Bad pixel map of each camera keyed by the serial number of the camera.
+  """
+
+  def __init__(self, path: str = None) -> None:
+    """
+    :param path: Cache directory, default is bad_pixels in cache_dir()
+    """
+    self.path = path if path != None else cache_dir("bad_pixels")
+
+  def get(self, serial: str) -> Union[np.ndarray, None]:
+    """
+    Get the bad pixel map of a camera.
+
+    :param serial: Serial number of the camera
+    :returns: Bad pixel map (True for bad pixels) or None if it is not cached
+    """
+    try:
+      with open(self._file(serial), "r") as file:
+        data = json.load(file)
+      if data.get("serial") != serial:
+        return None
+      mask = np.zeros(data["shape"], dtype=bool)
+      pixels = np.array(data["pixels"], dtype=np.int64).reshape(-1, 2)
+      mask[pixels[:, 0], pixels[:, 1]] = True
+    except (OSError, ValueError, KeyError, IndexError, TypeError):
+      return None
+    return mask
+
+  def put(self, serial: str, mask: np.ndarray) -> None:
+    """
+    Save the bad pixel map of a camera.
+
+    :param serial: Serial number of the camera
+    :param mask: Bad pixel map (2D array, True for bad pixels)
+    :returns: None
+    :raises OSError: File cannot be written
+    """
+    # Only the bad pixels are listed (spectral, spatial index)
+    pixels = np.argwhere(mask).tolist()
+    write_atomic(self._file(serial), json.dumps({"serial": serial, "shape": list(np.shape(mask)), "pixels": pixels}))
+
+  def remove(self, serial: str) -> None:
+    """
+    Remove the bad pixel map of a camera (if it exists).
+
+    :param serial: Serial number of the camera
+    :returns: None
+    """
+    try:
+      os.remove(self._file(serial))
+    except FileNotFoundError:
+      pass
+
+  def _file(self, serial: str) -> str:
+    return os.path.join(self.path, hashlib.sha256(serial.encode("utf-8")).hexdigest() + ".json")
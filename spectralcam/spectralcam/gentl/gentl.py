@@ -8,14 +8,16 @@
   Also note that this module supports GigE Vision devices only.
 """
 
+import selectors
 import socket
-from typing import Union
+import time
+from typing import Callable, Union
 
 import psutil
 from psutil._common import snicaddr
 
 from spectralcam.utils import ETH_MAX_MTU, netmask_to_short, ip_to_uint32, is_ipv4, is_normal_ip
-from spectralcam.gige import GVCP_PORT, GVCPRequestId, GVCPAck, GVCPDiscoveryAck, GVCPDiscoveryCmd, GVCPForceIPCmd
+from spectralcam.gige import GVCP_PORT, GVCPRequestId, GVCPAck, GVCPDiscoveryAck, GVCPDiscoveryCmd, GVCPForceIPCmd, GVCPActionCmd, GVCPActionAck
 from spectralcam.exceptions import AckError
 from spectralcam.preview import PreviewFactory
 
@@ -273,21 +275,17 @@ class GCInterface:
     self._open_devs.append(dev)
     return dev
 
-  def update_device_list(self, timeout: float = 0.5, ack_bcast: bool = False) -> None:
+  def update_device_list(self, timeout: float = 0.5, ack_bcast: bool = False, expected: int = None) -> None:
     """
-    Find all GigE Vision devices connected to this interface.
+    Find all GigE Vision devices connected to this interface. Discovery is sent from all addresses
+    of the interface at once (see also discover_devices to search several interfaces at once).
 
     :param timeout: Time to wait for an answer from devices (in seconds)
     :param ack_bcast: Allow cameras to broadcast their acknowledgement. Note that this application cannot receive broadcasted acknowledgements.
+    :param expected: Stop waiting when this many devices have answered, optional
     :raises RuntimeError: Interface is closed
     """
-    self._check_open()
-    self._existing_devs = {}
-    for i, addr in enumerate(self._info.addrs):
-      soc = self._socs[i]
-      soc.settimeout(timeout)
-      for discovery in self.gvcp_discovery(soc, ack_bcast):
-        self._existing_devs.update({ discovery.mac_address: GCDeviceInfo(addr.address, addr.netmask, discovery) })
+    discover_devices([self], timeout, ack_bcast, expected)
 
   def gvcp_discovery(self, soc: socket.socket, ack_bcast: bool = False) -> list[GVCPDiscoveryAck]:
     """
@@ -397,10 +395,114 @@ class GCInterface:
       data = sel_soc.recv(ETH_MAX_MTU)
       return GVCPAck(data)
 
+  def gvcp_action(self, device_key: int, group_key: int, group_mask: int, act_time: int = None, ack: bool = False, timeout: float = 0.2) -> list[GVCPActionAck]:
+    """
+    Broadcast GVCP ACTION command to all devices connected to this interface. A device executes the
+    action if its device key, group key and group mask match (ActionDeviceKey, ActionGroupKey and
+    ActionGroupMask features). With act_time the action is scheduled: devices execute it when their
+    timestamp reaches the given value, so devices with synchronized clocks (PTP) act at the same
+    time regardless of network delays. Devices must support scheduled actions (see
+    GVCP.scheduled_action_support), others ignore the command or act immediately.
+
+    :param device_key: Device key (see GigE Vision specs)
+    :param group_key: Group key (see GigE Vision specs)
+    :param group_mask: Group mask (see GigE Vision specs)
+    :param act_time: Device timestamp (in ticks) to execute the action at, immediately if not given
+    :param ack: Wait for acknowledgements from the devices
+    :param timeout: How long to wait for acknowledgements (in seconds)
+    :returns: Acknowledgements received within the timeout, empty if parameter 'ack' is False
+    :raises RuntimeError: Interface is closed
+    """
+    self._check_open()
+    selector = selectors.DefaultSelector()
+    acks = []
+    try:
+      # Send from every address first so that all devices get the command as close together as possible
+      for soc in self._socs:
+        request = GVCPActionCmd(self._req_id.get(), device_key, group_key, group_mask, ack, act_time)
+        try:
+          soc.sendto(request.data, ("255.255.255.255", GVCP_PORT))
+        except OSError:
+          continue
+        if ack:
+          selector.register(soc, selectors.EVENT_READ, request.req_id)
+
+      # Gather ACTION_ACKs, number of matching devices is not known so wait until the deadline
+      deadline = time.monotonic() + timeout
+      while selector.get_map():
+        remaining = deadline - time.monotonic()
+        if remaining <= 0:
+          break
+        for key, _ in selector.select(remaining):
+          try:
+            response = GVCPActionAck(key.fileobj.recv(ETH_MAX_MTU))
+          except OSError:
+            continue
+          except AckError as err:
+            # E.g. ACTION_LATE, the device timestamp was already past act_time
+            print(err.args[0])
+            continue
+          if response.ack_id == key.data:
+            acks.append(response)
+    finally:
+      selector.close()
+    return acks
+
   def _check_open(self):
     if not self.is_open:
       raise RuntimeError("Interface is closed")
 
+def discover_devices(interfaces: list[GCInterface], timeout: float = 0.5, ack_bcast: bool = False, expected: int = None, match: Callable[[GCDeviceInfo], bool] = None) -> None:
+  """
+  Find GigE Vision devices on several interfaces at once. Discovery is broadcasted from every
+  address of every interface before waiting, and the acknowledgements are gathered with a single
+  select loop, so the time is one timeout regardless of the number of interfaces. Found devices are
+  saved to the interfaces (see GCInterface.get_num_devices etc.).
+
+  :param interfaces: Open interfaces to search
+  :param timeout: Time to wait for answers from devices (in seconds)
+  :param ack_bcast: Allow cameras to broadcast their acknowledgement
+  :param expected: Stop waiting when this many (matching) devices have answered, optional
+  :param match: Count only devices for which this function returns True, optional
+  :raises RuntimeError: Interface is closed
+  """
+  selector = selectors.DefaultSelector()
+  found = 0
+  try:
+    for intf in interfaces:
+      intf._check_open()
+      intf._existing_devs = {}
+      for addr, soc in zip(intf._info.addrs, intf._socs):
+        request = GVCPDiscoveryCmd(intf._req_id.get(), ack_bcast)
+        try:
+          soc.sendto(request.data, ("255.255.255.255", GVCP_PORT))
+        except OSError:
+          # Address cannot broadcast (e.g. link is down)
+          continue
+        selector.register(soc, selectors.EVENT_READ, (intf, addr, request.req_id))
+
+    # Gather DISCOVERY_ACKs from all sockets until the deadline
+    deadline = time.monotonic() + timeout
+    while selector.get_map() and (expected == None or found < expected):
+      remaining = deadline - time.monotonic()
+      if remaining <= 0:
+        break
+      for key, _ in selector.select(remaining):
+        intf, addr, req_id = key.data
+        try:
+          data = key.fileobj.recv(ETH_MAX_MTU)
+          response = GVCPDiscoveryAck(data)
+        except (OSError, AckError):
+          continue
+        if response.ack_id != req_id or response.mac_address in intf._existing_devs:
+          continue
+        info = GCDeviceInfo(addr.address, addr.netmask, response)
+        intf._existing_devs.update({ response.mac_address: info })
+        if match == None or match(info):
+          found += 1
+  finally:
+    selector.close()
+
 class GCSystem:
   """
   Class to find GigE Vision cameras in local network.
@@ -526,26 +628,25 @@ class GCSystem:
         addrs = list(filter(lambda addr: (addr.family == socket.AF_INET and is_ipv4(addr.address)), addrs))
         self._existing_intfs.update({key: GCInterfaceInfo(key, addrs)})
 
-  def discover(self, device_type: DiscoverableGigeDevice, timeout: float = 0.2, all: bool = False) -> tuple[GCDevice, GCInterface]:
+  def discover(self, device_type: DiscoverableGigeDevice, timeout: float = 0.2, all: bool = False, expected: int = None) -> tuple[GCDevice, GCInterface]:
     """
     Short hand to search GigE Vision compatible devices (cameras). By default it will connect
     automatically if only one matching device is found. Otherwise user will be prompted to select a
-    device.
+    device. All interfaces are searched at once.
 
     :param device_type: Class that implements the device you are trying to connect to
     :param timeout: How long to wait for responses from devices
     :param all: Lists all devices and forces not to connect automatically
+    :param expected: Stop waiting when this many matching devices have answered, optional
     :returns: Instance of GenTL device (camera) and interface
     """
     dev_list: list[tuple[str, GCInterface]] = []
     inf_list: list[GCInterface] = []
 
-    # Find all devices from all interfaces
+    # Open all interfaces with a normal IP address
     self.update_interface_list()
     inf_len = self.get_num_interfaces()
     for inf_index in range(inf_len):
-
-      # Open an interface
       inf_id = self.get_interface_id(inf_index)
       filtered_inf = tuple(filter(lambda inf: inf.get_info(IF_INFO_ID) == inf_id, self.open_interfaces))
       if len(filtered_inf) > 0:
@@ -554,18 +655,17 @@ class GCSystem:
         inf = self.open_interface(inf_id)
       inf_list.append(inf)
 
-      # Find devices connected to the interface
-      inf_addrs = inf.get_info().addrs
-      inf_addrs = list(filter(is_normal_ip, inf_addrs))
-      if len(inf_addrs) > 0:
-        inf.update_device_list(timeout)
-        dev_len = inf.get_num_devices()
-        for dev_index in range(dev_len):
-          dev_id = inf.get_device_id(dev_index)
-          dev_vendor = inf.get_device_info(dev_id, DEV_INFO_VENDOR)
-          dev_model = inf.get_device_info(dev_id, DEV_INFO_MODEL)
-          if all or (device_type.DEV_INFO_VENDOR == dev_vendor and device_type.DEV_INFO_MODEL == dev_model):
-            dev_list.append((dev_id, inf))
+    # Find devices connected to all interfaces at once
+    def is_match(dev_info: GCDeviceInfo) -> bool:
+      return all or (device_type.DEV_INFO_VENDOR == dev_info.get(DEV_INFO_VENDOR) and device_type.DEV_INFO_MODEL == dev_info.get(DEV_INFO_MODEL))
+    search_list = [inf for inf in inf_list if len(list(filter(is_normal_ip, inf.get_info().addrs))) > 0]
+    discover_devices(search_list, timeout, expected=expected, match=is_match)
+    for inf in search_list:
+      dev_len = inf.get_num_devices()
+      for dev_index in range(dev_len):
+        dev_id = inf.get_device_id(dev_index)
+        if is_match(inf.get_device_info(dev_id)):
+          dev_list.append((dev_id, inf))
 
     # Select device to open from found devices
     open_device: GCDevice = None
@@ -1,2 +1,5 @@
 from .gvcp import *
+from .description import *
+from .message import *
+from .gvcp_async import *
 from . import gvsp
@@ -0,0 +1,270 @@
+"""
+  Lightweight reader for GenICam device description files. GenAPI (genicam package) does the real
+  work with the features, this module only collects the information the GVCP layer needs: where the
+  registers are, how they may be cached and how the nodes are linked to each other.
+"""
+import xml.etree.ElementTree as ET
+from typing import Union
+
+# Cachable attribute values of register nodes (default is write through)
+CACHE_NONE = "NoCache"
+CACHE_WRITE_THROUGH = "WriteThrough"
+CACHE_WRITE_AROUND = "WriteAround"
+
+REGISTER_TAGS = ("Register", "IntReg", "MaskedIntReg", "FloatReg", "StringReg", "StructReg")
+VALUE_LINKS = ("pValue", "pValueCopy", "pValueIndexed", "pValueDefault")
+"""Links that are followed when a value is written to a node."""
+
+def _tag(element: ET.Element) -> str:
+  return element.tag.rsplit("}", 1)[-1]
+
+def _child_text(element: ET.Element, name: str) -> Union[str, None]:
+  for child in element:
+    if _tag(child) == name and child.text != None:
+      return child.text.strip()
+  return None
+
+def _parse_int(text: str) -> int:
+  return int(text, 0)
+
+def _parse_links(element: ET.Element) -> list[tuple[str, str]]:
+  return [(_tag(child), child.text.strip()) for child in element if _tag(child).startswith("p") and child.text != None]
+
+class RegisterInfo:
+  """Register of the device port described in the device description file."""
+  def __init__(self, name: str, address: int, length: int, cachable: str, polling_time: Union[float, None], invalidators: list[str]) -> None:
+    self.name = name
+    self.address = address
+    self.length = length
+    self.cachable = cachable
+    self.polling_time = polling_time
+    """Time in seconds after which a cached value is stale, None if the value does not change by itself"""
+    self.invalidators = invalidators
+    """Names of the nodes that invalidate this register when written"""
+
+  def __repr__(self) -> str:
+    return f"RegisterInfo({self.name}, 0x{self.address:08x}, {self.length}, {self.cachable})"
+
+class DeviceDescription:
+  """
+  Registers and node links of a GenICam device description file. Only registers with a constant
+  address on the device port are listed, others (indexed, chunk port etc.) are always read from the camera.
+  """
+
+  def __init__(self, xml_str: str) -> None:
+    """
+    :param xml_str: Device description file XML
+    :raises xml.etree.ElementTree.ParseError: Invalid XML
+    """
+    root = ET.fromstring(xml_str)
+    self.registers = {}
+    """Registers by node name"""
+    self.commands = set()
+    """Names of command nodes"""
+    self.events = {}
+    """Event IDs by node name (nodes with EventID, e.g. ports of event data)"""
+    self._links = {}
+    self._polling = {}
+    for element in root.iter():
+      name = element.get("Name")
+      tag = _tag(element)
+      if tag == "StructReg":
+        # Struct register has no name, its entries are the features
+        self._add_struct(element)
+        continue
+      if name == None or tag == "StructEntry":
+        continue
+      self._links[name] = _parse_links(element)
+      polling_time = _child_text(element, "PollingTime")
+      if polling_time != None:
+        self._polling[name] = int(polling_time) / 1000
+      event_id = _child_text(element, "EventID")
+      if event_id != None:
+        self.events[name] = int(event_id, 16)
+      if tag == "Command":
+        self.commands.add(name)
+      elif tag in REGISTER_TAGS:
+        self._add_register(name, element)
+
+    # Polling time of a feature applies to the registers it reads
+    for name, polling_time in self._polling.items():
+      for reg_name in self.registers_of(name):
+        reg = self.registers[reg_name]
+        if reg.polling_time == None or polling_time < reg.polling_time:
+          reg.polling_time = polling_time
+
+    # Commands are done when the camera clears the register, never cache them
+    for name in self.commands:
+      for reg_name in self.registers_of(name):
+        self.registers[reg_name].cachable = CACHE_NONE
+
+    # Lookup tables for the port
+    self._by_address = {}
+    for reg in self.registers.values():
+      # Struct entries share the register, the strictest caching wins
+      other = self._by_address.get((reg.address, reg.length))
+      if other == None or other.cachable == CACHE_WRITE_THROUGH or reg.cachable == CACHE_NONE:
+        self._by_address[(reg.address, reg.length)] = reg
+    self._invalidates = {}
+    for reg in self.registers.values():
+      for invalidator in reg.invalidators:
+        for source_name in self.registers_of(invalidator):
+          source = self.registers[source_name]
+          self._invalidates.setdefault((source.address, source.length), []).append(reg)
+
+  def links(self, name: str) -> list[str]:
+    """
+    Get names of the nodes a node refers to (pValue, pMin, pIsAvailable etc.).
+
+    :param name: Name of the node
+    :returns: Node names, empty if the node does not exist
+    """
+    return [target for link, target in self._links.get(name, []) if link not in ("pPort", "pInvalidator")]
+
+  def registers_of(self, name: str) -> set[str]:
+    """
+    Get the registers that hold the value of a node by following the value links.
+
+    :param name: Name of the node
+    :returns: Register names
+    """
+    found = set()
+    visited = set()
+    stack = [name]
+    while stack:
+      node = stack.pop()
+      if node in visited:
+        continue
+      visited.add(node)
+      if node in self.registers:
+        found.add(node)
+      stack.extend(target for link, target in self._links.get(node, []) if link in VALUE_LINKS)
+    return found
+
+  def registers_read_by(self, name: str) -> set[str]:
+    """
+    Get all registers GenAPI may read to access a node: value, limits, availability etc.
+
+    :param name: Name of the node
+    :returns: Register names
+    """
+    found = set()
+    visited = set()
+    stack = [name]
+    while stack:
+      node = stack.pop()
+      if node in visited:
+        continue
+      visited.add(node)
+      if node in self.registers:
+        found.add(node)
+      stack.extend(self.links(node))
+    return found
+
+  def affected_by(self, name: str, other: str) -> bool:
+    """
+    Check if value, limits or availability of a feature may change when another feature is written:
+    a register the feature reads is written by the other feature or invalidated by it.
+
+    :param name: Name of the feature
+    :param other: Name of the written feature
+    :returns: True if the feature depends on the other feature
+    """
+    if name == other:
+      return False
+    writes = self.registers_of(other)
+    for reg_name in self.registers_read_by(name):
+      if reg_name in writes:
+        return True
+      for invalidator in self.registers[reg_name].invalidators:
+        if invalidator == other or self.registers_of(invalidator) & writes:
+          return True
+    return False
+
+  def dependency_order(self, names: list[str]) -> list[str]:
+    """
+    Sort features so that a feature comes after the features its value, limits or availability
+    depend on (e.g. Width after BinningHorizontal). Otherwise the given order is kept.
+
+    :param names: Names of the features
+    :returns: Names in dependency order
+    """
+    after = {name: [other for other in names if self.affected_by(name, other)] for name in names}
+    ordered = []
+    remaining = list(names)
+    while remaining:
+      ready = [name for name in remaining if all(other not in remaining for other in after[name])]
+      # Circular dependency, keep the given order for the rest
+      name = ready[0] if ready else remaining[0]
+      ordered.append(name)
+      remaining.remove(name)
+    return ordered
+
+  def find_events(self, text: str) -> dict[str, int]:
+    """
+    Find events by name.
+
+    :param text: Text to search from event names (case insensitive)
+    :returns: Event IDs by node name
+    """
+    return {name: event_id for name, event_id in self.events.items() if text.lower() in name.lower()}
+
+  def get_register(self, address: int, length: int) -> Union[RegisterInfo, None]:
+    """
+    Get register by the address.
+
+    :param address: Address of the register
+    :param length: Length of the register in bytes
+    :returns: Register or None if it is not in the device description file
+    """
+    return self._by_address.get((address, length))
+
+  def invalidated_by(self, address: int, length: int) -> list[RegisterInfo]:
+    """
+    Get the registers that must be invalidated when a register is written (pInvalidator).
+
+    :param address: Address of the written register
+    :param length: Length of the written register in bytes
+    :returns: Registers to invalidate
+    """
+    return self._invalidates.get((address, length), [])
+
+  def _add_register(self, name: str, element: ET.Element) -> None:
+    reg = self._parse_register(name, element, self._links[name])
+    if reg != None:
+      self.registers[name] = reg
+
+  def _add_struct(self, element: ET.Element) -> None:
+    links = _parse_links(element)
+    for entry in element:
+      name = entry.get("Name")
+      if _tag(entry) != "StructEntry" or name == None:
+        continue
+      self._links[name] = links + _parse_links(entry)
+      polling_time = _child_text(entry, "PollingTime")
+      if polling_time != None:
+        self._polling[name] = int(polling_time) / 1000
+      reg = self._parse_register(name, element, self._links[name])
+      if reg != None:
+        reg.cachable = _child_text(entry, "Cachable") or reg.cachable
+        self.registers[name] = reg
+
+  def _parse_register(self, name: str, element: ET.Element, links: list[tuple[str, str]]) -> Union[RegisterInfo, None]:
+    if _child_text(element, "pPort") not in (None, "Device"):
+      return None
+    address = 0
+    for child in element:
+      tag = _tag(child)
+      if tag == "Address":
+        address += _parse_int(child.text.strip())
+      elif tag in ("pAddress", "IntSwissKnife", "pIndex"):
+        # Address is not constant
+        return None
+    length = _child_text(element, "Length")
+    if length == None or _child_text(element, "pLength") != None:
+      return None
+    cachable = _child_text(element, "Cachable") or CACHE_WRITE_THROUGH
+    polling_time = _child_text(element, "PollingTime")
+    polling_time = int(polling_time) / 1000 if polling_time != None else None
+    invalidators = [target for link, target in links if link == "pInvalidator"]
+    return RegisterInfo(name, address, _parse_int(length), cachable, polling_time, invalidators)
@@ -7,9 +7,12 @@
   been done already as PortGVCP class provides the port interface for official
   GenAPI implementation to access cameras GVCP registers.
 """
+from concurrent.futures import Future, TimeoutError as FutureTimeoutError
 import io
+import os
 import socket
 import threading
+import time
 from typing import Iterable, Union, Any
 import zipfile
 
@@ -18,6 +21,8 @@ from genicam.genapi import AbstractPort, EAccessMode
 
 from spectralcam.utils import *
 from spectralcam.exceptions import *
+from spectralcam.cache import DeviceDescriptionCache
+from spectralcam.gige.description import DeviceDescription, RegisterInfo, CACHE_NONE, CACHE_WRITE_THROUGH
 
 # Misc general GVCP constants
 GVCP_KEY = 0x42
@@ -26,6 +31,9 @@ GVCP_HEADER_SIZE = 8
 GVCP_MAX_PAYLOAD_SIZE = IP4_MAX_MTU - (IP4_HEADER_SIZE + UDP_HEADER_SIZE + GVCP_HEADER_SIZE)
 READMEM_HEADER_SIZE = 4
 READMEM_MAX_PAYLOAD_SIZE = GVCP_MAX_PAYLOAD_SIZE - READMEM_HEADER_SIZE
+READREG_MAX_COUNT = GVCP_MAX_PAYLOAD_SIZE // 4 # registers in one READREG
+WRITEREG_MAX_COUNT = GVCP_MAX_PAYLOAD_SIZE // 8 # registers in one WRITEREG
+GVCP_RECEIVER_TICK = 0.02 # in seconds, how often timeouts of requests in flight are checked
 # TODO Support for extended id?
 
 # GVCP command and acknowledgement codes
@@ -121,6 +129,10 @@ REG_CCP = 0x00000A00
 VAL_CONTROL_ACCESS = 0x00000002
 REG_HEARTBEAT_TIMEOUT = 0x00000938
 REG_GVCP_CAPABILITY = 0x00000934
+REG_SCPS0 = 0x00000D04
+VAL_SCPS_FIRE_TEST = 0x80000000
+VAL_SCPS_DO_NOT_FRAGMENT = 0x40000000
+VAL_SCPS_PACKET_SIZE = 0x0000FFFF
 
 # GVCP device mode: Endianess
 DEV_MODE_LITTLE_ENDIAN = 0
@@ -189,14 +201,26 @@ class GVCPRequestId:
   """Class to get an unique request ID for GVCP commands."""
   def __init__(self) -> None:
     self.__req_id = 1
+    self.__lock = threading.Lock()
 
   def get(self) -> int:
-    req_id = self.__req_id
-    self.__req_id += 1
-    if self.__req_id > 65535:
-      self.__req_id = 1
+    with self.__lock:
+      req_id = self.__req_id
+      self.__req_id += 1
+      if self.__req_id > 65535:
+        self.__req_id = 1
     return req_id
 
+class GVCPInFlight:
+  """Request sent by GVCP request engine and waiting for an acknowledgement."""
+  def __init__(self, request: "GVCPCmd", timeout: float) -> None:
+    self.request = request
+    self.future = Future()
+    self.attempts = 1
+    self.pending = False
+    self.extension = 0.0
+    self.deadline = time.monotonic() + timeout
+
 class GVCPCmd:
   """Create GVCP command header. Base class for all GVCP commands."""
 
@@ -314,8 +338,8 @@ class GVCPReadRegCmd(GVCPCmd):
   def __init__(self, req_id: int, addrs: list[int]) -> None:
     if len(addrs) < 1:
       raise ValueError("GVCP ERROR: At least one address is needed")
-    if len(addrs) > 135:
-      raise ValueError("GVCP ERROR: Cannot read over 135 addresses at once")
+    if len(addrs) > READREG_MAX_COUNT:
+      raise ValueError(f"GVCP ERROR: Cannot read over {READREG_MAX_COUNT} addresses at once")
     payload = bytes([])
     for i in range(len(addrs)):
       if not is_uint32_4_multiple(addrs[i]):
@@ -343,8 +367,8 @@ class GVCPWriteRegCmd(GVCPCmd):
   def __init__(self, req_id: int, addrs: list[int], values: Union[bytes, list[Union[int, float]]], ack: bool = True) -> None:
     if len(addrs) < 1:
       raise ValueError("GVCP ERROR: At least one address is needed")
-    if len(addrs) > 67:
-      raise ValueError("GVCP ERROR: Cannot write over 67 addresses at once")
+    if len(addrs) > WRITEREG_MAX_COUNT:
+      raise ValueError(f"GVCP ERROR: Cannot write over {WRITEREG_MAX_COUNT} addresses at once")
     if type(values) == bytes:
       dt = np.dtype(np.uint32).newbyteorder(">")
       values = list(np.frombuffer(values, dt))
@@ -840,10 +864,17 @@ class GVCP:
     self._soc_lock = threading.Lock()
     self._soc_timeout = 0.5 # in seconds
     self._req_id = GVCPRequestId()
-    self._pending = False
     self.retries = 3
     """Number of times to retry a command before raising an error."""
 
+    # Request engine: one receiver thread passes acks to waiting requests by ID
+    self._in_flight = {}
+    self._in_flight_cond = threading.Condition()
+    self._receiver_thread = None
+    self._receiver_stop = threading.Event()
+    self.max_outstanding = 4
+    """Number of requests in flight. Dropped to 1 if the device answers BUSY or drops requests."""
+
     # Heartbeat
     self._heartbeat_timeout = 5.0 # in seconds
     self._heartbeat_rate = self._heartbeat_timeout / 3 # in seconds
@@ -868,7 +899,8 @@ class GVCP:
   @property
   def pending(self) -> bool:
     """Received PENDING_ACK and waiting for the actual response."""
-    return self._pending
+    with self._in_flight_cond:
+      return any(state.pending for state in self._in_flight.values())
 
   @property
   def ack_timeout(self) -> float:
@@ -878,7 +910,6 @@ class GVCP:
   @ack_timeout.setter
   def ack_timeout(self, timeout: float) -> None:
     self._soc_timeout = timeout
-    self._soc.settimeout(timeout)
 
   @property
   def heartbeat_timeout(self) -> float:
@@ -911,23 +942,27 @@ class GVCP:
     try:
       self._soc = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
       # TODO Fetch GVCP pending timeout from device register 0x0958 if it is implemented
-      self._soc.settimeout(self._soc_timeout)
+      self._soc.settimeout(GVCP_RECEIVER_TICK)
       self._soc.connect((addr, port))
+      self._receiver_stop.clear()
+      self._receiver_thread = threading.Thread(target=self._receive, daemon=True)
+      self._receiver_thread.start()
     finally:
       self._soc_lock.release()
-    self.writereg(REG_CCP, VAL_CONTROL_ACCESS)
-    self.writereg(REG_HEARTBEAT_TIMEOUT, round(self._heartbeat_timeout * 1000))
-    ccp_status = self.readreg(REG_CCP, int)
+    try:
+      self.writereg(REG_CCP, VAL_CONTROL_ACCESS)
+      self.writereg(REG_HEARTBEAT_TIMEOUT, round(self._heartbeat_timeout * 1000))
+      ccp_status = self.readreg(REG_CCP, int)
+    except:
+      self._close()
+      raise
     if ccp_status == VAL_CONTROL_ACCESS:
       self._heartbeat_thread = threading.Thread(target=self._heartbeat)
       self._heartbeat_thread.start()
       if self.verbose:
         print("GVCP: Connected")
     else:
-      self._soc_lock.acquire()
-      self._soc.close()
-      self._soc = None
-      self._soc_lock.release()
+      self._close()
       raise NotConnectedError(f"GVCP ERROR: Could not connect\nCCP register value: 0x{ccp_status:x}")
 
   def disconnect(self) -> None:
@@ -945,10 +980,7 @@ class GVCP:
     self.writereg(REG_CCP, 0)
     self._heartbeat_thread.join()
     self._heartbeat_disable.clear()
-    self._soc_lock.acquire()
-    self._soc.close()
-    self._soc = None
-    self._soc_lock.release()
+    self._close()
     if self.verbose:
       print("GVCP: Disconnected")
 
@@ -1117,6 +1149,70 @@ class GVCP:
       if self.verbose:
         print(response)
 
+  def readmem_bulk(self, addr: int, length: int) -> bytes:
+    """
+    Read a block of camera memory of any length. Memory is read with the largest READMEM requests
+    GVCP allows and several requests are kept in flight (see max_outstanding).
+
+    :param addr: First register address
+    :param length: Amount of bytes to read
+    :returns: Content of the memory
+    :raises NotConnectedError: No connection
+    :raises ValueError: Invalid value of address
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises socket.timeout: Camera didn't send an acknowledgement in time
+    """
+    if not self.connected:
+      raise NotConnectedError("GVCP ERROR: Not connected, call gvcp.connect() first")
+    if length < 1:
+      raise ValueError("GVCP ERROR: Length must be greater than 0")
+
+    # Count of each request must be multiple of 4, extra bytes of the last one are dropped
+    requests = []
+    for offset in range(0, length, READMEM_MAX_PAYLOAD_SIZE):
+      count = min(READMEM_MAX_PAYLOAD_SIZE, length - offset)
+      count += (4 - count % 4) % 4
+      requests.append(GVCPReadMemCmd(self._req_id.get(), addr + offset, count))
+    responses = self._request_many(requests)
+
+    data = bytearray()
+    for request, ack in zip(requests, responses):
+      response = GVCPReadMemAck(ack)
+      if response.addr != request.addr:
+        raise AckValueError("GVCP ERROR: Acknowledged address was different to requested address", request.addr, response.addr)
+      data += response.get_values(bytes)
+    return bytes(data[:length])
+
+  def writemem_bulk(self, addr: int, value: bytes) -> None:
+    """
+    Write a block of camera memory of any length, e.g. to upload a file. Memory is written with the
+    largest WRITEMEM requests GVCP allows and several requests are kept in flight (see max_outstanding).
+
+    :param addr: First register address
+    :param value: Bytes to write to camera memory (padded with zeros to multiple of 4)
+    :returns: None
+    :raises NotConnectedError: No connection
+    :raises NotImplementedError: Device does not support WRITEMEM command
+    :raises ValueError: Invalid address or value
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises socket.timeout: Camera didn't send an acknowledgement in time
+    """
+    if not self.connected:
+      raise NotConnectedError("GVCP ERROR: Not connected, call gvcp.connect() first")
+
+    # Check support for WRITEMEM command
+    if self.writemem_support == None:
+      self._check_capability()
+    if not self.writemem_support:
+      raise NotImplementedError("GVCP ERROR: Device does not support WRITEMEM command")
+
+    requests = []
+    for offset in range(0, len(value), READMEM_MAX_PAYLOAD_SIZE):
+      chunk = value[offset:offset + READMEM_MAX_PAYLOAD_SIZE]
+      requests.append(GVCPWriteMemCmd(self._req_id.get(), addr + offset, chunk))
+    for ack in self._request_many(requests):
+      GVCPWriteMemAck(ack)
+
   def action(self, device_key: int, group_key: int, group_mask: int, ack: bool = True, act_time: int = None) -> None:
     """
     Send action command to the camera. Note that this method cannot be used for broadcasting.
@@ -1175,11 +1271,13 @@ class GVCP:
       print("GVCP: Read device description URL")
     return url if return_type == str else DeviceDescriptionUrl(url)
 
-  def get_device_description_file(self, path: str = None) -> str:
+  def get_device_description_file(self, path: str = None, cache: DeviceDescriptionCache = None, device: GVCPDiscoveryAck = None) -> str:
     """
     Get the device description file automatically. Optionally you specify where to save the file.
 
     :param path: Path where to save the file on hard drive, optional
+    :param cache: Cache to load the file from and to save downloaded file to, optional
+    :param device: Device info for the cache key (model and version), discovery is sent if not given
     :returns: Device description file XML
     :raises NotConnectedError: No connection
     :raises AckError: Problem with an acknowledgement from the camera
@@ -1191,47 +1289,27 @@ class GVCP:
       raise NotConnectedError("GVCP ERROR: Not connected, call gvcp.connect() first")
 
     # Fetch address for device description file
-    url = self.get_device_description_url(DeviceDescriptionUrl)
+    url_str = self.get_device_description_url(str)
+    url = DeviceDescriptionUrl(url_str)
 
     # Device description file is saved on the local machine
     if url.location == "file":
-      if url.extension == "xml":
-        file = open(url.url)
-        xml_str = file.read()
-      elif url.extension == "zip":
-        file = zipfile.ZipFile(url.url)
-        xml_str = file.read(file.namelist()[0]).decode("utf-8")
-      else:
-        raise AckValueError(f"GVCP ERROR: Unsupported device description file format: {url.extension}", None, url.extension)
+      with open(url.url, "rb") as file:
+        ddf = file.read()
 
     # Device description file is saved on the camera memory
     elif url.location == "local":
-      addr = url.address
-      len_total = url.length
-      len_left = len_total
-      packet_size = 512
-
-      # Fetch device decription file in 512 byte chunks
-      ddf = bytes()
-      while len_left >= packet_size:
-        ddf_part = self.readmem(addr, packet_size, bytes)
-        ddf = ddf + ddf_part
-        addr += packet_size
-        len_left -= packet_size
-      if len_left % 4:
-        len_left = len_left + 4 - (len_left % 4)
-      ddf_part = self.readmem(addr, len_left, bytes)
-      ddf = ddf + ddf_part
-      ddf = ddf[:len_total]
-
-      # Unzip if needed and save to string
-      if url.extension == "xml":
-        xml_str = ddf
-      if url.extension == "zip":
-        z_file = zipfile.ZipFile(io.BytesIO(ddf))
-        xml_str = z_file.read(z_file.namelist()[0]).decode("utf-8")
-      else:
-        raise AckValueError(f"GVCP ERROR: Unsupported device description file format: {url.extension}", None, url.extension)
+      ddf = None
+      if cache != None:
+        if device == None:
+          device = self.discovery(GVCPDiscoveryAck)
+        ddf = cache.get(url_str, device.model_name, device.device_version)
+      if ddf == None:
+        ddf = self._read_device_description(url)
+        if cache != None:
+          cache.put(url_str, device.model_name, device.device_version, ddf)
+      elif self.verbose:
+        print("GVCP: Device description file loaded from cache")
 
     # Device description file is saved on the internet
     elif url.location == "http":
@@ -1239,40 +1317,193 @@ class GVCP:
     else:
       raise AckValueError(f"GVCP ERROR: Unsupported device description file location: {url.location}", None, url.location)
 
+    # Unzip if needed and save to string
+    if url.extension == "xml":
+      xml_str = ddf.decode("utf-8")
+    elif url.extension == "zip":
+      z_file = zipfile.ZipFile(io.BytesIO(ddf))
+      xml_str = z_file.read(z_file.namelist()[0]).decode("utf-8")
+    else:
+      raise AckValueError(f"GVCP ERROR: Unsupported device description file format: {url.extension}", None, url.extension)
+
     # Save xml if path is given
     if (path != None):
-      z_file.extractall(path)
+      if url.extension == "zip":
+        z_file.extractall(path)
+      else:
+        with open(os.path.join(path, url.file_name), "w", encoding="utf-8") as file:
+          file.write(xml_str)
       if self.verbose:
         print(f"GVCP: Device description file saved to: {path}")
     return xml_str
 
-  def _request(self, request: GVCPCmd) -> GVCPAck:
-    self._soc_lock.acquire()
-    try:
-      response = self._exec_request(request, 1)
-    finally:
-      self._soc_lock.release()
-    return response
+  def _read_device_description(self, url: DeviceDescriptionUrl) -> bytes:
+    ddf = self.readmem_bulk(url.address, url.length)
+    if self.verbose:
+      print("GVCP: Device description file read from camera memory")
+    return ddf
 
-  def _exec_request(self, request: GVCPCmd, retry: int) -> GVCPAck:
-    response = None
+  def _request(self, request: GVCPCmd) -> GVCPAck:
+    data = self._result(request, self._submit(request))
+    if data == None:
+      return None
+    return self._handle_ack(data, request.req_id)
+
+  def _request_many(self, requests: list[GVCPCmd]) -> list[GVCPAck]:
+    # Requests are sent as soon as there is room in flight, acks are handled in request order
+    futures = [self._submit(request) for request in requests]
+    return [self._handle_ack(self._result(request, future), request.req_id) for request, future in zip(requests, futures)]
+
+  def _submit(self, request: GVCPCmd) -> Future:
+    future = None
+    with self._in_flight_cond:
+      if request.ack:
+        while self.connected and len(self._in_flight) >= max(1, self.max_outstanding):
+          self._in_flight_cond.wait(self._soc_timeout)
+      if not self.connected:
+        raise NotConnectedError("GVCP ERROR: Not connected, call gvcp.connect() first")
+      if request.ack:
+        state = GVCPInFlight(request, self._soc_timeout)
+        self._in_flight[request.req_id] = state
+        future = state.future
+      self._send(request)
+    if future == None:
+      future = Future()
+      future.set_result(None)
+    return future
+
+  def _result(self, request: GVCPCmd, future: Future) -> bytes:
+    # Receiver thread resolves the future, wait is bounded in case it cannot
+    with self._in_flight_cond:
+      state = self._in_flight.get(request.req_id)
+    start = time.monotonic()
+    while True:
+      extension = state.extension if state != None else 0
+      remaining = start + (self.retries + 1) * self._soc_timeout + extension - time.monotonic()
+      try:
+        return future.result(max(remaining, 0))
+      except FutureTimeoutError:
+        if future.done():
+          raise
+        # Keep waiting only if the device asked for more time meanwhile
+        if state == None or state.extension == extension:
+          break
+    with self._in_flight_cond:
+      if self._in_flight.get(request.req_id) is state:
+        del self._in_flight[request.req_id]
+        self._in_flight_cond.notify_all()
+    raise socket.timeout(f"GVCP ERROR: No acknowledgement for {request.cmd_name}, id: {request.req_id}")
+
+  def _send(self, request: GVCPCmd) -> None:
     req_len = self._soc.send(request.data)
     if self.debug:
       print(f"GVCP: Sent {request.cmd_name}, id: {request.req_id}, length: {req_len} bytes")
-    if request.ack:
+
+  def _receive(self) -> None:
+    soc = self._soc
+    while not self._receiver_stop.is_set():
       try:
-        response = self._handle_ack(self._soc.recv(ETH_MAX_MTU), request.req_id)
-        while self._pending:
-          response = self._handle_ack(self._soc.recv(ETH_MAX_MTU), request.req_id)
-      except socket.timeout as err_timeout:
-        if retry < self.retries:
+        data = soc.recv(ETH_MAX_MTU)
+      except socket.timeout:
+        data = None
+      except (ConnectionRefusedError, ConnectionResetError):
+        # ICMP error from a previous send, requests are retried on timeout
+        data = None
+      except OSError as e:
+        if not self._receiver_stop.is_set():
+          print(f"GVCP WARNING: Receiver stopped: {e}")
+          self._fail_in_flight(NotConnectedError(f"GVCP ERROR: Connection lost: {e}"))
+        break
+      try:
+        if data != None and len(data) >= GVCP_HEADER_SIZE:
+          self._route_ack(data)
+        self._check_timeouts()
+      except Exception as e:
+        print(f"GVCP WARNING: Error in receiver: {e}")
+
+  def _route_ack(self, data: bytes) -> None:
+    ack_id = bytes_to_uint16(data[6:8])
+    with self._in_flight_cond:
+      state = self._in_flight.get(ack_id)
+      if state == None:
+        # Late ack of a retransmitted or timed out request
+        if self.debug:
+          print(f"GVCP: Ignored acknowledgement, id: {ack_id}")
+        return
+
+      # Device is working on it, wait for the time it tells
+      if bytes_to_uint16(data[2:4]) == PENDING_ACK and len(data) >= 12:
+        timeout = bytes_to_uint16(data[10:12]) / 1000 + 0.01
+        state.deadline = time.monotonic() + timeout
+        state.extension += timeout
+        state.pending = True
+        return
+
+      # Device cannot queue requests, retry one at a time
+      if data[0] & 0x80 and bytes_to_uint12(data[0:2]) == GEV_STATUS_BUSY and state.attempts < self.retries:
+        self._limit_outstanding()
+        state.deadline = time.monotonic()
+        return
+
+      del self._in_flight[ack_id]
+      self._in_flight_cond.notify_all()
+    state.future.set_result(data)
+
+  def _check_timeouts(self) -> None:
+    now = time.monotonic()
+    failed = []
+    with self._in_flight_cond:
+      for req_id, state in list(self._in_flight.items()):
+        if now < state.deadline:
+          continue
+        if state.attempts >= self.retries:
+          del self._in_flight[req_id]
+          failed.append(state)
+          continue
+        if self.verbose:
+          print(f"GVCP: Attempt {state.attempts} timed out")
+        # Device may drop requests it cannot queue
+        if len(self._in_flight) > 1:
+          self._limit_outstanding()
+        state.attempts += 1
+        state.pending = False
+        state.deadline = now + self._soc_timeout
+        try:
+          self._send(state.request)
+        except OSError as e:
+          # Counted as an attempt, next timeout retries
           if self.verbose:
-            print(f"GVCP: Attempt {retry} timed out")
-          retry += 1
-          response = self._exec_request(request, retry)
-        else:
-          raise err_timeout
-    return response
+            print(f"GVCP: Resending {state.request.cmd_name} failed: {e}")
+      if failed:
+        self._in_flight_cond.notify_all()
+    for state in failed:
+      state.future.set_exception(socket.timeout(f"GVCP ERROR: No acknowledgement for {state.request.cmd_name}, id: {state.request.req_id}"))
+
+  def _limit_outstanding(self) -> None:
+    if self.max_outstanding > 1:
+      self.max_outstanding = 1
+      if self.verbose:
+        print("GVCP: Device does not accept multiple requests in flight, sending one at a time")
+
+  def _close(self) -> None:
+    # Stop receiver and fail requests still waiting
+    self._receiver_stop.set()
+    if self._receiver_thread != None and self._receiver_thread != threading.current_thread():
+      self._receiver_thread.join()
+    self._receiver_thread = None
+    with self._in_flight_cond:
+      if self._soc != None:
+        self._soc.close()
+      self._soc = None
+    self._fail_in_flight(NotConnectedError("GVCP ERROR: Connection closed"))
+
+  def _fail_in_flight(self, error: Exception) -> None:
+    with self._in_flight_cond:
+      failed = list(self._in_flight.values())
+      self._in_flight.clear()
+      self._in_flight_cond.notify_all()
+    for state in failed:
+      state.future.set_exception(error)
 
   def _handle_ack(self, data: bytes, req_id: int) -> GVCPAck:
     response = GVCPAck(data)
@@ -1281,19 +1512,6 @@ class GVCP:
     if self.debug:
       specific_msg = "(device specific code)" if response.device_specific else ""
       print(f"GVCP: Received {response.ack_name} INFO: {response.status_name} {specific_msg}")
-
-    # Handle PENDING acknowledge
-    if response.ack == PENDING_ACK:
-      assert response.length >= 4
-      if not self._pending:
-        timeout = bytes_to_uint16(data[10:12])
-        self._soc.settimeout(timeout / 1000 + 0.01)
-        self._pending = True
-    elif self._pending:
-      self._soc.settimeout(self._soc_timeout)
-      self._pending = False
-
-    # Return payload
     return response
 
   def _heartbeat(self):
@@ -1306,17 +1524,32 @@ class GVCP:
           request = GVCPReadRegCmd(self._req_id.get(), [REG_CCP])
           response = GVCPReadRegAck(self._request(request))
           ccp_status = response.get_values(int)[0]
-        except socket.timeout:
+        except (OSError, NotConnectedError):
+          # Timed out or receiver lost the socket
           ccp_status = 0
         if ccp_status != VAL_CONTROL_ACCESS:
-          self._soc.close()
-          self._soc = None
+          self._close()
           raise NotConnectedError("GVCP ERROR: Connection lost")
         elif self.debug:
           print("GVCP: Sent heartbeat refresh packet")
     if self.verbose:
       print("GVCP: Stopping heartbeat")
 
+  def supports(self, feature: str) -> bool:
+    """
+    Check if the device supports an optional GVCP feature. Capabilities are read from the device
+    the first time they are needed.
+
+    :param feature: "concat" (register concatenation), "writemem", "action" or "scheduled_action"
+    :returns: True if the feature is supported
+    :raises NotConnectedError: No connection
+    :raises AckError: Problem with an acknowledgement from the camera
+    """
+    support = f"{feature}_support"
+    if getattr(self, support) == None:
+      self._check_capability()
+    return getattr(self, support)
+
   def _check_capability(self):
     capability = self.readreg(REG_GVCP_CAPABILITY, int)
     self.concat_support = bool(capability & 0x00000001)
@@ -1325,32 +1558,209 @@ class GVCP:
     self.scheduled_action_support = bool(capability & 0x00020000)
 
 class PortGVCP(AbstractPort):
-  """GenICam port interface - to access GVCP module from device description NodeMap"""
+  """
+  GenICam port interface - to access GVCP module from device description NodeMap
 
-  def __init__(self, gvcp: GVCP):
+  If the device description is given, register values are cached as the Cachable and PollingTime
+  attributes of the registers allow. Written values go through the cache and pInvalidator links are
+  honoured. Registers written directly with GVCP must be invalidated with invalidate().
+
+  Many registers can be read with few concatenated READREG commands with prefetch(), and register
+  writes between begin_batch() and end_batch() are sent with concatenated WRITEREG commands.
+  """
+
+  def __init__(self, gvcp: GVCP, description: DeviceDescription = None):
     super().__init__()
     if isinstance(gvcp, GVCP):
       self.gvcp = gvcp
     else:
       raise TypeError('Port must be initialized with a GVCP object.')
+    self.description = description
+    self.cache_enabled = True
+    """Use register cache (requires device description)."""
+    self.cache_hits = 0
+    self.cache_misses = 0
+    self._cache = {}
+    self._prefetched = {}
+    self._batch = None
+    self._cache_lock = threading.Lock()
 
   def is_open(self) -> bool:
     """Is connection to the camera open (for configuration)"""
     return self.gvcp.connected
 
+  def invalidate(self, address: int = None) -> None:
+    """
+    Drop cached register values.
+
+    :param address: Address of the register, all registers if not given
+    :returns: None
+    """
+    with self._cache_lock:
+      if address == None:
+        self._cache.clear()
+        self._prefetched.clear()
+      else:
+        for key in [key for key in self._cache if key[0] == address]:
+          del self._cache[key]
+        self._prefetched.pop(address, None)
+
+  def prefetch(self, addresses: Iterable[int]) -> None:
+    """
+    Read registers with as few READREG commands as possible. Following reads of the registers are
+    answered from the prefetched values: registers that can be cached go to the cache, others are
+    read once until end_prefetch() is called or any register is written.
+
+    :param addresses: Addresses of 4 byte registers
+    :returns: None
+    :raises NotConnectedError: No connection
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises socket.timeout: Camera didn't send an acknowledgement in time
+    """
+    if not self.gvcp.supports("concat"):
+      return
+    now = time.monotonic()
+    missing = []
+    with self._cache_lock:
+      for address in sorted(set(addresses)):
+        reg = self._cached_register(address, 4)
+        entry = self._cache.get((address, 4))
+        if entry != None and reg != None and (reg.polling_time == None or now - entry[1] < reg.polling_time):
+          continue
+        missing.append(address)
+    for i in range(0, len(missing), READREG_MAX_COUNT):
+      addrs = missing[i:i + READREG_MAX_COUNT]
+      try:
+        data = self.gvcp.readreg(addrs, bytes) if len(addrs) > 1 else self.gvcp.readreg(addrs[0], bytes)
+      except AckError as err:
+        # Some register cannot be read, leave them all to normal reads
+        if self.gvcp.verbose:
+          print(f"GVCP: Prefetch failed, {err}")
+        continue
+      now = time.monotonic()
+      with self._cache_lock:
+        for j, address in enumerate(addrs):
+          value = data[j*4:j*4 + 4]
+          if self._cached_register(address, 4) != None:
+            self._cache[(address, 4)] = (value, now)
+          else:
+            self._prefetched[address] = value
+
+  def end_prefetch(self) -> None:
+    """
+    Drop prefetched values that cannot be cached.
+
+    :returns: None
+    """
+    with self._cache_lock:
+      self._prefetched.clear()
+
+  def begin_batch(self) -> None:
+    """
+    Start collecting register writes. Writes of 4 byte registers are sent with concatenated WRITEREG
+    commands when end_batch() is called or before a read that needs the camera, so the order of
+    writes and reads is kept.
+
+    :returns: None
+    """
+    self._batch = []
+
+  def end_batch(self) -> None:
+    """
+    Send collected register writes and stop collecting them.
+
+    :returns: None
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises socket.timeout: Camera didn't send an acknowledgement in time
+    """
+    try:
+      self._flush()
+    finally:
+      self._batch = None
+
   def write(self, address: int, value: bytes) -> None:
     """Write value through GVCP module"""
-    if len(value) <= 4:
-      self.gvcp.writereg(address, bytes_to_uint32(value))
-    else:
-      self.gvcp.writemem(address, value)
+    reg = self._cached_register(address, len(value))
+    try:
+      if self._batch != None and len(value) == 4:
+        self._batch.append((address, bytes_to_uint32(value)))
+      elif len(value) <= 4:
+        self._flush()
+        self.gvcp.writereg(address, bytes_to_uint32(value))
+      elif len(value) <= READMEM_MAX_PAYLOAD_SIZE:
+        self._flush()
+        self.gvcp.writemem(address, value)
+      else:
+        self._flush()
+        self.gvcp.writemem_bulk(address, value)
+    except:
+      self.invalidate(address)
+      raise
+    with self._cache_lock:
+      # Any write may change registers that are not cached (limits, availability)
+      self._prefetched.clear()
+      if self.description == None:
+        return
+      if reg != None and reg.cachable == CACHE_WRITE_THROUGH:
+        self._cache[(address, len(value))] = (bytes(value), time.monotonic())
+      else:
+        self._cache.pop((address, len(value)), None)
+      for other in self.description.invalidated_by(address, len(value)):
+        self._cache.pop((other.address, other.length), None)
 
   def read(self, address: int, length: int) -> bytes:
-    """Read value through GVCP module"""
+    """Read value through GVCP module (or from the register cache)"""
+    reg = self._cached_register(address, length)
+    if reg != None:
+      with self._cache_lock:
+        entry = self._cache.get((address, length))
+      if entry != None and (reg.polling_time == None or time.monotonic() - entry[1] < reg.polling_time):
+        self.cache_hits += 1
+        return entry[0]
+      self.cache_misses += 1
+    elif length == 4:
+      with self._cache_lock:
+        value = self._prefetched.pop(address, None)
+      if value != None:
+        return value
+    self._flush()
     if length <= 4:
-      return self.gvcp.readreg(address, bytes)
+      value = self.gvcp.readreg(address, bytes)
+    elif length <= READMEM_MAX_PAYLOAD_SIZE:
+      value = self.gvcp.readmem(address, length, bytes)
     else:
-      return self.gvcp.readmem(address, length, bytes)
+      value = self.gvcp.readmem_bulk(address, length)
+    if reg != None:
+      with self._cache_lock:
+        self._cache[(address, length)] = (value, time.monotonic())
+    return value
+
+  def _flush(self) -> None:
+    # Send writes collected in batch mode
+    if not self._batch:
+      return
+    batch = self._batch
+    self._batch = []
+    count = WRITEREG_MAX_COUNT if self.gvcp.supports("concat") else 1
+    for i in range(0, len(batch), count):
+      addrs = [address for address, _ in batch[i:i + count]]
+      values = [value for _, value in batch[i:i + count]]
+      try:
+        self.gvcp.writereg(addrs, values)
+      except:
+        # Index of the failed register is not known here, values of the batch may be stale
+        for address, _ in batch[i:]:
+          self.invalidate(address)
+        raise
+
+  def _cached_register(self, address: int, length: int) -> Union[RegisterInfo, None]:
+    # Register info if the register may be cached
+    if not self.cache_enabled or self.description == None:
+      return None
+    reg = self.description.get_register(address, length)
+    if reg == None or reg.cachable == CACHE_NONE:
+      return None
+    return reg
 
   def get_access_mode(self) -> EAccessMode:
     """Get access mode of this port (read / write)"""
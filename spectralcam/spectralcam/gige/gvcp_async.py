@@ -0,0 +1,541 @@
+"""
+  Asyncio version of the GVCP client. AsyncGVCP has the same commands as GVCP but they are
+  coroutines, so one event loop can control many cameras without a thread per camera. The socket is
+  an asyncio datagram endpoint: acknowledgements are passed to waiting requests by ID as they
+  arrive, retransmissions are scheduled with the event loop and the heartbeat is an asyncio task.
+"""
+import asyncio
+import socket
+from collections import deque
+from typing import Iterable, Union
+
+from spectralcam.utils import *
+from spectralcam.exceptions import *
+from spectralcam.gige.gvcp import *
+
+class AsyncGVCPInFlight:
+  """Request sent by AsyncGVCP and waiting for an acknowledgement."""
+  def __init__(self, request: GVCPCmd, future: asyncio.Future) -> None:
+    self.request = request
+    self.future = future
+    self.attempts = 1
+    self.pending = False
+    self.timer = None
+
+class GVCPProtocol(asyncio.DatagramProtocol):
+  """Datagram protocol passing received acknowledgements to AsyncGVCP."""
+
+  def __init__(self, gvcp: "AsyncGVCP") -> None:
+    self.gvcp = gvcp
+
+  def datagram_received(self, data: bytes, addr: tuple[str, int]) -> None:
+    if len(data) >= GVCP_HEADER_SIZE:
+      self.gvcp._route_ack(data)
+
+  def error_received(self, exc: Exception) -> None:
+    # E.g. ICMP port unreachable, requests are retried until they time out
+    if self.gvcp.debug:
+      print(f"GVCP: Socket error: {exc}")
+
+  def connection_lost(self, exc: Exception) -> None:
+    self.gvcp._fail_all(NotConnectedError("GVCP ERROR: Connection closed"))
+
+class AsyncGVCP:
+  """
+  GigE Vision control channel for asyncio applications. Usage is the same as with GVCP except that
+  the methods must be awaited:
+
+    gvcp = AsyncGVCP()
+    await gvcp.connect("169.254.0.1")
+    width = await gvcp.readreg(0x00300000, int)
+    await gvcp.disconnect()
+  """
+
+  def __init__(self):
+    # Socket / packets
+    self._transport = None
+    self._soc_timeout = 0.5 # in seconds
+    self._req_id = GVCPRequestId()
+    self.retries = 3
+    """Number of times to retry a command before raising an error."""
+
+    # Requests in flight by ID, coroutines waiting for room in flight
+    self._in_flight = {}
+    self._slot_waiters = deque()
+    self.max_outstanding = 4
+    """Number of requests in flight. Dropped to 1 if the device answers BUSY or drops requests."""
+
+    # Heartbeat
+    self._heartbeat_timeout = 5.0 # in seconds
+    self._heartbeat_rate = self._heartbeat_timeout / 3 # in seconds
+    self._heartbeat_task = None
+
+    # Support for optional features
+    self.concat_support = None
+    self.writemem_support = None
+    self.action_support = None
+    self.scheduled_action_support = None
+
+    # Output formatting
+    self.verbose = False
+    self.debug = False
+
+  @property
+  def connected(self) -> bool:
+    """Connection is open."""
+    return self._transport != None
+
+  @property
+  def pending(self) -> bool:
+    """Received PENDING_ACK and waiting for the actual response."""
+    return any(state.pending for state in self._in_flight.values())
+
+  @property
+  def ack_timeout(self) -> float:
+    """Time to wait for an acknowledgement in seconds."""
+    return self._soc_timeout
+
+  @ack_timeout.setter
+  def ack_timeout(self, timeout: float) -> None:
+    self._soc_timeout = timeout
+
+  @property
+  def heartbeat_timeout(self) -> float:
+    """GVCP heartbeat timeout in seconds. Use set_heartbeat_timeout() to change it while connected."""
+    return self._heartbeat_timeout
+
+  async def set_heartbeat_timeout(self, timeout: float) -> None:
+    """
+    Set GVCP heartbeat timeout.
+
+    :param timeout: Heartbeat timeout in seconds
+    :returns: None
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises socket.timeout: Camera didn't send an acknowledgement in time
+    """
+    self._heartbeat_timeout = timeout
+    self._heartbeat_rate = timeout / 3
+    if self.connected:
+      await self.writereg(REG_HEARTBEAT_TIMEOUT, round(timeout * 1000))
+
+  async def connect(self, addr: str, port: int = GVCP_PORT) -> None:
+    """
+    Connect to a camera with an IP address.
+
+    :param addr: IP address of the camera
+    :param port: UDP port of the camera (for GVCP), default is 3956
+    :returns: None
+    :raises NotConnectedError: Cannot connect
+    :raises IsConnectedError: Already connected
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises socket.timeout: Camera didn't send an acknowledgement in time
+    """
+    if self.connected:
+      raise IsConnectedError("GVCP ERROR: GVCP is already connected")
+    loop = asyncio.get_running_loop()
+    self._transport, _ = await loop.create_datagram_endpoint(lambda: GVCPProtocol(self), remote_addr=(addr, port))
+    try:
+      await self.writereg(REG_CCP, VAL_CONTROL_ACCESS)
+      await self.writereg(REG_HEARTBEAT_TIMEOUT, round(self._heartbeat_timeout * 1000))
+      ccp_status = await self.readreg(REG_CCP, int)
+    except:
+      self._close()
+      raise
+    if ccp_status == VAL_CONTROL_ACCESS:
+      self._heartbeat_task = loop.create_task(self._heartbeat())
+      if self.verbose:
+        print("GVCP: Connected")
+    else:
+      self._close()
+      raise NotConnectedError(f"GVCP ERROR: Could not connect\nCCP register value: 0x{ccp_status:x}")
+
+  async def disconnect(self) -> None:
+    """
+    Disconnect from the camera.
+
+    :returns: None
+    :raises NotConnectedError: Already disconnected
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises socket.timeout: Camera didn't send an acknowledgement in time
+    """
+    if not self.connected:
+      raise NotConnectedError("GVCP ERROR: Not connected, call gvcp.connect() first")
+    self._stop_heartbeat()
+    try:
+      await self.writereg(REG_CCP, 0)
+    finally:
+      self._close()
+    if self.verbose:
+      print("GVCP: Disconnected")
+
+  async def discovery(self, return_type: type = bytes) -> Union[bytes, GVCPDiscoveryAck]:
+    """
+    Send discovery command to the camera.
+
+    :param return_type: Type of the returned value
+    :returns: Discovery acknowledgement as a GVCPDiscoveryAck object or raw bytes
+    :raises NotConnectedError: No connection
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises socket.timeout: Camera didn't send an acknowledgement in time
+    """
+    self._check_connection()
+    request = GVCPDiscoveryCmd(self._req_id.get())
+    if self.verbose: print(request)
+    response = GVCPDiscoveryAck(await self._request(request))
+    if self.verbose: print(response)
+    if return_type == bytes:
+      return response.payload
+    elif return_type == GVCPDiscoveryAck:
+      return response
+    else:
+      raise TypeError("GVCP ERROR: Invalid return_type, allowed types: bytes, GVCPDiscoveryAck", return_type)
+
+  async def readreg(self, addrs: Union[int, Iterable[int]], return_type: type = bytes) -> Union[bytes, int, float, list[Union[int, float]]]:
+    """
+    Read single or multiple registers from the camera.
+
+    :param addrs: Register address or addresses
+    :param return_type: Type of the returned value
+    :returns: Value or values from camera registers
+    :raises NotConnectedError: No connection
+    :raises ValueError: Invalid value of address
+    :raises TypeError: Invalid return_type
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises socket.timeout: Camera didn't send an acknowledgement in time
+    """
+    self._check_connection()
+    if type(addrs) == int:
+      addrs = [addrs]
+    if len(addrs) > 1:
+      await self._require("concat_support", "register concatenation")
+    request = GVCPReadRegCmd(self._req_id.get(), addrs)
+    if self.verbose: print(request)
+    response = GVCPReadRegAck(await self._request(request))
+    if self.verbose: print(response)
+    values = response.get_values(return_type)
+    return values if type(values) == bytes or len(values) > 1 else values[0]
+
+  async def writereg(self, addrs: Union[int, list[int]], values: Union[bytes, int, float, list[Union[int, float]]], ack: bool = True) -> None:
+    """
+    Write single or multiple registers on the camera.
+
+    :param addrs: Register address or addresses
+    :param values: Register value or values corresponding to addresses
+    :param ack: Ask camera to acknowledge
+    :returns: None
+    :raises NotConnectedError: No connection
+    :raises ValueError: Invalid value of address
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises socket.timeout: Camera didn't send an acknowledgement in time
+    """
+    self._check_connection()
+    if type(addrs) == int:
+      addrs = [addrs]
+    if type(values) == int or type(values) == float:
+      values = [values]
+    if len(addrs) > 1:
+      await self._require("concat_support", "register concatenation")
+    request = GVCPWriteRegCmd(self._req_id.get(), addrs, values, ack)
+    if self.verbose: print(request)
+    response = await self._request(request)
+    if ack:
+      response = GVCPWriteRegAck(response)
+      if self.verbose: print(response)
+
+  async def readmem(self, addr: int, count: int, return_type: type = bytes) -> Union[bytes, str]:
+    """
+    Read multiple registers as a string from the camera.
+
+    :param addr: First register address
+    :param count: Amount of registers to read
+    :param return_type: Format of the returned value
+    :returns: Values of the registers
+    :raises NotConnectedError: No connection
+    :raises ValueError: Invalid value of address
+    :raises TypeError: Invalid return_type
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises socket.timeout: Camera didn't send an acknowledgement in time
+    """
+    self._check_connection()
+    request = GVCPReadMemCmd(self._req_id.get(), addr, count)
+    if self.verbose: print(request)
+    response = GVCPReadMemAck(await self._request(request))
+    if response.addr != addr:
+      raise AckValueError("GVCP ERROR: Acknowledged address was different to requested address", addr, response.addr)
+    if self.verbose: print(response)
+    return response.get_values(return_type)
+
+  async def writemem(self, addr: int, value: Union[str, bytes], ack: bool = True) -> None:
+    """
+    Write multiple registers with a string to the camera.
+
+    :param addr: First register address
+    :param value: String or bytes to write to camera memory
+    :param ack: Ask camera to acknowledge request
+    :returns: None
+    :raises NotConnectedError: No connection
+    :raises NotImplementedError: Device does not support WRITEMEM command
+    :raises ValueError: Invalid address or value
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises socket.timeout: Camera didn't send an acknowledgement in time
+    """
+    self._check_connection()
+    await self._require("writemem_support", "WRITEMEM command")
+    request = GVCPWriteMemCmd(self._req_id.get(), addr, value, ack)
+    if self.verbose: print(request)
+    response = await self._request(request)
+    if ack:
+      response = GVCPWriteMemAck(response)
+      if self.verbose: print(response)
+
+  async def readmem_bulk(self, addr: int, length: int) -> bytes:
+    """
+    Read a block of camera memory of any length with several READMEM requests in flight.
+
+    :param addr: First register address
+    :param length: Amount of bytes to read
+    :returns: Content of the memory
+    :raises NotConnectedError: No connection
+    :raises ValueError: Invalid value of address
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises socket.timeout: Camera didn't send an acknowledgement in time
+    """
+    self._check_connection()
+    if length < 1:
+      raise ValueError("GVCP ERROR: Length must be greater than 0")
+    requests = []
+    for offset in range(0, length, READMEM_MAX_PAYLOAD_SIZE):
+      count = min(READMEM_MAX_PAYLOAD_SIZE, length - offset)
+      count += (4 - count % 4) % 4
+      requests.append(GVCPReadMemCmd(self._req_id.get(), addr + offset, count))
+    responses = await asyncio.gather(*[self._request(request) for request in requests])
+    data = bytearray()
+    for request, ack in zip(requests, responses):
+      response = GVCPReadMemAck(ack)
+      if response.addr != request.addr:
+        raise AckValueError("GVCP ERROR: Acknowledged address was different to requested address", request.addr, response.addr)
+      data += response.get_values(bytes)
+    return bytes(data[:length])
+
+  async def writemem_bulk(self, addr: int, value: bytes) -> None:
+    """
+    Write a block of camera memory of any length with several WRITEMEM requests in flight.
+
+    :param addr: First register address
+    :param value: Bytes to write to camera memory (padded with zeros to multiple of 4)
+    :returns: None
+    :raises NotConnectedError: No connection
+    :raises NotImplementedError: Device does not support WRITEMEM command
+    :raises ValueError: Invalid address or value
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises socket.timeout: Camera didn't send an acknowledgement in time
+    """
+    self._check_connection()
+    await self._require("writemem_support", "WRITEMEM command")
+    requests = []
+    for offset in range(0, len(value), READMEM_MAX_PAYLOAD_SIZE):
+      chunk = value[offset:offset + READMEM_MAX_PAYLOAD_SIZE]
+      requests.append(GVCPWriteMemCmd(self._req_id.get(), addr + offset, chunk))
+    for ack in await asyncio.gather(*[self._request(request) for request in requests]):
+      GVCPWriteMemAck(ack)
+
+  async def action(self, device_key: int, group_key: int, group_mask: int, ack: bool = True, act_time: int = None) -> None:
+    """
+    Send action command to the camera. Note that this method cannot be used for broadcasting
+    (see GCInterface.gvcp_action).
+
+    :param device_key: Device key (see GigE Vision specs)
+    :param group_key: Group key (see GigE Vision specs)
+    :param group_mask: Group mask (see GigE Vision specs)
+    :param ack: Ask camera to acknowledge
+    :param act_time: Device timestamp to execute the action at (scheduled action), optional
+    :returns: None
+    :raises NotConnectedError: No connection
+    :raises NotImplementedError: Device does not support ACTION or scheduled ACTION command
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises socket.timeout: Camera didn't send an acknowledgement in time
+    """
+    self._check_connection()
+    await self._require("action_support", "ACTION command")
+    if act_time != None:
+      await self._require("scheduled_action_support", "scheduled ACTION command")
+    request = GVCPActionCmd(self._req_id.get(), device_key, group_key, group_mask, ack, act_time)
+    if self.verbose: print(request)
+    response = await self._request(request)
+    if ack:
+      response = GVCPActionAck(response)
+      if self.verbose: print(response)
+
+  async def _request(self, request: GVCPCmd) -> GVCPAck:
+    loop = asyncio.get_running_loop()
+    if request.ack:
+      # Wait for room in flight
+      while self.connected and len(self._in_flight) >= max(1, self.max_outstanding):
+        waiter = loop.create_future()
+        self._slot_waiters.append(waiter)
+        try:
+          await waiter
+        finally:
+          if waiter in self._slot_waiters:
+            self._slot_waiters.remove(waiter)
+    self._check_connection()
+    if not request.ack:
+      self._send(request)
+      return None
+    state = AsyncGVCPInFlight(request, loop.create_future())
+    self._in_flight[request.req_id] = state
+    self._send(request)
+    state.timer = loop.call_later(self._soc_timeout, self._on_timeout, request.req_id)
+    try:
+      data = await state.future
+    finally:
+      self._finish(request.req_id)
+    return self._handle_ack(data, request.req_id)
+
+  def _send(self, request: GVCPCmd) -> None:
+    self._transport.sendto(request.data)
+    if self.debug:
+      print(f"GVCP: Sent {request.cmd_name}, id: {request.req_id}, length: {len(request.data)} bytes")
+
+  def _route_ack(self, data: bytes) -> None:
+    ack_id = bytes_to_uint16(data[6:8])
+    state = self._in_flight.get(ack_id)
+    if state == None or state.future.done():
+      # Late ack of a retransmitted or timed out request
+      if self.debug:
+        print(f"GVCP: Ignored acknowledgement, id: {ack_id}")
+      return
+    loop = asyncio.get_running_loop()
+
+    # Device is working on it, wait for the time it tells
+    if bytes_to_uint16(data[2:4]) == PENDING_ACK and len(data) >= 12:
+      timeout = bytes_to_uint16(data[10:12])
+      state.pending = True
+      state.timer.cancel()
+      state.timer = loop.call_later(timeout / 1000 + 0.01, self._on_timeout, ack_id)
+      return
+
+    # Device cannot queue requests, retry one at a time
+    if data[0] & 0x80 and bytes_to_uint12(data[0:2]) == GEV_STATUS_BUSY and state.attempts < self.retries:
+      self._limit_outstanding()
+      state.timer.cancel()
+      state.timer = loop.call_soon(self._on_timeout, ack_id)
+      return
+
+    state.future.set_result(data)
+
+  def _on_timeout(self, req_id: int) -> None:
+    state = self._in_flight.get(req_id)
+    if state == None or state.future.done():
+      return
+    if state.attempts >= self.retries:
+      state.future.set_exception(socket.timeout(f"GVCP ERROR: No acknowledgement for {state.request.cmd_name}, id: {req_id}"))
+      return
+    if self.verbose:
+      print(f"GVCP: Attempt {state.attempts} timed out")
+    # Device may drop requests it cannot queue
+    if len(self._in_flight) > 1:
+      self._limit_outstanding()
+    state.attempts += 1
+    state.pending = False
+    self._send(state.request)
+    state.timer = asyncio.get_running_loop().call_later(self._soc_timeout, self._on_timeout, req_id)
+
+  def _finish(self, req_id: int) -> None:
+    # Request is done, let the next waiting request in flight
+    state = self._in_flight.pop(req_id, None)
+    if state != None and state.timer != None:
+      state.timer.cancel()
+    while self._slot_waiters:
+      waiter = self._slot_waiters.popleft()
+      if not waiter.done():
+        waiter.set_result(None)
+        break
+
+  def _limit_outstanding(self) -> None:
+    if self.max_outstanding > 1:
+      self.max_outstanding = 1
+      if self.verbose:
+        print("GVCP: Device does not accept multiple requests in flight, sending one at a time")
+
+  def _handle_ack(self, data: bytes, req_id: int) -> GVCPAck:
+    response = GVCPAck(data)
+    if req_id != None and response.ack_id != req_id:
+      raise AckIdError("GVCP ERROR: Acknowledgement ID does not match last request ID", req_id, response.ack_id)
+    if self.debug:
+      specific_msg = "(device specific code)" if response.device_specific else ""
+      print(f"GVCP: Received {response.ack_name} INFO: {response.status_name} {specific_msg}")
+    return response
+
+  def _fail_all(self, err: Exception) -> None:
+    for state in self._in_flight.values():
+      if not state.future.done():
+        state.future.set_exception(err)
+    for waiter in self._slot_waiters:
+      if not waiter.done():
+        waiter.set_result(None)
+
+  def _close(self) -> None:
+    # Close the socket and fail requests still waiting
+    if self._transport != None:
+      self._transport.close()
+    self._transport = None
+    self._fail_all(NotConnectedError("GVCP ERROR: Connection closed"))
+
+  def _stop_heartbeat(self) -> None:
+    task = self._heartbeat_task
+    self._heartbeat_task = None
+    if task != None and task is not asyncio.current_task():
+      task.cancel()
+
+  async def _heartbeat(self) -> None:
+    if self.verbose:
+      print("GVCP: Starting to send heartbeat")
+    try:
+      while self.connected:
+        await asyncio.sleep(self._heartbeat_rate)
+        try:
+          ccp_status = await self.readreg(REG_CCP, int)
+        except (socket.timeout, NotConnectedError):
+          ccp_status = 0
+        if ccp_status != VAL_CONTROL_ACCESS:
+          # Nobody awaits the heartbeat, requests in flight get the error
+          print("GVCP ERROR: Connection lost")
+          self._heartbeat_task = None
+          self._close()
+          return
+        elif self.debug:
+          print("GVCP: Sent heartbeat refresh packet")
+    finally:
+      if self.verbose:
+        print("GVCP: Stopping heartbeat")
+
+  async def supports(self, feature: str) -> bool:
+    """
+    Check if the device supports an optional GVCP feature. Capabilities are read from the device
+    the first time they are needed.
+
+    :param feature: "concat" (register concatenation), "writemem", "action" or "scheduled_action"
+    :returns: True if the feature is supported
+    :raises NotConnectedError: No connection
+    :raises AckError: Problem with an acknowledgement from the camera
+    """
+    support = f"{feature}_support"
+    if getattr(self, support) == None:
+      await self._check_capability()
+    return getattr(self, support)
+
+  async def _require(self, support: str, name: str) -> None:
+    if not await self.supports(support.removesuffix("_support")):
+      raise NotImplementedError(f"GVCP ERROR: Device does not support {name}")
+
+  async def _check_capability(self) -> None:
+    capability = await self.readreg(REG_GVCP_CAPABILITY, int)
+    self.concat_support = bool(capability & 0x00000001)
+    self.writemem_support = bool(capability & 0x00000002)
+    self.action_support = bool(capability & 0x00000040)
+    self.scheduled_action_support = bool(capability & 0x00020000)
+
+  def _check_connection(self) -> None:
+    if not self.connected:
+      raise NotConnectedError("GVCP ERROR: Not connected, call gvcp.connect() first")
@@ -17,6 +17,9 @@
 #include "numpy/arrayobject.h"
 #include <stdio.h>
 #include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
 #if defined IS_UNIX
   #include <sys/socket.h>
   #include <netinet/in.h>
@@ -31,9 +34,46 @@
 #define false 0
 #define true 1
 
-#define BUF_SIZE 2048
+#define BUF_SIZE 65536 // Largest UDP datagram, jumbo frames must not be truncated
 #define GVSP_HEADER_SIZE 8
 #define GVSP_TOTAL_HEADER_SIZE 36 // IP + UDP + GVSP header
+#define GVSP_EXT_HEADER_SIZE 20 // GVSP header with extended ID
+#define MULTIPART_HEADER_SIZE 8 // Part ID and offset in multi-part data packets
+#define MULTIPART_DESCRIPTOR_SIZE 48 // Part description in multi-part leader
+#define MAX_PARTS 10
+#define IP_HEADER_SIZE 20
+#define UDP_HEADER_SIZE 8
+
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_SPB 0x00000003
+#define PCAPNG_EPB 0x00000006
+#define PCAP_MAX_INTERFACES 16
+#define PCAP_MAX_PACKET 262144 // Largest snaplen of libpcap, longer records are corrupt
+#define PCAPNG_MAX_BLOCK (PCAP_MAX_PACKET + 65536) // Packet block with headers and options
+#define PCAP_WRITE_BUF_SIZE (4 << 20)
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+
+#define PACKET_LEADER 1
+#define PACKET_TRAILER 2
+#define PACKET_PAYLOAD 3
+#define PACKET_MULTIPART 7
+
+#define PAYLOAD_IMAGE 0x0001
+#define PAYLOAD_MULTIPART 0x000A
+#define PAYLOAD_EXTENDED_CHUNK 0x4000 // Flag on top of the payload type
+#define CHUNK_TAG_SIZE 8 // Chunk ID + length after the chunk data
+
+// Log-linear (HDR) histograms of arrival times: 2^HIST_SUB_BITS buckets per power of two, values in ns
+#define HIST_SUB_BITS 5
+#define HIST_MAX_BITS 40 // Larger values (~18 min) are clamped
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
 
 #define MONO8 0x01080001
 #define MONO10 0x01100003
@@ -42,6 +82,10 @@
 #define MONO12PACKED 0x010C0006
 #define MONO16 0x01100007
 
+#define PREVIEW_CHANNELS 3 // RGB
+#define PREVIEW_MAX_DEPTH 16
+#define BAD_PIXEL_MAX_DISTANCE 4 // Farthest neighbour used for interpolation
+
 typedef unsigned char bool;
 typedef unsigned short ushort;
 typedef unsigned long ulong;
@@ -49,6 +93,9 @@ typedef unsigned char byte;
 
 char errmsg[256];
 
+// Numpy dtype of chunk data: chunk ID, length of the data and the data as an integer (if it fits)
+PyArray_Descr *chunk_descr = NULL;
+
 #if defined IS_UNIX
   typedef int soc_t;
   typedef pthread_mutex_t mutex_t;
@@ -76,6 +123,49 @@ char errmsg[256];
   }
 #endif
 
+struct part
+{
+  ulong start; // Offset in frame buffer
+  ulong length;
+  ulong pixel_format;
+  ulong size_x;
+  ulong size_s;
+};
+
+struct calibration
+{
+  ulong rows; // Parts of multi-part frames are stacked along rows
+  ulong cols;
+  int typenum; // Output type, NPY_FLOAT32 or NPY_UINT16
+  float *dark;
+  float *gain; // Reciprocal of white - dark, multiplied by the scale of uint16 output
+};
+
+struct bad_pixels
+{
+  ulong rows; // Parts of multi-part frames are stacked along rows
+  ulong cols;
+  ulong count;
+  ulong *pixels; // Index of the pixel and its two neighbours, ascending by the pixel
+};
+
+struct band_selection
+{
+  ulong count; // Number of output bands
+  ulong *starts; // Start of each group in indexes, count + 1 entries
+  ulong *indexes; // Bands of the frame (counted over all parts) averaged to each output band
+  ulong max_index;
+};
+
+struct histogram
+{
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+};
+
 struct gvsp
 {
   // Feedback settings
@@ -85,6 +175,7 @@ struct gvsp
   // Socket and receive loop
   soc_t sockfd;
   ushort port;
+  in_addr_t host_ip;
   thread_t recv_thread;
 
   // Receiving enabled (this must be protected by g_en_lock)
@@ -92,20 +183,63 @@ struct gvsp
   mutex_t en_lock;
 
   // Image (these must be protected by g_frame_lock)
-  ulong size_x;
-  ulong size_s;
-  ulong frame_size;
+  struct part parts[MAX_PARTS];
+  ulong part_count;
   bool leader_received;
   ulong received_packets;
   ulong packet_count;
   ulong packet_size;
   ulong payload_size;
-  ulong pixel_format;
+  ulong payload_type;
+  ulong block_packet_size; // Data in one packet, depends on header size of the block
+  ulong data_len;
   byte *frame_buf;
   mutex_t frame_lock;
 
+  // Parse chunk data appended to frames (protected by g_frame_lock)
+  bool chunk_mode;
+
+  // Pass device timestamp of the leader with frames (protected by g_frame_lock)
+  bool timestamp_mode;
+  uint64_t timestamp;
+
+  // False color preview row of three bands (protected by g_frame_lock)
+  bool preview_mode;
+  ulong preview_bands[PREVIEW_CHANNELS];
+  float preview_gain[PREVIEW_CHANNELS];
+  float preview_offset[PREVIEW_CHANNELS];
+  byte *preview_luts[PREVIEW_MAX_DEPTH + 1]; // By bit depth, built when a frame of the depth arrives
+
+  // Per-pixel sums of frames, e.g. for a dark reference (protected by g_frame_lock)
+  bool accum_mode;
+  ulong accum_max; // Frames to accumulate, 0 for no limit
+  ulong accum_count;
+  ulong accum_rows; // Parts of multi-part frames are stacked along rows
+  ulong accum_cols;
+  uint64_t *accum_sum;
+  uint64_t *accum_sumsq;
+
+  // Dark and white reference calibration to reflectance, NULL when off (protected by g_frame_lock)
+  struct calibration *calib;
+
+  // Defective pixels replaced by their neighbours, NULL when off (protected by g_frame_lock)
+  struct bad_pixels *bad;
+
+  // Bands kept from the frames, NULL for all (protected by g_frame_lock)
+  struct band_selection *selection;
+
   // Output for frame data
   PyObject *frame_cb;
+
+  // Raw packet capture (this must be protected by g_frame_lock)
+  FILE *pcap_file;
+
+  // Timing of the receive loop (these must be protected by g_frame_lock)
+  uint64_t recv_time; // Arrival of the packet being handled, 0 if not received live
+  uint64_t last_packet_time;
+  uint64_t last_leader_time;
+  struct histogram packet_gaps; // Between packets of a block
+  struct histogram frame_intervals; // Between leaders
 };
 
 ulong bytes_to_uint16(byte *bytes)
@@ -123,6 +257,79 @@ ulong bytes_to_uint32(byte *bytes)
   return (*bytes << 24) + (*(bytes+1) << 16) + (*(bytes+2) << 8) + *(bytes+3);
 }
 
+void uint16_to_bytes(byte *bytes, ulong value)
+{
+  *bytes = (value >> 8) & 0xff;
+  *(bytes + 1) = value & 0xff;
+}
+
+uint32_t swap_uint32(uint32_t value, bool swap)
+{
+  if (!swap) return value;
+  return (value >> 24) | ((value >> 8) & 0xff00) | ((value << 8) & 0xff0000) | (value << 24);
+}
+
+uint64_t monotonic_ns(void)
+{
+#if defined IS_UNIX
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#elif defined IS_WIN32
+  LARGE_INTEGER count;
+  LARGE_INTEGER freq;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&freq);
+  return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000 + (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+#endif
+}
+
+ulong hist_index(uint64_t value)
+{
+  ulong msb = HIST_SUB_BITS;
+  ulong shift;
+  if (value < (1 << HIST_SUB_BITS))
+  {
+    return (ulong)value;
+  }
+  if (value >= ((uint64_t)1 << HIST_MAX_BITS))
+  {
+    value = ((uint64_t)1 << HIST_MAX_BITS) - 1;
+  }
+#if defined __GNUC__
+  msb = 63 - __builtin_clzll(value);
+#else
+  while (value >> (msb + 1)) msb++;
+#endif
+  shift = msb - HIST_SUB_BITS;
+  return (shift << HIST_SUB_BITS) + (ulong)(value >> shift);
+}
+
+// Smallest value of a bucket
+uint64_t hist_value(ulong index)
+{
+  if (index < (2 << HIST_SUB_BITS))
+  {
+    return index;
+  }
+  ulong shift = (index >> HIST_SUB_BITS) - 1;
+  return (uint64_t)((index & ((1 << HIST_SUB_BITS) - 1)) + (1 << HIST_SUB_BITS)) << shift;
+}
+
+void hist_record(struct histogram *h, uint64_t value)
+{
+  h->counts[hist_index(value)]++;
+  if (h->total == 0 || value < h->min) h->min = value;
+  if (value > h->max) h->max = value;
+  h->total++;
+  h->sum += value;
+}
+
+void hist_reset(struct histogram *h)
+{
+  memset(h, 0, sizeof (struct histogram));
+}
+
 PyObject * handle_py_error(void)
 {
   if (errno != 0)
@@ -257,21 +464,48 @@ void init_gvsp(struct gvsp *g)
 
   g->sockfd = -1;
   g->port = 0;
+  g->host_ip = 0;
 
   g->recv_en = false;
   g->en_lock = en_lock;
 
-  g->size_x = 0;
-  g->size_s = 0;
+  g->part_count = 0;
   g->leader_received = false;
   g->received_packets = 0;
   g->packet_count = 0;
   g->packet_size = 0;
   g->payload_size = 0;
+  g->payload_type = 0;
+  g->block_packet_size = 0;
+  g->data_len = 0;
   g->frame_buf = NULL;
   g->frame_lock = frame_lock;
 
+  g->chunk_mode = false;
+  g->timestamp_mode = false;
+  g->timestamp = 0;
+  g->preview_mode = false;
+  memset(g->preview_luts, 0, sizeof g->preview_luts);
+  g->accum_mode = false;
+  g->accum_max = 0;
+  g->accum_count = 0;
+  g->accum_rows = 0;
+  g->accum_cols = 0;
+  g->accum_sum = NULL;
+  g->accum_sumsq = NULL;
+  g->calib = NULL;
+  g->bad = NULL;
+  g->selection = NULL;
+
   g->frame_cb = NULL;
+
+  g->pcap_file = NULL;
+
+  g->recv_time = 0;
+  g->last_packet_time = 0;
+  g->last_leader_time = 0;
+  hist_reset(&g->packet_gaps);
+  hist_reset(&g->frame_intervals);
 }
 
 struct gvsp * get_gvsp(PyObject *args, PyObject *kwargs)
@@ -291,45 +525,51 @@ void free_frame(void *caps)
   free(buf);
 }
 
-bool validate_header(struct gvsp *g, byte *buf)
+// Returns size of the header or 0 if the packet must be ignored
+ulong parse_header(struct gvsp *g, byte *buf, ulong buf_len, ulong *packet_id)
 {
   ulong status;
   if (*buf != 0 || *(buf+1) != 0)
   {
     status = bytes_to_uint16(buf);
     if (g->warnings) printf("GVSP WARNING: Received packet with status: 0x%04lx\n", status);
-    return false;
+    return 0;
   }
-  if (*(buf+2) == 0 && *(buf+3) == 0)
+  if (*(buf+4) & 0x80)
   {
-    return false;
+    // Extended ID: 64-bit block ID and 32-bit packet ID (required by multi-part payload)
+    if (buf_len < GVSP_EXT_HEADER_SIZE || (bytes_to_uint32(buf+8) == 0 && bytes_to_uint32(buf+12) == 0))
+    {
+      return 0;
+    }
+    *packet_id = bytes_to_uint32(buf + 16);
+    return GVSP_EXT_HEADER_SIZE;
   }
-  if (*(buf+4) & 0x80)
+  if (*(buf+2) == 0 && *(buf+3) == 0)
   {
-    if (g->warnings) printf("GVSP WARNING: Extended ID is not supported\n");
-    return false;
+    return 0;
   }
-  return true;
+  *packet_id = bytes_to_uint24(buf + 5);
+  return GVSP_HEADER_SIZE;
 }
 
-void * decode_mono8(struct gvsp *g, int *typenum)
+void * decode_mono8(byte *src, ulong count, int *typenum)
 {
-  ulong payload_size = (g->size_s * g->size_x);
-  byte *frame = malloc(g->size_s * g->size_x * sizeof(byte));
+  byte *frame = malloc(count * sizeof(byte));
   if (frame == NULL)
   {
     strcpy(errmsg, "GVSP ERROR: Failed to allocate memory for a frame, STOPPING THREAD");
     return NULL;
   }
-  memcpy(frame, g->frame_buf, payload_size);
+  memcpy(frame, src, count);
   *typenum = NPY_UINT8;
   return frame;
 }
 
-void * decode_mono10(struct gvsp *g, int *typenum)
+void * decode_mono10(byte *src, ulong count, int *typenum)
 {
-  ulong payload_size = g->size_s * g->size_x * 2;
-  ushort *frame = malloc(g->size_s * g->size_x * sizeof(ushort));
+  ulong payload_size = count * 2;
+  ushort *frame = malloc(count * sizeof(ushort));
   ulong buf_i;
   byte *buf_p;
 
@@ -340,7 +580,7 @@ void * decode_mono10(struct gvsp *g, int *typenum)
   }
   for (buf_i = 0; buf_i < payload_size; buf_i += 2)
   {
-    buf_p = g->frame_buf + buf_i;
+    buf_p = src + buf_i;
     *(frame + (buf_i >> 1)) = ((*(buf_p+1) & 0x03) << 8) + *buf_p;
   }
 
@@ -348,10 +588,10 @@ void * decode_mono10(struct gvsp *g, int *typenum)
   return frame;
 }
 
-void * decode_mono10packed(struct gvsp *g, int *typenum)
+void * decode_mono10packed(byte *src, ulong count, int *typenum)
 {
-  ulong payload_size = ((g->size_s * g->size_x) >> 1) * 3;
-  ushort *frame = malloc(g->size_s * g->size_x * sizeof(ushort));
+  ulong payload_size = (count >> 1) * 3;
+  ushort *frame = malloc(count * sizeof(ushort));
   ulong frame_i = 0;
   ulong buf_i;
   byte *buf_p;
@@ -363,20 +603,20 @@ void * decode_mono10packed(struct gvsp *g, int *typenum)
   }
   for (buf_i = 0; buf_i < payload_size; buf_i += 3)
   {
-    frame_i += 2;
-    buf_p = g->frame_buf + buf_i;
+    buf_p = src + buf_i;
     *(frame + frame_i) = (*(buf_p) << 2) + (*(buf_p+1) & 0x03);
     *(frame + frame_i + 1) = (*(buf_p+2) << 2) + ((*(buf_p+1) & 0x30) >> 4);
+    frame_i += 2;
   }
 
   *typenum = NPY_UINT16;
   return frame;
 }
 
-void * decode_mono12(struct gvsp *g, int *typenum)
+void * decode_mono12(byte *src, ulong count, int *typenum)
 {
-  ulong payload_size = g->size_s * g->size_x * 2;
-  ushort *frame = malloc(g->size_s * g->size_x * sizeof(ushort));
+  ulong payload_size = count * 2;
+  ushort *frame = malloc(count * sizeof(ushort));
   ulong buf_i;
   byte *buf_p;
 
@@ -387,7 +627,7 @@ void * decode_mono12(struct gvsp *g, int *typenum)
   }
   for (buf_i = 0; buf_i < payload_size; buf_i += 2)
   {
-    buf_p = g->frame_buf + buf_i;
+    buf_p = src + buf_i;
     *(frame + (buf_i >> 1)) = ((*(buf_p+1) & 0x0f) << 8) + *buf_p;
   }
 
@@ -395,10 +635,10 @@ void * decode_mono12(struct gvsp *g, int *typenum)
   return frame;
 }
 
-void * decode_mono12packed(struct gvsp *g, int *typenum)
+void * decode_mono12packed(byte *src, ulong count, int *typenum)
 {
-  ulong payload_size = ((g->size_s * g->size_x) >> 1) * 3;
-  ushort *frame = malloc(g->size_s * g->size_x * sizeof(ushort));
+  ulong payload_size = (count >> 1) * 3;
+  ushort *frame = malloc(count * sizeof(ushort));
   ulong frame_i = 0;
   ulong buf_i;
   byte *buf_p;
@@ -410,20 +650,20 @@ void * decode_mono12packed(struct gvsp *g, int *typenum)
   }
   for (buf_i = 0; buf_i < payload_size; buf_i += 3)
   {
-    frame_i += 2;
-    buf_p = g->frame_buf + buf_i;
+    buf_p = src + buf_i;
     *(frame + frame_i) = (*(buf_p) << 4) + (*(buf_p+1) & 0x0f);
     *(frame + frame_i + 1) = (*(buf_p+2) << 4) + ((*(buf_p+1) & 0xf0) >> 4);
+    frame_i += 2;
   }
 
   *typenum = NPY_UINT16;
   return frame;
 }
 
-void * decode_mono16(struct gvsp *g, int *typenum)
+void * decode_mono16(byte *src, ulong count, int *typenum)
 {
-  ulong payload_size = g->size_s * g->size_x * 2;
-  ushort *frame = malloc(g->size_s * g->size_x * sizeof(ushort));
+  ulong payload_size = count * 2;
+  ushort *frame = malloc(count * sizeof(ushort));
   ulong buf_i;
   byte *buf_p;
 
@@ -434,7 +674,7 @@ void * decode_mono16(struct gvsp *g, int *typenum)
   }
   for (buf_i = 0; buf_i < payload_size; buf_i += 2)
   {
-    buf_p = g->frame_buf + buf_i;
+    buf_p = src + buf_i;
     *(frame + (buf_i >> 1)) = (*(buf_p+1) << 8) + *buf_p;
   }
 
@@ -442,544 +682,2458 @@ void * decode_mono16(struct gvsp *g, int *typenum)
   return frame;
 }
 
+// Protected by g_frame_lock. Pixel format must have been checked by validate_part.
+void * decode_part(struct gvsp *g, struct part *p, int *typenum, int *bit_depth)
+{
+  byte *src = g->frame_buf + p->start;
+  ulong count = p->size_x * p->size_s;
+  switch (p->pixel_format)
+  {
+    case MONO8:
+      *bit_depth = 8;
+      return decode_mono8(src, count, typenum);
+    case MONO10:
+      *bit_depth = 10;
+      return decode_mono10(src, count, typenum);
+    case MONO10PACKED:
+      *bit_depth = 10;
+      return decode_mono10packed(src, count, typenum);
+    case MONO12:
+      *bit_depth = 12;
+      return decode_mono12(src, count, typenum);
+    case MONO12PACKED:
+      *bit_depth = 12;
+      return decode_mono12packed(src, count, typenum);
+    default:
+      *bit_depth = 16;
+      return decode_mono16(src, count, typenum);
+  }
+}
+
+ulong image_data_len(struct part *p)
+{
+  // Bits per pixel are encoded in the pixel format (GenICam PFNC)
+  return p->size_x * p->size_s * ((p->pixel_format >> 16) & 0xff) / 8;
+}
+
 // Protected by g_frame_lock
-int handle_leader(struct gvsp *g, byte *buf, ulong buf_len)
+bool validate_part(struct gvsp *g, struct part *p)
 {
-  // General for all payload types
-  if (!validate_header(g, buf) || buf_len < 12)
+  switch (p->pixel_format)
   {
-    if (g->warnings) printf("GVSP WARNING: Received invalid leader packet\n");
-    return 0;
+    case MONO8:
+    case MONO10:
+    case MONO10PACKED:
+    case MONO12:
+    case MONO12PACKED:
+    case MONO16:
+      break;
+    default:
+      if (g->warnings) printf("GVSP WARNING: Pixel format 0x%08lx is not supported\n", p->pixel_format);
+      return false;
   }
-  byte *payload = buf + GVSP_HEADER_SIZE;
-  ulong payload_len = buf_len - GVSP_HEADER_SIZE;
-  if (bytes_to_uint16(payload + 2) != 0x0001)
+  if (p->start + p->length > g->payload_size || image_data_len(p) > p->length)
   {
-    if (g->warnings) printf("GVSP WARNING: No other format than uncompressed image is supported\n");
-    return 0;
+    if (g->warnings) printf("GVSP WARNING: Image size exceeds frame buffer size\n");
+    return false;
   }
+  return true;
+}
 
-  // Specific to uncompressed image (only supported format. TODO more of them?)
+// Protected by g_frame_lock
+bool parse_image_leader(struct gvsp *g, byte *payload, ulong payload_len)
+{
+  // Specific to uncompressed image, extended chunk mode uses the same leader
   if (payload_len != 36)
   {
     if (g->warnings) printf("GVSP WARNING: Received invalid uncompressed image leader packet\n");
-    return 0;
+    return false;
   }
   if (*payload != 0)
   {
     if (g->warnings) printf("GVSP WARNING: Interlacing is not supported\n");
+    return false;
+  }
+  struct part *p = &g->parts[0];
+  p->start = 0;
+  p->length = g->payload_size;
+  p->pixel_format = bytes_to_uint32(payload + 12);
+  p->size_x = bytes_to_uint32(payload + 16);
+  p->size_s = bytes_to_uint32(payload + 20);
+  g->part_count = 1;
+  // TODO support for ROI / offset
+  // TODO support for padding
+  return validate_part(g, p);
+}
+
+// Protected by g_frame_lock. Parts are placed one after another in the frame buffer.
+bool parse_multipart_leader(struct gvsp *g, byte *payload, ulong payload_len)
+{
+  ulong part_count = (payload_len - 12) / MULTIPART_DESCRIPTOR_SIZE;
+  ulong start = 0;
+  ulong i;
+  byte *desc;
+  struct part *p;
+  if (part_count == 0 || part_count > MAX_PARTS)
+  {
+    if (g->warnings) printf("GVSP WARNING: Received multi-part leader with %ld parts, 1 to %d are supported\n", part_count, MAX_PARTS);
+    return false;
+  }
+  for (i = 0; i < part_count; i++)
+  {
+    desc = payload + 12 + i * MULTIPART_DESCRIPTOR_SIZE;
+    p = &g->parts[i];
+    if (bytes_to_uint16(desc + 2) != 0)
+    {
+      if (g->warnings) printf("GVSP WARNING: Received part with 48-bit part length, it is not supported\n");
+      return false;
+    }
+    p->start = start;
+    p->length = bytes_to_uint32(desc + 4);
+    p->pixel_format = bytes_to_uint32(desc + 8);
+    p->size_x = bytes_to_uint32(desc + 24);
+    p->size_s = bytes_to_uint32(desc + 28);
+    if (!validate_part(g, p))
+    {
+      return false;
+    }
+    start += p->length;
+  }
+  g->part_count = part_count;
+  return true;
+}
+
+// Protected by g_frame_lock
+int handle_leader(struct gvsp *g, byte *payload, ulong payload_len, ulong header_size)
+{
+  // General for all payload types
+  if (payload_len < 12)
+  {
+    if (g->warnings) printf("GVSP WARNING: Received invalid leader packet\n");
+    return 0;
+  }
+  ulong payload_type = bytes_to_uint16(payload + 2);
+  if ((payload_type & ~PAYLOAD_EXTENDED_CHUNK) == PAYLOAD_IMAGE)
+  {
+    if (!parse_image_leader(g, payload, payload_len)) return 0;
+  }
+  else if (payload_type == PAYLOAD_MULTIPART)
+  {
+    if (!parse_multipart_leader(g, payload, payload_len)) return 0;
+  }
+  else
+  {
+    if (g->warnings) printf("GVSP WARNING: No other format than uncompressed image (with or without chunks) or multi-part is supported\n");
+    return 0;
+  }
+
+  // Extended ID header takes space from the data
+  if (g->packet_size <= header_size - GVSP_HEADER_SIZE)
+  {
+    if (g->warnings) printf("GVSP WARNING: Packet size is too small for the header\n");
     return 0;
   }
-  g->pixel_format = bytes_to_uint32(payload + 12);
-  g->size_x = bytes_to_uint32(payload + 16);
-  g->size_s = bytes_to_uint32(payload + 20);
-  g->frame_size = g->size_x * g->size_s;
+  g->block_packet_size = g->packet_size - (header_size - GVSP_HEADER_SIZE);
+  if (g->recv_time != 0)
+  {
+    if (g->last_leader_time != 0) hist_record(&g->frame_intervals, g->recv_time - g->last_leader_time);
+    g->last_leader_time = g->recv_time;
+  }
+  // Timestamp is at the same place in leaders of all payload types
+  g->timestamp = ((uint64_t)bytes_to_uint32(payload + 4) << 32) + bytes_to_uint32(payload + 8);
+  g->payload_type = payload_type;
   g->received_packets = 0;
+  g->data_len = 0;
   g->leader_received = true;
-  // TODO support for ROI / offset
-  // TODO support for padding
   return 0;
 }
 
 // Protected by g_frame_lock
-int handle_frame(struct gvsp *g, byte *buf, ulong buf_len)
+int handle_frame(struct gvsp *g, byte *payload, ulong len, ulong packet_id)
 {
-  ulong packet_id = bytes_to_uint24(buf + 5);
-  ulong start = (packet_id - 1) * g->packet_size;
-  ulong i;
-  if (GVSP_HEADER_SIZE + g->packet_size > buf_len)
+  if (!g->leader_received || g->payload_type == PAYLOAD_MULTIPART)
   {
-    if (g->warnings) printf("GVSP WARNING: Received data payload packet is too small, expected %ld bytes, received %ld bytes\n", GVSP_HEADER_SIZE + g->packet_size, buf_len);
     return 0;
   }
-  if (start + g->packet_size > g->payload_size)
+  ulong start = (packet_id - 1) * g->block_packet_size;
+  if (packet_id == 0 || start >= g->payload_size)
   {
     if (g->warnings) printf("GVSP WARNING: Received data payload packet exceeds frame buffer size\n");
     return 0;
   }
-  for (i = 0; i < g->packet_size; i++)
+  // Last packet of a block is usually shorter (image and chunk data rarely fill it)
+  if (len > g->block_packet_size)
+  {
+    if (g->warnings) printf("GVSP WARNING: Received data payload packet is too large, expected %ld bytes, received %ld bytes\n", g->block_packet_size, len);
+    return 0;
+  }
+  if (start + len > g->payload_size)
   {
-    *(g->frame_buf + start + i) = *(buf + GVSP_HEADER_SIZE + i);
+    len = g->payload_size - start;
+  }
+  memcpy(g->frame_buf + start, payload, len);
+  if (start + len > g->data_len)
+  {
+    g->data_len = start + len;
   }
   g->received_packets++;
   return 0;
 }
 
 // Protected by g_frame_lock
-int handle_trailer(struct gvsp *g, byte *buf, ulong buf_len)
+int handle_part(struct gvsp *g, byte *payload, ulong len)
 {
-
-  if (!g->leader_received)
+  if (!g->leader_received || g->payload_type != PAYLOAD_MULTIPART)
   {
-    if (g->warnings) printf("GVSP WARNING: Trailer received before leader\n");
     return 0;
   }
-  g->leader_received = false;
-  if (!validate_header(g, buf) || buf_len < 12)
+  if (len < MULTIPART_HEADER_SIZE)
   {
-    if (g->warnings) printf("GVSP WARNING: Received invalid trailer packet\n");
+    if (g->warnings) printf("GVSP WARNING: Received invalid multi-part data packet\n");
     return 0;
   }
-  if (g->received_packets != g->packet_count)
+  ulong part_id = *payload;
+  uint64_t offset = ((uint64_t)bytes_to_uint16(payload + 2) << 32) + bytes_to_uint32(payload + 4);
+  len -= MULTIPART_HEADER_SIZE;
+  if (part_id >= g->part_count || offset + len > g->parts[part_id].length)
   {
-    if (g->warnings) printf("GVSP WARNING: %ld packets dropped\n", g->packet_count - g->received_packets);
+    if (g->warnings) printf("GVSP WARNING: Received multi-part data packet exceeds part size\n");
     return 0;
   }
+  memcpy(g->frame_buf + g->parts[part_id].start + offset, payload + MULTIPART_HEADER_SIZE, len);
+  g->received_packets++;
+  return 0;
+}
 
-  PyGILState_STATE gil;
-  PyObject *frame_py;
-  PyObject *args_py;
-  PyObject *caps_py;
-  void *frame = NULL; // unsigend char or usinged short
-  npy_intp nds[] = {g->size_s, g->size_x};
-  int typenum;
-  int bit_depth = 0;
-
-  // Decode received frame data
-  switch (g->pixel_format)
+// Protected by g_frame_lock
+ulong count_chunks(struct gvsp *g)
+{
+  ulong pos = g->data_len;
+  ulong len;
+  ulong count = 0;
+  ulong image_len = image_data_len(&g->parts[0]);
+  // Image data may or may not be tagged as a chunk, other chunks never start inside it
+  while (pos >= CHUNK_TAG_SIZE && pos > image_len)
   {
-    case MONO8:
-      frame = decode_mono8(g, &typenum);
-      bit_depth = 8;
-      break;
-    case MONO10:
-      frame = decode_mono10(g, &typenum);
-      bit_depth = 10;
-      break;
-    case MONO10PACKED:
-      frame = decode_mono10packed(g, &typenum);
-      bit_depth = 10;
-      break;
-    case MONO12:
-      frame = decode_mono12(g, &typenum);
-      bit_depth = 12;
-      break;
-    case MONO12PACKED:
-      frame = decode_mono12packed(g, &typenum);
-      bit_depth = 12;
-      break;
-    case MONO16:
-      frame = decode_mono16(g, &typenum);
-      bit_depth = 16;
+    len = bytes_to_uint32(g->frame_buf + pos - 4);
+    if (len > pos - CHUNK_TAG_SIZE || len % 4 != 0)
+    {
       break;
-    default:
-      if (g->warnings) printf("GVSP WARNING: Pixel format is not supported\n");
+    }
+    pos -= CHUNK_TAG_SIZE + len;
+    count++;
   }
-  if (frame == NULL)
+  return count;
+}
+
+struct chunk
+{
+  uint32_t id;
+  uint32_t length;
+  uint64_t value;
+};
+
+// Protected by g_frame_lock. Chunks are listed from the end of the payload: data, ID, length.
+void parse_chunks(struct gvsp *g, struct chunk *chunks, ulong count)
+{
+  ulong pos = g->data_len;
+  ulong i;
+  ulong j;
+  for (i = 0; i < count; i++)
   {
-    return -1;
+    chunks[i].id = bytes_to_uint32(g->frame_buf + pos - 8);
+    chunks[i].length = bytes_to_uint32(g->frame_buf + pos - 4);
+    pos -= CHUNK_TAG_SIZE + chunks[i].length;
+    chunks[i].value = 0;
+    if (chunks[i].length <= 8)
+    {
+      for (j = 0; j < chunks[i].length; j++)
+      {
+        chunks[i].value = (chunks[i].value << 8) + *(g->frame_buf + pos + j);
+      }
+    }
   }
+}
 
-  // Create numpy.ndarray of the frame
-  gil = PyGILState_Ensure();
-  frame_py = PyArray_SimpleNewFromData(2, nds, typenum, frame);
-  if (frame_py == NULL)
+// Protected by g_frame_lock
+void free_preview_luts(struct gvsp *g)
+{
+  int i;
+  for (i = 0; i <= PREVIEW_MAX_DEPTH; i++)
   {
-    strcpy(errmsg, "GVSP ERROR: Failed to create numpy.ndarray from a frame, STOPPING THREAD");
-    return -1;
+    free(g->preview_luts[i]);
+    g->preview_luts[i] = NULL;
   }
-  caps_py = PyCapsule_New(frame, "wrapped_buffer", (PyCapsule_Destructor)&free_frame);
-  if (PyArray_SetBaseObject((PyArrayObject*)frame_py, caps_py) == -1)
+}
+
+// Protected by g_frame_lock. Tables map a pixel value to uint8, one table for each channel.
+byte * get_preview_lut(struct gvsp *g, int bit_depth)
+{
+  ulong size = 1 << bit_depth;
+  ulong c, v;
+  float x;
+  byte *lut;
+  if (bit_depth < 1 || bit_depth > PREVIEW_MAX_DEPTH) return NULL;
+  if (g->preview_luts[bit_depth] != NULL) return g->preview_luts[bit_depth];
+  lut = malloc(PREVIEW_CHANNELS * size);
+  if (lut == NULL) return NULL;
+  for (c = 0; c < PREVIEW_CHANNELS; c++)
   {
-    strcpy(errmsg, "GVSP ERROR: Failed to set destructor function for frame, STOPPING THREAD");
-    Py_DECREF(frame_py);
-    return -1;
+    for (v = 0; v < size; v++)
+    {
+      x = (float)v * 255.0f / (float)(size - 1) * g->preview_gain[c] + g->preview_offset[c];
+      lut[c * size + v] = x <= 0.0f ? 0 : x >= 255.0f ? 255 : (byte)(x + 0.5f);
+    }
   }
+  g->preview_luts[bit_depth] = lut;
+  return lut;
+}
 
-  // Ouput frame
-  if (g->frame_cb != NULL)
+// Protected by g_frame_lock. RGB row of the preview bands, bands are counted over all parts. Returns
+// NULL if the bands are in parts of different width.
+byte * make_preview_row(struct gvsp *g, struct part *parts, ulong part_count, void **frames, int *typenums, int *bit_depths, ulong *width)
+{
+  ulong total = 0;
+  ulong band, i, c, x, size_x = 0;
+  void *rows[PREVIEW_CHANNELS];
+  int row_types[PREVIEW_CHANNELS];
+  byte *luts[PREVIEW_CHANNELS];
+  byte *out;
+  for (i = 0; i < part_count; i++) total += parts[i].size_s;
+  if (total == 0) return NULL;
+
+  for (c = 0; c < PREVIEW_CHANNELS; c++)
   {
-    args_py = Py_BuildValue("(Oi)", frame_py, bit_depth);
-    PyObject_CallObject(g->frame_cb, args_py);
-    Py_DECREF(args_py);
+    band = g->preview_bands[c] < total ? g->preview_bands[c] : total - 1;
+    for (i = 0; band >= parts[i].size_s; i++) band -= parts[i].size_s;
+    if (c > 0 && parts[i].size_x != size_x) return NULL;
+    size_x = parts[i].size_x;
+    luts[c] = get_preview_lut(g, bit_depths[i]);
+    if (luts[c] == NULL) return NULL;
+    luts[c] += c << bit_depths[i];
+    row_types[c] = typenums[i];
+    if (typenums[i] == NPY_UINT8) rows[c] = (uint8_t*)frames[i] + band * size_x;
+    else rows[c] = (uint16_t*)frames[i] + band * size_x;
   }
-  Py_DECREF(frame_py);
-  PyGILState_Release(gil);
 
-  return 0;
+  out = malloc(size_x * PREVIEW_CHANNELS);
+  if (out == NULL) return NULL;
+  for (c = 0; c < PREVIEW_CHANNELS; c++)
+  {
+    if (row_types[c] == NPY_UINT8)
+    {
+      uint8_t *src = rows[c];
+      for (x = 0; x < size_x; x++) out[x * PREVIEW_CHANNELS + c] = luts[c][src[x]];
+    }
+    else
+    {
+      uint16_t *src = rows[c];
+      for (x = 0; x < size_x; x++) out[x * PREVIEW_CHANNELS + c] = luts[c][src[x]];
+    }
+  }
+  *width = size_x;
+  return out;
 }
 
-#if defined IS_UNIX
-void * receive(void *vargp)
-#elif defined IS_WIN32
-DWORD receive(void *vargp)
-#endif
+// Protected by g_frame_lock
+void free_accumulator(struct gvsp *g)
 {
-  struct gvsp *g = vargp;
-  byte *buf;
-#if defined IS_UNIX
-  ssize_t buf_len;
-#elif defined IS_WIN32
-  int buf_len;
-#endif
-  ushort packet_format;
-  int result = 0;
+  free(g->accum_sum);
+  free(g->accum_sumsq);
+  g->accum_sum = NULL;
+  g->accum_sumsq = NULL;
+  g->accum_count = 0;
+  g->accum_rows = 0;
+  g->accum_cols = 0;
+}
 
-  buf = malloc(BUF_SIZE);
-  if (buf == NULL)
+// Protected by g_frame_lock. Add a decoded frame to the sums, sums are allocated with the first frame.
+void accumulate_frame(struct gvsp *g, struct part *parts, ulong part_count, void **frames, int *typenums)
+{
+  ulong rows = 0;
+  ulong cols = parts[0].size_x;
+  ulong i, j, n;
+  uint64_t *sum;
+  uint64_t *sumsq;
+  if (g->accum_max != 0 && g->accum_count >= g->accum_max) return;
+  for (i = 0; i < part_count; i++)
   {
-    printf("GVSP ERROR: Failed to allocate memory, aborting thread");
-    errno = ENOMEM;
-#if defined IS_UNIX
-    return NULL;
-#elif defined IS_WIN32
-    return 0;
-#endif
+    if (parts[i].size_x != cols)
+    {
+      if (g->warnings) printf("GVSP WARNING: Parts of different width cannot be accumulated\n");
+      return;
+    }
+    rows += parts[i].size_s;
   }
-  if (g->verbose) printf("GVSP: Receiver is listening port: %d\n", g->port);
-  while (true)
+  if (g->accum_sum == NULL)
   {
-    buf_len = recv(g->sockfd, buf, BUF_SIZE, 0);
-    lock_mutex(&g->frame_lock);
-    if (buf_len > 0)
+    g->accum_sum = calloc(rows * cols, sizeof (uint64_t));
+    g->accum_sumsq = calloc(rows * cols, sizeof (uint64_t));
+    if (g->accum_sum == NULL || g->accum_sumsq == NULL)
+    {
+      if (g->warnings) printf("GVSP WARNING: Failed to allocate memory for accumulation\n");
+      free_accumulator(g);
+      g->accum_mode = false;
+      return;
+    }
+    g->accum_rows = rows;
+    g->accum_cols = cols;
+  }
+  else if (g->accum_rows != rows || g->accum_cols != cols)
+  {
+    if (g->warnings) printf("GVSP WARNING: Frame size changed during accumulation, frame skipped\n");
+    return;
+  }
+
+  sum = g->accum_sum;
+  sumsq = g->accum_sumsq;
+  for (i = 0; i < part_count; i++)
+  {
+    n = parts[i].size_s * cols;
+    if (typenums[i] == NPY_UINT8)
     {
-      packet_format = *(buf + 4) & 0x0f;
-      if (packet_format == 3)
+      uint8_t *src = frames[i];
+      for (j = 0; j < n; j++)
       {
-        result = handle_frame(g, buf, (ulong)buf_len);
+        sum[j] += src[j];
+        sumsq[j] += (uint32_t)src[j] * src[j];
       }
-      else if (packet_format == 1)
+    }
+    else
+    {
+      uint16_t *src = frames[i];
+      for (j = 0; j < n; j++)
       {
-        result = handle_leader(g, buf, (ulong)buf_len);
+        sum[j] += src[j];
+        sumsq[j] += (uint32_t)src[j] * src[j];
       }
-      else if (packet_format == 2)
+    }
+    sum += n;
+    sumsq += n;
+  }
+  g->accum_count++;
+}
+
+void free_calibration(struct calibration *c)
+{
+  if (c == NULL) return;
+  free(c->dark);
+  free(c->gain);
+  free(c);
+}
+
+// Protected by g_frame_lock. Reflectance of a decoded frame, (raw - dark) / (white - dark) with the
+// precomputed reciprocal. Returns NULL if the frame does not match the references.
+void * calibrate_frame(struct gvsp *g, struct part *parts, ulong part_count, void **frames, int *typenums)
+{
+  struct calibration *c = g->calib;
+  ulong rows = 0;
+  ulong i, j, n;
+  float *dark = c->dark;
+  float *gain = c->gain;
+  float *out_f = NULL;
+  uint16_t *out_u = NULL;
+  float x;
+  void *out;
+  for (i = 0; i < part_count; i++)
+  {
+    if (parts[i].size_x != c->cols) break;
+    rows += parts[i].size_s;
+  }
+  if (i < part_count || rows != c->rows)
+  {
+    if (g->warnings) printf("GVSP WARNING: Frame size does not match calibration references\n");
+    return NULL;
+  }
+  out = malloc(rows * c->cols * (c->typenum == NPY_FLOAT32 ? sizeof (float) : sizeof (uint16_t)));
+  if (out == NULL) return NULL;
+  if (c->typenum == NPY_FLOAT32) out_f = out;
+  else out_u = out;
+
+  for (i = 0; i < part_count; i++)
+  {
+    n = parts[i].size_s * c->cols;
+    if (typenums[i] == NPY_UINT8)
+    {
+      uint8_t *src = frames[i];
+      if (out_f != NULL) for (j = 0; j < n; j++) out_f[j] = ((float)src[j] - dark[j]) * gain[j];
+      else for (j = 0; j < n; j++)
       {
-        result = handle_trailer(g, buf, (ulong)buf_len);
+        x = ((float)src[j] - dark[j]) * gain[j];
+        out_u[j] = x <= 0.0f ? 0 : x >= 65535.0f ? 65535 : (uint16_t)(x + 0.5f);
       }
     }
-    lock_mutex(&g->en_lock);
-    if (!g->recv_en)
+    else
     {
-      unlock_mutex(&g->en_lock);
-      unlock_mutex(&g->frame_lock);
-      break;
+      uint16_t *src = frames[i];
+      if (out_f != NULL) for (j = 0; j < n; j++) out_f[j] = ((float)src[j] - dark[j]) * gain[j];
+      else for (j = 0; j < n; j++)
+      {
+        x = ((float)src[j] - dark[j]) * gain[j];
+        out_u[j] = x <= 0.0f ? 0 : x >= 65535.0f ? 65535 : (uint16_t)(x + 0.5f);
+      }
     }
-    unlock_mutex(&g->en_lock);
-    unlock_mutex(&g->frame_lock);
-    if (result < 0)
+    dark += n;
+    gain += n;
+    if (out_f != NULL) out_f += n;
+    else out_u += n;
+  }
+  return out;
+}
+
+void free_bad_pixels(struct bad_pixels *b)
+{
+  if (b == NULL) return;
+  free(b->pixels);
+  free(b);
+}
+
+// Nearest good pixel in a direction, -1 if there is none within BAD_PIXEL_MAX_DISTANCE
+long find_good_neighbour(const bool *mask, ulong rows, ulong cols, ulong row, ulong col, long d_row, long d_col)
+{
+  long r = row;
+  long c = col;
+  int i;
+  for (i = 0; i < BAD_PIXEL_MAX_DISTANCE; i++)
+  {
+    r += d_row;
+    c += d_col;
+    if (r < 0 || c < 0 || r >= (long)rows || c >= (long)cols) return -1;
+    if (!mask[r * cols + c]) return r * cols + c;
+  }
+  return -1;
+}
+
+// Value of a pixel of stacked parts, parts have equal width
+#define STACKED_PIXEL(type, index) (((type*)frames[part_of[(index) / cols]]) [(index) - part_start[part_of[(index) / cols]]])
+
+// Protected by g_frame_lock. Replace bad pixels of a decoded frame with the mean of their neighbours.
+void correct_bad_pixels(struct gvsp *g, struct part *parts, ulong part_count, void **frames, int *typenums)
+{
+  struct bad_pixels *b = g->bad;
+  ulong part_start[MAX_PARTS];
+  ulong *part_of;
+  ulong rows = 0;
+  ulong cols = b->cols;
+  ulong i, r, k;
+  for (i = 0; i < part_count; i++)
+  {
+    if (parts[i].size_x != cols || (i > 0 && typenums[i] != typenums[0])) break;
+    rows += parts[i].size_s;
+  }
+  if (i < part_count || rows != b->rows)
+  {
+    if (g->warnings) printf("GVSP WARNING: Frame size does not match bad pixel map\n");
+    return;
+  }
+  part_of = malloc(rows * sizeof (ulong));
+  if (part_of == NULL) return;
+  r = 0;
+  for (i = 0; i < part_count; i++)
+  {
+    part_start[i] = r * cols;
+    for (k = 0; k < parts[i].size_s; k++) part_of[r++] = i;
+  }
+
+  ulong *p = b->pixels;
+  if (typenums[0] == NPY_UINT8)
+  {
+    for (k = 0; k < b->count; k++, p += 3)
     {
-      printf(errmsg);
-      break;
+      STACKED_PIXEL(uint8_t, p[0]) = (STACKED_PIXEL(uint8_t, p[1]) + STACKED_PIXEL(uint8_t, p[2]) + 1) / 2;
     }
   }
-  free(buf);
-#if defined IS_UNIX
-  return NULL;
-#elif defined IS_WIN32
-  return 0;
-#endif
+  else
+  {
+    for (k = 0; k < b->count; k++, p += 3)
+    {
+      STACKED_PIXEL(uint16_t, p[0]) = (STACKED_PIXEL(uint16_t, p[1]) + STACKED_PIXEL(uint16_t, p[2]) + 1) / 2;
+    }
+  }
+  free(part_of);
 }
+#undef STACKED_PIXEL
 
-int init_receive(struct gvsp *g)
+void free_band_selection(struct band_selection *b)
 {
-#if defined IS_UNIX
-  pthread_create(&g->recv_thread, NULL, receive, g);
-#elif defined IS_WIN32
-  g->recv_thread = CreateThread(NULL, 0, receive, g, 0, NULL);
-#endif
-  return 0;
+  if (b == NULL) return;
+  free(b->starts);
+  free(b->indexes);
+  free(b);
 }
 
-int open_connection(struct gvsp *g, char *ip_str)
+// Row of a band counted over all parts
+void * stacked_row(struct part *parts, void **frames, int typenum, ulong band)
 {
-  // Initialize address
-  struct sockaddr_in addr;
-  in_addr_t ip;
-  memset(&addr, '0', sizeof addr);
-  inet_pton(AF_INET, ip_str, &ip);
-  addr.sin_family = AF_INET;
-  addr.sin_addr.s_addr = ip;
-  addr.sin_port = htons(g->port);
+  ulong i;
+  for (i = 0; band >= parts[i].size_s; i++) band -= parts[i].size_s;
+  if (typenum == NPY_UINT8) return (uint8_t*)frames[i] + band * parts[i].size_x;
+  return (uint16_t*)frames[i] + band * parts[i].size_x;
+}
 
-  // Send dummy packet to open firewall
-  byte data[4] = {0, 0, 0, 0};
-  if (sendto(g->sockfd, data, sizeof data, 0, (struct sockaddr*) &addr, sizeof addr) < 0)
+// Protected by g_frame_lock. Replace the decoded parts with one frame of the selected bands, groups
+// of bands are averaged (rounded) so type and bit depth stay the same. Returns false and keeps the
+// frame if it does not have the bands.
+bool select_bands(struct gvsp *g, struct part *parts, ulong part_count, void **frames, int *typenums, int *bit_depths, struct part *selected)
+{
+  struct band_selection *b = g->selection;
+  ulong cols = parts[0].size_x;
+  ulong rows = 0;
+  ulong i, j, k, n;
+  ulong pixel_size = typenums[0] == NPY_UINT8 ? 1 : 2;
+  uint32_t *sum;
+  byte *out;
+  for (i = 0; i < part_count; i++)
   {
-    return -1;
+    if (parts[i].size_x != cols || typenums[i] != typenums[0] || bit_depths[i] != bit_depths[0]) break;
+    rows += parts[i].size_s;
+  }
+  if (i < part_count || b->max_index >= rows)
+  {
+    if (g->warnings) printf("GVSP WARNING: Frame does not have the selected bands\n");
+    return false;
+  }
+  out = malloc(b->count * cols * pixel_size);
+  sum = malloc(cols * sizeof (uint32_t));
+  if (out == NULL || sum == NULL)
+  {
+    free(out);
+    free(sum);
+    return false;
   }
 
-  if (g->verbose) printf("GVSP: Connection open\n");
-  return 0;
+  for (i = 0; i < b->count; i++)
+  {
+    n = b->starts[i + 1] - b->starts[i];
+    byte *dst = out + i * cols * pixel_size;
+    if (n == 1)
+    {
+      memcpy(dst, stacked_row(parts, frames, typenums[0], b->indexes[b->starts[i]]), cols * pixel_size);
+      continue;
+    }
+    memset(sum, 0, cols * sizeof (uint32_t));
+    for (k = b->starts[i]; k < b->starts[i + 1]; k++)
+    {
+      void *row = stacked_row(parts, frames, typenums[0], b->indexes[k]);
+      if (typenums[0] == NPY_UINT8) for (j = 0; j < cols; j++) sum[j] += ((uint8_t*)row)[j];
+      else for (j = 0; j < cols; j++) sum[j] += ((uint16_t*)row)[j];
+    }
+    if (typenums[0] == NPY_UINT8) for (j = 0; j < cols; j++) ((uint8_t*)dst)[j] = (sum[j] + n / 2) / n;
+    else for (j = 0; j < cols; j++) ((uint16_t*)dst)[j] = (sum[j] + n / 2) / n;
+  }
+  free(sum);
+
+  for (i = 0; i < part_count; i++) free(frames[i]);
+  frames[0] = out;
+  selected->start = 0;
+  selected->length = b->count * cols * pixel_size;
+  selected->pixel_format = parts[0].pixel_format;
+  selected->size_x = cols;
+  selected->size_s = b->count;
+  return true;
 }
 
-static const char DOC_CREATE_SOCKET[] = "Create and bind a socket to receive frames from the camera.\n\n"
-":param addr: Host IP address\n"
-":returns: Tuple of GVSP instance and host port\n"
-":raises MemoryError: Failed to allocate memory for GVSP instance\n";
-static PyObject * create_socket(PyObject *self, PyObject *args, PyObject *kwargs)
+// Wrap a decoded part to numpy.ndarray which frees the data, GIL must be held
+PyObject * part_to_ndarray(struct part *p, void *frame, int typenum)
 {
-  errno = 0;
+  npy_intp nds[] = {p->size_s, p->size_x};
+  PyObject *frame_py;
+  PyObject *caps_py;
 
-  // Parse arguments
-  char *ip_str;
-  static char *kwlist[] = {"addr", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &ip_str)) goto err1;
+  frame_py = PyArray_SimpleNewFromData(2, nds, typenum, frame);
+  if (frame_py == NULL)
+  {
+    strcpy(errmsg, "GVSP ERROR: Failed to create numpy.ndarray from a frame, STOPPING THREAD");
+    free(frame);
+    return NULL;
+  }
+  caps_py = PyCapsule_New(frame, "wrapped_buffer", (PyCapsule_Destructor)&free_frame);
+  if (PyArray_SetBaseObject((PyArrayObject*)frame_py, caps_py) == -1)
+  {
+    strcpy(errmsg, "GVSP ERROR: Failed to set destructor function for frame, STOPPING THREAD");
+    Py_DECREF(frame_py);
+    return NULL;
+  }
+  return frame_py;
+}
 
-  // Create an "instance" of GVSP
-  struct gvsp *g;
-  g = malloc(sizeof (struct gvsp));
-  if (g == NULL)
+// Protected by g_frame_lock
+int handle_trailer(struct gvsp *g, byte *payload, ulong payload_len, ulong packet_id)
+{
+
+  if (!g->leader_received)
   {
-    PyErr_SetString(PyExc_MemoryError, "Failed to allocate memory for GVSP instance");
-    goto err1;
+    if (g->warnings) printf("GVSP WARNING: Trailer received before leader\n");
+    return 0;
+  }
+  g->leader_received = false;
+  if (payload_len < 4)
+  {
+    if (g->warnings) printf("GVSP WARNING: Received invalid trailer packet\n");
+    return 0;
+  }
+  // Trailer is the packet after the last data packet
+  ulong packet_count = packet_id - 1;
+  if (g->received_packets != packet_count)
+  {
+    if (g->warnings) printf("GVSP WARNING: %ld packets dropped\n", packet_count - g->received_packets);
+    return 0;
   }
-  init_gvsp(g);
 
-#ifdef IS_WIN32
-  // Initialize Windows sockets
-  WSADATA wsa;
-  if (WSAStartup(MAKEWORD(2,2),&wsa) != 0) goto err1;
-#endif
+  PyGILState_STATE gil;
+  PyObject *frame_py;
+  PyObject *depth_py;
+  PyObject *part_py;
+  PyObject *bit_depth_py;
+  PyObject *args_py;
+  PyObject *kwargs_py = NULL;
+  PyObject *chunks_py;
+  PyObject *result_py;
+  ulong chunk_count = 0;
+  void *frames[MAX_PARTS]; // unsigend char or usinged short
+  int typenums[MAX_PARTS];
+  int bit_depths[MAX_PARTS];
+  byte *preview = NULL;
+  ulong preview_width = 0;
+  void *reflectance = NULL;
+  struct part *parts = g->parts; // Band selection replaces the parts with one frame
+  ulong part_count = g->part_count;
+  struct part selected;
+  bool multipart = g->payload_type == PAYLOAD_MULTIPART;
+  ulong i;
 
-  // Initialize arguments
-  struct sockaddr_in addr_init;
-  struct sockaddr_in addr_fin;
-  in_addr_t ip;
-  socklen_t addr_fin_len = sizeof addr_fin;
-  memset(&addr_init, '0', sizeof addr_init);
-  memset(&addr_fin, '0', sizeof addr_fin);
-  inet_pton(AF_INET, ip_str, &ip);
-  addr_init.sin_family = AF_INET;
-  addr_init.sin_addr.s_addr = ip;
-  addr_init.sin_port = htons(0);
+  // Decode received frame data
+  for (i = 0; i < g->part_count; i++)
+  {
+    frames[i] = decode_part(g, &g->parts[i], &typenums[i], &bit_depths[i]);
+    if (frames[i] == NULL)
+    {
+      while (i > 0) free(frames[--i]);
+      return -1;
+    }
+  }
 
-  // Set receive timeout
-#if defined IS_UNIX
-  struct timeval tv;
-  tv.tv_sec = 0;
-  tv.tv_usec = 100000;
-#elif defined IS_WIN32
-  DWORD tv = 100;
-#endif
+  // Bad pixels are corrected before anything else uses the frame
+  if (g->bad != NULL)
+  {
+    correct_bad_pixels(g, parts, part_count, frames, typenums);
+  }
 
-  // Create socket and bind it to host address
-  g->sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-  if (g->sockfd < 0) goto err2;
-  if (setsockopt(g->sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv) < 0) goto err3;
-  if (bind(g->sockfd, (struct sockaddr*) &addr_init, sizeof addr_init) < 0) goto err3;
-  if (getsockname(g->sockfd, (struct sockaddr*) &addr_fin, &addr_fin_len) < 0) goto err3;
-  g->port = ntohs(addr_fin.sin_port);
+  if (g->selection != NULL && select_bands(g, parts, part_count, frames, typenums, bit_depths, &selected))
+  {
+    parts = &selected;
+    part_count = 1;
+    multipart = false;
+  }
 
-  if (g->verbose) printf("GVSP: Socket created on %s:%d\n", ip_str, g->port);
+  if (g->accum_mode)
+  {
+    accumulate_frame(g, parts, part_count, frames, typenums);
+  }
+
+  // Preview row and reflectance are made before taking the GIL
+  if (g->preview_mode)
+  {
+    preview = make_preview_row(g, parts, part_count, frames, typenums, bit_depths, &preview_width);
+  }
+  if (g->calib != NULL)
+  {
+    reflectance = calibrate_frame(g, parts, part_count, frames, typenums);
+  }
+
+  // Create numpy.ndarray of the frame, multi-part frame set is a tuple of them
+  gil = PyGILState_Ensure();
+  if (multipart)
+  {
+    frame_py = PyTuple_New(part_count);
+    depth_py = PyTuple_New(part_count);
+    i = 0;
+    if (frame_py == NULL || depth_py == NULL)
+    {
+      strcpy(errmsg, "GVSP ERROR: Failed to create tuple for a multi-part frame set, STOPPING THREAD");
+      goto err_parts;
+    }
+    for (i = 0; i < part_count; i++)
+    {
+      part_py = part_to_ndarray(&parts[i], frames[i], typenums[i]);
+      if (part_py == NULL)
+      {
+        // Failed part is already freed
+        i++;
+        goto err_parts;
+      }
+      PyTuple_SET_ITEM(frame_py, i, part_py);
+      bit_depth_py = PyLong_FromLong(bit_depths[i]);
+      if (bit_depth_py == NULL)
+      {
+        // Frame of the part is owned by the tuple already
+        strcpy(errmsg, "GVSP ERROR: Failed to create bit depth of a multi-part frame set, STOPPING THREAD");
+        i++;
+        goto err_parts;
+      }
+      PyTuple_SET_ITEM(depth_py, i, bit_depth_py);
+    }
+  }
+  else
+  {
+    frame_py = part_to_ndarray(&parts[0], frames[0], typenums[0]);
+    if (frame_py == NULL)
+    {
+      free(preview);
+      free(reflectance);
+      PyGILState_Release(gil);
+      return -1;
+    }
+    depth_py = PyLong_FromLong(bit_depths[0]);
+  }
+
+  // Chunk data is passed as a keyword argument in chunk mode
+  if (g->chunk_mode)
+  {
+    if (g->payload_type & PAYLOAD_EXTENDED_CHUNK)
+    {
+      chunk_count = count_chunks(g);
+    }
+    npy_intp chunk_nds[] = {chunk_count};
+    Py_INCREF(chunk_descr);
+    chunks_py = PyArray_NewFromDescr(&PyArray_Type, chunk_descr, 1, chunk_nds, NULL, NULL, 0, NULL);
+    if (chunks_py == NULL)
+    {
+      strcpy(errmsg, "GVSP ERROR: Failed to create numpy.ndarray from chunk data, STOPPING THREAD");
+      Py_DECREF(frame_py);
+      Py_DECREF(depth_py);
+      free(preview);
+      free(reflectance);
+      PyGILState_Release(gil);
+      return -1;
+    }
+    parse_chunks(g, (struct chunk*)PyArray_DATA((PyArrayObject*)chunks_py), chunk_count);
+    kwargs_py = Py_BuildValue("{sN}", "chunks", chunks_py);
+  }
+
+  // Device timestamp is passed as a keyword argument in timestamp mode
+  if (g->timestamp_mode)
+  {
+    if (kwargs_py == NULL) kwargs_py = PyDict_New();
+    PyObject *timestamp_py = PyLong_FromUnsignedLongLong(g->timestamp);
+    if (kwargs_py == NULL || timestamp_py == NULL || PyDict_SetItemString(kwargs_py, "timestamp", timestamp_py) == -1)
+    {
+      strcpy(errmsg, "GVSP ERROR: Failed to pass frame timestamp, STOPPING THREAD");
+      Py_XDECREF(timestamp_py);
+      Py_XDECREF(kwargs_py);
+      Py_DECREF(frame_py);
+      Py_DECREF(depth_py);
+      free(preview);
+      free(reflectance);
+      PyGILState_Release(gil);
+      return -1;
+    }
+    Py_DECREF(timestamp_py);
+  }
+
+  // Preview row is passed as a keyword argument in preview mode
+  if (preview != NULL)
+  {
+    struct part preview_part = { 0, 0, 0, PREVIEW_CHANNELS, preview_width };
+    PyObject *preview_py = part_to_ndarray(&preview_part, preview, NPY_UINT8);
+    if (preview_py == NULL)
+    {
+      // Preview is already freed
+      PyErr_Clear();
+    }
+    else
+    {
+      if (kwargs_py == NULL) kwargs_py = PyDict_New();
+      if (kwargs_py != NULL) PyDict_SetItemString(kwargs_py, "preview", preview_py);
+      Py_DECREF(preview_py);
+    }
+  }
+
+  // Reflectance is passed as a keyword argument when calibration is on
+  if (reflectance != NULL)
+  {
+    struct part reflectance_part = { 0, 0, 0, g->calib->cols, g->calib->rows };
+    PyObject *reflectance_py = part_to_ndarray(&reflectance_part, reflectance, g->calib->typenum);
+    if (reflectance_py == NULL)
+    {
+      // Reflectance is already freed
+      PyErr_Clear();
+    }
+    else
+    {
+      if (kwargs_py == NULL) kwargs_py = PyDict_New();
+      if (kwargs_py != NULL) PyDict_SetItemString(kwargs_py, "reflectance", reflectance_py);
+      Py_DECREF(reflectance_py);
+    }
+  }
+
+  // Ouput frame
+  if (g->frame_cb != NULL)
+  {
+    args_py = Py_BuildValue("(OO)", frame_py, depth_py);
+    result_py = PyObject_Call(g->frame_cb, args_py, kwargs_py);
+    if (result_py == NULL)
+    {
+      // Exception in the callback must not be left pending in this thread
+      PyErr_Print();
+    }
+    Py_XDECREF(result_py);
+    Py_DECREF(args_py);
+  }
+  Py_XDECREF(kwargs_py);
+  Py_DECREF(frame_py);
+  Py_DECREF(depth_py);
+  PyGILState_Release(gil);
+
+  return 0;
+
+err_parts:
+  for (; i < part_count; i++) free(frames[i]);
+  free(preview);
+  free(reflectance);
+  Py_XDECREF(frame_py);
+  Py_XDECREF(depth_py);
+  PyGILState_Release(gil);
+  return -1;
+}
+
+// Protected by g_frame_lock
+int handle_packet(struct gvsp *g, byte *buf, ulong buf_len)
+{
+  ushort packet_format;
+  ulong packet_id;
+  ulong header_size;
+  if (buf_len < GVSP_HEADER_SIZE)
+  {
+    return 0;
+  }
+  header_size = parse_header(g, buf, buf_len, &packet_id);
+  if (header_size == 0)
+  {
+    return 0;
+  }
+  packet_format = *(buf + 4) & 0x0f;
+  buf += header_size;
+  buf_len -= header_size;
+  if (packet_format == PACKET_PAYLOAD)
+  {
+    return handle_frame(g, buf, buf_len, packet_id);
+  }
+  else if (packet_format == PACKET_MULTIPART)
+  {
+    return handle_part(g, buf, buf_len);
+  }
+  else if (packet_format == PACKET_LEADER)
+  {
+    return handle_leader(g, buf, buf_len, header_size);
+  }
+  else if (packet_format == PACKET_TRAILER)
+  {
+    return handle_trailer(g, buf, buf_len, packet_id);
+  }
+  return 0;
+}
+
+// Protected by g_frame_lock
+void write_pcap_record(struct gvsp *g, byte *buf, ulong buf_len, in_addr_t src_ip, ushort src_port)
+{
+  struct timespec ts;
+  uint32_t record[4];
+  byte headers[IP_HEADER_SIZE + UDP_HEADER_SIZE];
+  byte *ip = headers;
+  byte *udp = headers + IP_HEADER_SIZE;
+  ulong ip_len = IP_HEADER_SIZE + UDP_HEADER_SIZE + buf_len;
+  ulong sum = 0;
+  int i;
+
+  // Record header is in the byte order of the writer, like the file header
+  timespec_get(&ts, TIME_UTC);
+  record[0] = (uint32_t)ts.tv_sec;
+  record[1] = (uint32_t)ts.tv_nsec;
+  record[2] = (uint32_t)ip_len;
+  record[3] = (uint32_t)ip_len;
+
+  // Recreate IPv4 and UDP headers so that the file opens in Wireshark as is
+  memset(headers, 0, sizeof headers);
+  *ip = 0x45;
+  uint16_to_bytes(ip + 2, ip_len);
+  *(ip + 6) = 0x40; // Do not fragment
+  *(ip + 8) = 64;
+  *(ip + 9) = 17; // UDP
+  memcpy(ip + 12, &src_ip, 4);
+  memcpy(ip + 16, &g->host_ip, 4);
+  for (i = 0; i < IP_HEADER_SIZE; i += 2)
+  {
+    sum += bytes_to_uint16(ip + i);
+  }
+  while (sum >> 16)
+  {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  uint16_to_bytes(ip + 10, ~sum & 0xffff);
+  uint16_to_bytes(udp, src_port);
+  uint16_to_bytes(udp + 2, g->port);
+  uint16_to_bytes(udp + 4, UDP_HEADER_SIZE + buf_len);
+
+  fwrite(record, sizeof record, 1, g->pcap_file);
+  fwrite(headers, sizeof headers, 1, g->pcap_file);
+  fwrite(buf, 1, buf_len, g->pcap_file);
+}
+
+#if defined IS_UNIX
+void * receive(void *vargp)
+#elif defined IS_WIN32
+DWORD receive(void *vargp)
+#endif
+{
+  struct gvsp *g = vargp;
+  byte *buf;
+  struct sockaddr_in src;
+  socklen_t src_len;
+#if defined IS_UNIX
+  ssize_t buf_len;
+#elif defined IS_WIN32
+  int buf_len;
+#endif
+  int result = 0;
+  uint64_t now;
+
+  buf = malloc(BUF_SIZE);
+  if (buf == NULL)
+  {
+    printf("GVSP ERROR: Failed to allocate memory, aborting thread");
+    errno = ENOMEM;
+#if defined IS_UNIX
+    return NULL;
+#elif defined IS_WIN32
+    return 0;
+#endif
+  }
+  if (g->verbose) printf("GVSP: Receiver is listening port: %d\n", g->port);
+  while (true)
+  {
+    src_len = sizeof src;
+    buf_len = recvfrom(g->sockfd, buf, BUF_SIZE, 0, (struct sockaddr*) &src, &src_len);
+    now = monotonic_ns();
+    lock_mutex(&g->frame_lock);
+    if (buf_len > 0)
+    {
+      // Gaps between blocks are measured by frame intervals
+      if (g->leader_received && g->last_packet_time != 0)
+      {
+        hist_record(&g->packet_gaps, now - g->last_packet_time);
+      }
+      g->last_packet_time = now;
+      g->recv_time = now;
+      if (g->pcap_file != NULL)
+      {
+        write_pcap_record(g, buf, (ulong)buf_len, src.sin_addr.s_addr, ntohs(src.sin_port));
+      }
+      result = handle_packet(g, buf, (ulong)buf_len);
+      g->recv_time = 0;
+    }
+    lock_mutex(&g->en_lock);
+    if (!g->recv_en)
+    {
+      unlock_mutex(&g->en_lock);
+      unlock_mutex(&g->frame_lock);
+      break;
+    }
+    unlock_mutex(&g->en_lock);
+    unlock_mutex(&g->frame_lock);
+    if (result < 0)
+    {
+      printf(errmsg);
+      break;
+    }
+  }
+  free(buf);
+#if defined IS_UNIX
+  return NULL;
+#elif defined IS_WIN32
+  return 0;
+#endif
+}
+
+struct pcap_reader
+{
+  FILE *file;
+  bool pcapng;
+  bool swapped;
+  ulong linktypes[PCAP_MAX_INTERFACES];
+  ulong if_count;
+  ulong snaplen;
+  byte *block;
+  ulong block_size;
+};
+
+int pcap_reserve(struct pcap_reader *r, ulong size)
+{
+  byte *block;
+  if (size <= r->block_size)
+  {
+    return 0;
+  }
+  block = realloc(r->block, size);
+  if (block == NULL)
+  {
+    return -1;
+  }
+  r->block = block;
+  r->block_size = size;
+  return 0;
+}
+
+// Returns 0 on success, -1 if the file cannot be read and -2 if the format is not supported
+int pcap_open(struct pcap_reader *r, const char *path)
+{
+  uint32_t header[6];
+  r->file = fopen(path, "rb");
+  r->pcapng = false;
+  r->swapped = false;
+  r->if_count = 0;
+  r->block = NULL;
+  r->block_size = 0;
+  r->snaplen = PCAP_MAX_PACKET;
+  if (r->file == NULL)
+  {
+    return -1;
+  }
+  if (fread(header, 4, 1, r->file) != 1)
+  {
+    return -2;
+  }
+  if (header[0] == PCAPNG_SHB)
+  {
+    // Section header block is parsed by pcap_next
+    r->pcapng = true;
+    fseek(r->file, 0, SEEK_SET);
+    return 0;
+  }
+  if (header[0] == swap_uint32(PCAP_MAGIC_USEC, true) || header[0] == swap_uint32(PCAP_MAGIC_NSEC, true))
+  {
+    r->swapped = true;
+  }
+  else if (header[0] != PCAP_MAGIC_USEC && header[0] != PCAP_MAGIC_NSEC)
+  {
+    return -2;
+  }
+  if (fread(header + 1, 20, 1, r->file) != 1)
+  {
+    return -2;
+  }
+  r->linktypes[0] = swap_uint32(header[5], r->swapped) & 0xffff;
+  r->if_count = 1;
+  r->snaplen = swap_uint32(header[4], r->swapped);
+  if (r->snaplen == 0 || r->snaplen > PCAP_MAX_PACKET) r->snaplen = PCAP_MAX_PACKET;
+  return 0;
+}
+
+void pcap_close(struct pcap_reader *r)
+{
+  if (r->file != NULL) fclose(r->file);
+  free(r->block);
+}
+
+// Returns length of the next captured packet, 0 at the end of the file and -1 on error
+long pcap_next(struct pcap_reader *r, byte **data, ulong *linktype)
+{
+  uint32_t header[4];
+  ulong type;
+  ulong total_len;
+  ulong cap_len;
+  ulong if_id;
+  uint16_t linktype16;
+
+  if (!r->pcapng)
+  {
+    if (fread(header, sizeof header, 1, r->file) != 1)
+    {
+      return 0;
+    }
+    cap_len = swap_uint32(header[2], r->swapped);
+    // Check the length before allocating, a corrupt record could ask for gigabytes
+    if (cap_len > r->snaplen || pcap_reserve(r, cap_len) < 0 || fread(r->block, 1, cap_len, r->file) != cap_len)
+    {
+      return -1;
+    }
+    *data = r->block;
+    *linktype = r->linktypes[0];
+    return (long)cap_len;
+  }
+
+  while (true)
+  {
+    if (fread(header, 8, 1, r->file) != 1)
+    {
+      return 0;
+    }
+    type = header[0];
+    if (type == PCAPNG_SHB)
+    {
+      // Byte order of the section is known only after reading the byte order magic
+      if (fread(header + 2, 4, 1, r->file) != 1)
+      {
+        return -1;
+      }
+      if (header[2] == PCAPNG_BYTE_ORDER_MAGIC) r->swapped = false;
+      else if (header[2] == swap_uint32(PCAPNG_BYTE_ORDER_MAGIC, true)) r->swapped = true;
+      else return -1;
+      r->if_count = 0;
+      total_len = swap_uint32(header[1], r->swapped);
+      if (total_len < 12 || fseek(r->file, total_len - 12, SEEK_CUR) != 0)
+      {
+        return -1;
+      }
+      continue;
+    }
+    type = swap_uint32(type, r->swapped);
+    total_len = swap_uint32(header[1], r->swapped);
+    if (total_len < 12)
+    {
+      return -1;
+    }
+    if (type != PCAPNG_IDB && type != PCAPNG_EPB && type != PCAPNG_SPB)
+    {
+      // Other blocks are not needed, skip them without reading
+      if (fseek(r->file, total_len - 8, SEEK_CUR) != 0)
+      {
+        return -1;
+      }
+      continue;
+    }
+    if (total_len > PCAPNG_MAX_BLOCK || pcap_reserve(r, total_len) < 0 || fread(r->block, 1, total_len - 8, r->file) != total_len - 8)
+    {
+      return -1;
+    }
+    if (type == PCAPNG_IDB)
+    {
+      if (r->if_count < PCAP_MAX_INTERFACES)
+      {
+        memcpy(&linktype16, r->block, 2);
+        if (r->swapped) linktype16 = (linktype16 >> 8) | (linktype16 << 8);
+        r->linktypes[r->if_count] = linktype16;
+      }
+      r->if_count++;
+    }
+    else if (type == PCAPNG_EPB && total_len >= 32)
+    {
+      if_id = swap_uint32(*(uint32_t*)r->block, r->swapped);
+      cap_len = swap_uint32(*(uint32_t*)(r->block + 12), r->swapped);
+      if (if_id >= r->if_count || if_id >= PCAP_MAX_INTERFACES || cap_len > total_len - 32)
+      {
+        return -1;
+      }
+      *data = r->block + 20;
+      *linktype = r->linktypes[if_id];
+      return (long)cap_len;
+    }
+    else if (type == PCAPNG_SPB && total_len >= 16 && r->if_count > 0)
+    {
+      cap_len = swap_uint32(*(uint32_t*)r->block, r->swapped);
+      if (cap_len > total_len - 16) cap_len = total_len - 16;
+      *data = r->block + 4;
+      *linktype = r->linktypes[0];
+      return (long)cap_len;
+    }
+  }
+}
+
+// Strip link layer, IPv4 and UDP headers. Returns NULL if the packet is not a matching UDP datagram.
+byte * pcap_udp_payload(byte *data, ulong len, ulong linktype, ushort port, ulong *payload_len)
+{
+  ulong ether_type = 0x0800;
+  ulong ip_header_len;
+  ulong udp_len;
+
+  if (linktype == LINKTYPE_ETHERNET)
+  {
+    if (len < 14) return NULL;
+    ether_type = bytes_to_uint16(data + 12);
+    data += 14;
+    len -= 14;
+    if (ether_type == 0x8100 && len >= 4) // VLAN tag
+    {
+      ether_type = bytes_to_uint16(data + 2);
+      data += 4;
+      len -= 4;
+    }
+  }
+  else if (linktype == LINKTYPE_LINUX_SLL)
+  {
+    if (len < 16) return NULL;
+    ether_type = bytes_to_uint16(data + 14);
+    data += 16;
+    len -= 16;
+  }
+  else if (linktype != LINKTYPE_RAW && linktype != LINKTYPE_IPV4)
+  {
+    return NULL;
+  }
+  if (ether_type != 0x0800 || len < IP_HEADER_SIZE || (*data >> 4) != 4)
+  {
+    return NULL;
+  }
+  ip_header_len = (*data & 0x0f) * 4;
+  if (*(data + 9) != 17 || len < ip_header_len + UDP_HEADER_SIZE)
+  {
+    return NULL;
+  }
+  if (bytes_to_uint16(data + 6) & 0x3fff) // Fragmented datagrams are not reassembled
+  {
+    return NULL;
+  }
+  data += ip_header_len;
+  len -= ip_header_len;
+  if (port != 0 && bytes_to_uint16(data + 2) != port)
+  {
+    return NULL;
+  }
+  udp_len = bytes_to_uint16(data + 4);
+  if (udp_len < UDP_HEADER_SIZE || udp_len > len)
+  {
+    return NULL;
+  }
+  *payload_len = udp_len - UDP_HEADER_SIZE;
+  return data + UDP_HEADER_SIZE;
+}
+
+int init_receive(struct gvsp *g)
+{
+#if defined IS_UNIX
+  pthread_create(&g->recv_thread, NULL, receive, g);
+#elif defined IS_WIN32
+  g->recv_thread = CreateThread(NULL, 0, receive, g, 0, NULL);
+#endif
+  return 0;
+}
+
+int open_connection(struct gvsp *g, char *ip_str)
+{
+  // Initialize address
+  struct sockaddr_in addr;
+  in_addr_t ip;
+  memset(&addr, '0', sizeof addr);
+  inet_pton(AF_INET, ip_str, &ip);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = ip;
+  addr.sin_port = htons(g->port);
+
+  // Send dummy packet to open firewall
+  byte data[4] = {0, 0, 0, 0};
+  if (sendto(g->sockfd, data, sizeof data, 0, (struct sockaddr*) &addr, sizeof addr) < 0)
+  {
+    return -1;
+  }
+
+  if (g->verbose) printf("GVSP: Connection open\n");
+  return 0;
+}
+
+static const char DOC_CREATE_SOCKET[] = "Create and bind a socket to receive frames from the camera.\n\n"
+":param addr: Host IP address\n"
+":returns: Tuple of GVSP instance and host port\n"
+":raises MemoryError: Failed to allocate memory for GVSP instance\n";
+static PyObject * create_socket(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  errno = 0;
+
+  // Parse arguments
+  char *ip_str;
+  static char *kwlist[] = {"addr", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &ip_str)) goto err1;
+
+  // Create an "instance" of GVSP
+  struct gvsp *g;
+  g = malloc(sizeof (struct gvsp));
+  if (g == NULL)
+  {
+    PyErr_SetString(PyExc_MemoryError, "Failed to allocate memory for GVSP instance");
+    goto err1;
+  }
+  init_gvsp(g);
+
+#ifdef IS_WIN32
+  // Initialize Windows sockets
+  WSADATA wsa;
+  if (WSAStartup(MAKEWORD(2,2),&wsa) != 0) goto err1;
+#endif
+
+  // Initialize arguments
+  struct sockaddr_in addr_init;
+  struct sockaddr_in addr_fin;
+  in_addr_t ip;
+  socklen_t addr_fin_len = sizeof addr_fin;
+  memset(&addr_init, '0', sizeof addr_init);
+  memset(&addr_fin, '0', sizeof addr_fin);
+  inet_pton(AF_INET, ip_str, &ip);
+  addr_init.sin_family = AF_INET;
+  addr_init.sin_addr.s_addr = ip;
+  addr_init.sin_port = htons(0);
+
+  // Set receive timeout
+#if defined IS_UNIX
+  struct timeval tv;
+  tv.tv_sec = 0;
+  tv.tv_usec = 100000;
+#elif defined IS_WIN32
+  DWORD tv = 100;
+#endif
+
+  // Create socket and bind it to host address
+  g->sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (g->sockfd < 0) goto err2;
+  if (setsockopt(g->sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv) < 0) goto err3;
+  if (bind(g->sockfd, (struct sockaddr*) &addr_init, sizeof addr_init) < 0) goto err3;
+  if (getsockname(g->sockfd, (struct sockaddr*) &addr_fin, &addr_fin_len) < 0) goto err3;
+  g->port = ntohs(addr_fin.sin_port);
+  g->host_ip = ip;
+
+  if (g->verbose) printf("GVSP: Socket created on %s:%d\n", ip_str, g->port);
+
+  return Py_BuildValue("NN", PyCapsule_New(g, "gvsp", NULL), PyLong_FromLong(g->port));
+#if defined IS_UNIX
+  err3: close((int)g->sockfd);
+#elif defined IS_WIN32
+  err3: closesocket(g->sockfd);
+#endif
+err2: free(g);
+err1: return handle_py_error();
+}
+
+static const char DOC_CLOSE_SOCKET[] = "Close the socket.\n\n"
+":param g: GVSP instance\n"
+":returns: None\n"
+":raises ConnectionError: Socket has been closed already or receiving of frames is active\n";
+static PyObject * close_socket(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  errno = 0;
+
+  // Parse arguments
+  struct gvsp *g = get_gvsp(args, kwargs);
+  if (g == NULL) goto err;
+
+  // Check state of GVSP
+  if (is_receiving(g)) goto err;
+  if (has_no_socket(g)) goto err;
+
+  // Close socket and delete instance
+#if defined IS_UNIX
+  if (close((int)g->sockfd) < 0) goto err;
+#elif defined IS_WIN32
+  if (closesocket(g->sockfd) < 0) goto err;
+#endif
+  g->sockfd = -1;
+  if (g->pcap_file != NULL)
+  {
+    fclose(g->pcap_file);
+    g->pcap_file = NULL;
+  }
+  free_preview_luts(g);
+  free_accumulator(g);
+  free_calibration(g->calib);
+  free_bad_pixels(g->bad);
+  free_band_selection(g->selection);
+  if (g->verbose) printf("GVSP: Socket closed\n");
+  free(g);
+
+err: return handle_py_error();
+}
+
+static const char DOC_CREATE_BUFFER[] = "Create buffer to receive frames.\n\n"
+":param g: GVSP instance\n"
+":param payload_size: Payload size of one full frame + possible padding\n"
+":param packet_size: Size of a single packet\n"
+":returns: None\n"
+":raises ConnectionError: GVSP is receiving frames, buffer must have been created already\n"
+":raises MemoryError: Failed to allocate memory or buffer is created already\n"
+":raises ValueError: Problem with payload size or packet size\n";
+static PyObject * create_buffer(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  errno = 0;
+
+  // Parse arguments
+  PyObject *g_caps;
+  ulong payload_size = 0;
+  ulong packet_size = 0;
+  ulong packet_payload_size = 0;
+  static char *kwlist[] = {"g", "payload_size", "packet_size", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Okk", kwlist, &g_caps, &payload_size, &packet_size)) goto err1;
+  struct gvsp *g = PyCapsule_GetPointer(g_caps, "gvsp");
+  if (g == NULL) goto err1;
+
+  // Check state of GVSP
+  if (is_receiving(g)) goto err1;
+  if (has_buffer(g)) goto err1;
+
+  // Create buffer to receive frames
+  g->frame_buf = malloc(payload_size);
+  if (g->frame_buf == NULL)
+  {
+    PyErr_SetString(PyExc_MemoryError, "Failed to allocate memory for frame buffer");
+    goto err1;
+  }
+  if (packet_size <= GVSP_TOTAL_HEADER_SIZE)
+  {
+    PyErr_SetString(PyExc_ValueError, "Packet size must be greater than 0 (without headers)");
+    goto err2;
+  }
+  packet_payload_size = packet_size - GVSP_TOTAL_HEADER_SIZE;
+  g->payload_size = payload_size;
+  g->packet_size = packet_payload_size;
+  g->packet_count = (payload_size + packet_payload_size - 1) / packet_payload_size; // Last packet can be shorter
+
+  if (g->verbose)
+  {
+    printf("GVSP: Packet size: %ld, packet count: %ld\n", g->packet_size, g->packet_count);
+    printf("GVSP: Frame buffer created, %ld bytes\n", payload_size);
+  }
+  return PyLong_FromLong(0);
+err2: free(g->frame_buf);
+err1: return handle_py_error();
+}
+
+static const char DOC_FREE_BUFFER[] = "Release the frame buffer.\n\n"
+":param g: GVSP instance\n"
+":returns: None\n"
+":raises ConnectionError: GVSP is receiving frames, buffer cannot be freed\n"
+":raises MemoryError: Buffer has already been freed\n";
+static PyObject * free_buffer(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  errno = 0;
+
+  // Parse arguments
+  struct gvsp *g = get_gvsp(args, kwargs);
+  if (g == NULL) goto err;
+
+  // Check state of GVSP
+  if (is_receiving(g)) goto err;
+  if (has_no_buffer(g)) goto err;
+
+  // Free buffer and reset related values
+  g->payload_size = 0;
+  g->packet_size = 0;
+  g->packet_count = 0;
+  free(g->frame_buf);
+  g->frame_buf = NULL;
+
+  if (g->verbose) printf("GVSP: Frame buffer freed\n");
+err: return handle_py_error();
+}
+
+static const char DOC_START_RECEIVE[] = "Start listening incoming GVSP packets.\n\n"
+":param g: GVSP instance\n"
+":param addr: IP address of the camera as string\n"
+":returns: None\n"
+":raises ConnectionError: GVSP is already receiving frames or there is no socket to receive frames\n"
+":raises MemoryError: There is no buffer\n";
+static PyObject * start_receive(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  errno = 0;
+
+  // Parse arguments
+  PyObject *g_caps;
+  char *ip_str;
+  static char *kwlist[] = {"g", "addr", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Os", kwlist, &g_caps, &ip_str)) goto err;
+  struct gvsp *g = PyCapsule_GetPointer(g_caps, "gvsp");
+  if (g == NULL) goto err;
+
+  // Check state of GVSP
+  if (is_receiving(g)) goto err;
+  if (has_no_socket(g)) goto err;
+  if (has_no_buffer(g)) goto err;
+
+  // Send dummy packet to traverse firewall
+  if (open_connection(g, ip_str) < 0) goto err;
+
+  // Start listening for incoming packets, gaps are not measured across restarts
+  g->last_packet_time = 0;
+  g->last_leader_time = 0;
+  g->recv_en = true;
+  init_receive(g);
+
+err: return handle_py_error();
+}
+
+static const char DOC_RECEIVE_TEST_PACKET[] = "Wait for a test packet the camera sends when fire test packet bit of GevSCPS is set.\n\n"
+"All datagrams arriving to the stream channel port are counted, GVSP must not be receiving frames.\n\n"
+":param g: GVSP instance\n"
+":param addr: IP address of the camera as string\n"
+":param size: Expected size of the test packet (IP packet, i.e. GevSCPS packet size)\n"
+":param timeout: Time to wait in seconds\n"
+":returns: Size of the largest received packet (IP packet) or 0 if nothing was received\n"
+":raises ConnectionError: GVSP is receiving frames\n"
+":raises MemoryError: Failed to allocate memory\n";
+static PyObject * receive_test_packet(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  errno = 0;
+
+  // Parse arguments
+  PyObject *g_caps;
+  char *ip_str;
+  ulong size;
+  double timeout;
+  static char *kwlist[] = {"g", "addr", "size", "timeout", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oskd", kwlist, &g_caps, &ip_str, &size, &timeout)) goto err;
+  struct gvsp *g = PyCapsule_GetPointer(g_caps, "gvsp");
+  if (g == NULL) goto err;
+
+  // Check state of GVSP
+  if (is_receiving(g)) goto err;
+  if (has_no_socket(g)) goto err;
+
+  // Send dummy packet to traverse firewall
+  if (open_connection(g, ip_str) < 0) goto err;
+
+  byte *buf = malloc(BUF_SIZE);
+  if (buf == NULL)
+  {
+    PyErr_SetString(PyExc_MemoryError, "Failed to allocate memory for test packet");
+    goto err;
+  }
+  ulong max_len = 0;
+  Py_BEGIN_ALLOW_THREADS
+  uint64_t deadline = monotonic_ns() + (uint64_t)(timeout * 1e9);
+  while (max_len < size && monotonic_ns() < deadline)
+  {
+    // Socket has a receive timeout, so this returns regularly
+    long buf_len = recvfrom(g->sockfd, buf, BUF_SIZE, 0, NULL, NULL);
+    if (buf_len > 0 && (ulong)buf_len + IP_HEADER_SIZE + UDP_HEADER_SIZE > max_len)
+    {
+      max_len = (ulong)buf_len + IP_HEADER_SIZE + UDP_HEADER_SIZE;
+    }
+  }
+  Py_END_ALLOW_THREADS
+  free(buf);
+
+  if (g->verbose) printf("GVSP: Test packet of %ld bytes expected, largest received: %ld bytes\n", size, max_len);
+  return PyLong_FromUnsignedLong(max_len);
+err: return handle_py_error();
+}
+
+static const char DOC_STOP_RECEIVE[] = "Stop listening packets.\n\n"
+":param g: GVSP instance\n"
+":returns: None\n"
+":raises ConnectionError: Already stopped receiving frames\n";
+static PyObject * stop_receive(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  errno = 0;
+
+  // Parse arguments
+  struct gvsp *g = get_gvsp(args, kwargs);
+  if (g == NULL) goto err;
+
+  // Check state of GVSP
+  if (is_not_receiving(g)) goto err;
+
+  lock_mutex(&g->en_lock);
+  g->recv_en = false;
+  unlock_mutex(&g->en_lock);
+  PyThreadState *tstate = PyEval_SaveThread();
+#if defined IS_UNIX
+  pthread_join(g->recv_thread, NULL);
+#elif defined IS_WIN32
+  WaitForSingleObject(g->recv_thread, INFINITE);
+#endif
+  PyEval_RestoreThread(tstate);
+  // Only single thread should be running now
+
+  if (g->verbose) printf("GVSP: Stopped listening incoming packets\n");
+err: return handle_py_error();
+}
+
+static const char DOC_FRAME_CB[] = "Set a callback function to get frames.\n\n"
+"Callback is called with the frame (numpy.ndarray) and its bit depth. Multi-part payload is passed\n"
+"as a tuple of frames (one for each part) and a tuple of bit depths.\n\n"
+":param g: GVSP instance\n"
+":param callback: Function to call when a frame is received or None\n"
+":returns: None\n"
+":raises TypeError: Callback is not a function or None\n";
+static PyObject * set_frame_cb(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  errno = 0;
+
+  // Parse arguments
+  PyObject *g_caps;
+  PyObject *cb;
+  static char *kwlist[] = {"g", "callback", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO", kwlist, &g_caps, &cb)) goto err;
+  struct gvsp *g = PyCapsule_GetPointer(g_caps, "gvsp");
+  if (g == NULL) goto err;
+  if (!PyCallable_Check(cb) && cb != NULL) {
+    PyErr_SetString(PyExc_TypeError, "Callback function must be callable");
+    goto err;
+  }
+
+  // Set callback function
+  Py_XINCREF(cb);
+  lock_mutex(&g->frame_lock);
+  Py_XDECREF(g->frame_cb);
+  g->frame_cb = cb;
+  unlock_mutex(&g->frame_lock);
+
+  if (g->verbose) printf("GVSP: Frame callback function set\n");
+err: return handle_py_error();
+}
+
+static const char DOC_START_PCAP[] = "Start saving received raw packets to a pcap file.\n\n"
+"Packets are written before they are decoded, including packets that fail to decode. IPv4 and UDP\n"
+"headers are recreated so that the file can be opened with Wireshark or replayed with replay_pcap.\n\n"
+":param g: GVSP instance\n"
+":param path: Path of the pcap file, existing file will be overwritten\n"
+":returns: None\n"
+":raises ConnectionError: Packet capture is already active\n"
+":raises OSError: File cannot be opened\n";
+static PyObject * start_pcap(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  errno = 0;
+
+  // Parse arguments
+  PyObject *g_caps;
+  char *path;
+  FILE *file;
+  uint32_t header[6] = {PCAP_MAGIC_NSEC, 0x00040002, 0, 0, 65535, LINKTYPE_RAW};
+  static char *kwlist[] = {"g", "path", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Os", kwlist, &g_caps, &path)) goto err;
+  struct gvsp *g = PyCapsule_GetPointer(g_caps, "gvsp");
+  if (g == NULL) goto err;
+
+  // Open the file and write pcap file header (version 2.4, nanosecond timestamps)
+  file = fopen(path, "wb");
+  if (file == NULL)
+  {
+    PyErr_Format(PyExc_OSError, "Cannot open %s: %s", path, strerror(errno));
+    errno = 0;
+    goto err;
+  }
+  setvbuf(file, NULL, _IOFBF, PCAP_WRITE_BUF_SIZE);
+  if (fwrite(header, sizeof header, 1, file) != 1)
+  {
+    PyErr_Format(PyExc_OSError, "Cannot write %s: %s", path, strerror(errno));
+    errno = 0;
+    fclose(file);
+    goto err;
+  }
+
+  // Hand the file over to the receive thread
+  Py_BEGIN_ALLOW_THREADS
+  lock_mutex(&g->frame_lock);
+  if (g->pcap_file == NULL)
+  {
+    g->pcap_file = file;
+    file = NULL;
+  }
+  unlock_mutex(&g->frame_lock);
+  Py_END_ALLOW_THREADS
+  if (file != NULL)
+  {
+    fclose(file);
+    PyErr_SetString(PyExc_ConnectionError, "Packet capture is already active");
+    goto err;
+  }
+
+  if (g->verbose) printf("GVSP: Saving packets to %s\n", path);
+err: return handle_py_error();
+}
+
+static const char DOC_STOP_PCAP[] = "Stop saving received raw packets and close the pcap file.\n\n"
+":param g: GVSP instance\n"
+":returns: None\n"
+":raises ConnectionError: Packet capture is not active\n";
+static PyObject * stop_pcap(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  errno = 0;
+
+  // Parse arguments
+  FILE *file;
+  struct gvsp *g = get_gvsp(args, kwargs);
+  if (g == NULL) goto err;
+
+  // Take the file from the receive thread
+  Py_BEGIN_ALLOW_THREADS
+  lock_mutex(&g->frame_lock);
+  file = g->pcap_file;
+  g->pcap_file = NULL;
+  unlock_mutex(&g->frame_lock);
+  Py_END_ALLOW_THREADS
+  if (file == NULL)
+  {
+    PyErr_SetString(PyExc_ConnectionError, "Packet capture is not active");
+    goto err;
+  }
+  fclose(file);
+
+  if (g->verbose) printf("GVSP: Stopped saving packets\n");
+err: return handle_py_error();
+}
+
+static const char DOC_REPLAY_PCAP[] = "Feed packets from a pcap or pcapng file through the frame decoder.\n\n"
+"Packets are processed as fast as possible in the calling thread and decoded frames are passed to\n"
+"the frame callback exactly like received frames. Buffer must match the recorded stream.\n\n"
+":param g: GVSP instance\n"
+":param path: Path of the pcap or pcapng file\n"
+":param port: Replay only UDP packets sent to this port, 0 to replay all UDP packets\n"
+":returns: Number of replayed packets\n"
+":raises ConnectionError: GVSP is receiving frames\n"
+":raises MemoryError: There is no buffer\n"
+":raises OSError: File cannot be read\n"
+":raises ValueError: File format is not supported\n"
+":raises RuntimeError: Decoding a frame failed\n";
+static PyObject * replay_pcap(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  errno = 0;
+
+  // Parse arguments
+  PyObject *g_caps;
+  char *path;
+  ushort port = 0;
+  static char *kwlist[] = {"g", "path", "port", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Os|H", kwlist, &g_caps, &path, &port)) goto err1;
+  struct gvsp *g = PyCapsule_GetPointer(g_caps, "gvsp");
+  if (g == NULL) goto err1;
+
+  // Check state of GVSP
+  if (is_receiving(g)) goto err1;
+  if (has_no_buffer(g)) goto err1;
+
+  struct pcap_reader reader;
+  byte *data;
+  byte *payload;
+  ulong payload_len;
+  ulong linktype;
+  long data_len = 0;
+  long count = 0;
+  int result = 0;
+  int status = pcap_open(&reader, path);
+  if (status == -1)
+  {
+    PyErr_Format(PyExc_OSError, "Cannot open %s: %s", path, strerror(errno));
+    goto err2;
+  }
+  else if (status == -2)
+  {
+    PyErr_Format(PyExc_ValueError, "%s is not a pcap or pcapng file", path);
+    goto err2;
+  }
+
+  // Decode packets in this thread, frame callback will take GIL when needed
+  Py_BEGIN_ALLOW_THREADS
+  while (true)
+  {
+    data_len = pcap_next(&reader, &data, &linktype);
+    if (data_len <= 0) break;
+    payload = pcap_udp_payload(data, (ulong)data_len, linktype, port, &payload_len);
+    if (payload == NULL) continue;
+    lock_mutex(&g->frame_lock);
+    result = handle_packet(g, payload, payload_len);
+    unlock_mutex(&g->frame_lock);
+    count++;
+    if (result < 0) break;
+  }
+  Py_END_ALLOW_THREADS
+
+  if (result < 0)
+  {
+    PyErr_SetString(PyExc_RuntimeError, errmsg);
+    goto err2;
+  }
+  if (data_len < 0)
+  {
+    PyErr_Format(PyExc_ValueError, "%s is truncated or corrupted", path);
+    goto err2;
+  }
+  pcap_close(&reader);
+  if (g->verbose) printf("GVSP: Replayed %ld packets from %s\n", count, path);
+  return PyLong_FromLong(count);
+err2:
+  errno = 0;
+  pcap_close(&reader);
+err1: return handle_py_error();
+}
+
+static const char DOC_SET_CHUNK_MODE[] = "Parse chunk data appended to frames (extended chunk mode).\n\n"
+"When enabled, the frame callback gets an extra keyword argument 'chunks': numpy structured array\n"
+"with fields 'id', 'length', and 'value' (chunk data as a big endian integer, 0 if over 8 bytes).\n"
+"Chunks are listed in reverse order of appearance, the array is empty if a frame has no chunks.\n\n"
+":param g: GVSP instance\n"
+":param enable: True to parse chunks, False to pass frames only\n"
+":returns: None\n";
+static PyObject * set_chunk_mode(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  errno = 0;
+
+  // Parse arguments
+  PyObject *g_caps;
+  int enable;
+  static char *kwlist[] = {"g", "enable", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Op", kwlist, &g_caps, &enable)) goto err;
+  struct gvsp *g = PyCapsule_GetPointer(g_caps, "gvsp");
+  if (g == NULL) goto err;
 
-  return Py_BuildValue("NN", PyCapsule_New(g, "gvsp", NULL), PyLong_FromLong(g->port));
-#if defined IS_UNIX
-  err3: close((int)g->sockfd);
-#elif defined IS_WIN32
-  err3: closesocket(g->sockfd);
-#endif
-err2: free(g);
-err1: return handle_py_error();
+  // Set chunk mode on/off
+  g->chunk_mode = enable;
+err: return handle_py_error();
 }
 
-static const char DOC_CLOSE_SOCKET[] = "Close the socket.\n\n"
+static const char DOC_SET_TIMESTAMP_MODE[] = "Pass device timestamps of frames to the frame callback.\n\n"
+"When enabled, the frame callback gets an extra keyword argument 'timestamp': timestamp of the\n"
+"block from the leader packet in device ticks (see GevTimestampTickFrequency). Timestamps of\n"
+"frames triggered by the same scheduled action are comparable between PTP synchronized cameras.\n\n"
 ":param g: GVSP instance\n"
-":returns: None\n"
-":raises ConnectionError: Socket has been closed already or receiving of frames is active\n";
-static PyObject * close_socket(PyObject *self, PyObject *args, PyObject *kwargs)
+":param enable: True to pass timestamps, False to pass frames only\n"
+":returns: None\n";
+static PyObject * set_timestamp_mode(PyObject *self, PyObject *args, PyObject *kwargs)
 {
   errno = 0;
 
   // Parse arguments
-  struct gvsp *g = get_gvsp(args, kwargs);
+  PyObject *g_caps;
+  int enable;
+  static char *kwlist[] = {"g", "enable", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Op", kwlist, &g_caps, &enable)) goto err;
+  struct gvsp *g = PyCapsule_GetPointer(g_caps, "gvsp");
   if (g == NULL) goto err;
 
-  // Check state of GVSP
-  if (is_receiving(g)) goto err;
-  if (has_no_socket(g)) goto err;
+  // Set timestamp mode on/off
+  g->timestamp_mode = enable;
+err: return handle_py_error();
+}
 
-  // Close socket and delete instance
-#if defined IS_UNIX
-  if (close((int)g->sockfd) < 0) goto err;
-#elif defined IS_WIN32
-  if (closesocket(g->sockfd) < 0) goto err;
-#endif
-  g->sockfd = -1;
-  if (g->verbose) printf("GVSP: Socket closed\n");
-  free(g);
+static const char DOC_SET_PREVIEW[] = "Make a false color preview row of three bands with every frame.\n\n"
+"When enabled, the frame callback gets an extra keyword argument 'preview': numpy.ndarray of uint8\n"
+"with shape (width, 3), bands mapped to red, green and blue. Band values are scaled to 0-255 by the\n"
+"bit depth of the frame and then by gain and offset of the channel (value * gain + offset), using\n"
+"lookup tables built when the settings change. Bands of multi-part frames are counted over all\n"
+"parts, too large indexes are clamped to the last band.\n\n"
+":param g: GVSP instance\n"
+":param bands: Indexes of the red, green and blue bands, None to turn preview off\n"
+":param gain: Gains of red, green and blue\n"
+":param offset: Offsets of red, green and blue (in 8-bit scale)\n"
+":returns: None\n";
+static PyObject * set_preview(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  errno = 0;
+
+  // Parse arguments
+  PyObject *g_caps;
+  PyObject *bands_py = Py_None;
+  ulong bands[PREVIEW_CHANNELS] = {0, 0, 0};
+  float gain[PREVIEW_CHANNELS] = {1.0f, 1.0f, 1.0f};
+  float offset[PREVIEW_CHANNELS] = {0.0f, 0.0f, 0.0f};
+  static char *kwlist[] = {"g", "bands", "gain", "offset", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O(fff)(fff)", kwlist, &g_caps, &bands_py, &gain[0], &gain[1], &gain[2], &offset[0], &offset[1], &offset[2])) goto err;
+  struct gvsp *g = PyCapsule_GetPointer(g_caps, "gvsp");
+  if (g == NULL) goto err;
+  if (bands_py != Py_None && !PyArg_ParseTuple(bands_py, "kkk", &bands[0], &bands[1], &bands[2])) goto err;
 
+  // Receive thread builds the lookup tables again with the new settings
+  Py_BEGIN_ALLOW_THREADS
+  lock_mutex(&g->frame_lock);
+  g->preview_mode = bands_py != Py_None;
+  memcpy(g->preview_bands, bands, sizeof bands);
+  memcpy(g->preview_gain, gain, sizeof gain);
+  memcpy(g->preview_offset, offset, sizeof offset);
+  free_preview_luts(g);
+  unlock_mutex(&g->frame_lock);
+  Py_END_ALLOW_THREADS
 err: return handle_py_error();
 }
 
-static const char DOC_CREATE_BUFFER[] = "Create buffer to receive frames.\n\n"
+static const char DOC_START_ACCUMULATE[] = "Start summing frames pixel by pixel in the receiver, frames are still passed to the callback.\n\n"
+"Sums and sums of squares are kept in 64-bit accumulators, so memory use does not depend on the\n"
+"number of frames. Parts of multi-part frames are stacked along the spectral axis. Previous sums\n"
+"are cleared.\n\n"
 ":param g: GVSP instance\n"
-":param payload_size: Payload size of one full frame + possible padding\n"
-":param packet_size: Size of a single packet\n"
-":returns: None\n"
-":raises ConnectionError: GVSP is receiving frames, buffer must have been created already\n"
-":raises MemoryError: Failed to allocate memory or buffer is created already\n"
-":raises ValueError: Problem with payload size or packet size\n";
-static PyObject * create_buffer(PyObject *self, PyObject *args, PyObject *kwargs)
+":param max_frames: Number of frames to accumulate, 0 for no limit\n"
+":returns: None\n";
+static PyObject * start_accumulate(PyObject *self, PyObject *args, PyObject *kwargs)
 {
   errno = 0;
 
   // Parse arguments
   PyObject *g_caps;
-  ulong payload_size = 0;
-  ulong packet_size = 0;
-  ulong packet_payload_size = 0;
-  static char *kwlist[] = {"g", "payload_size", "packet_size", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Okk", kwlist, &g_caps, &payload_size, &packet_size)) goto err1;
+  unsigned long max_frames = 0;
+  static char *kwlist[] = {"g", "max_frames", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|k", kwlist, &g_caps, &max_frames)) goto err;
   struct gvsp *g = PyCapsule_GetPointer(g_caps, "gvsp");
-  if (g == NULL) goto err1;
+  if (g == NULL) goto err;
 
-  // Check state of GVSP
-  if (is_receiving(g)) goto err1;
-  if (has_buffer(g)) goto err1;
+  Py_BEGIN_ALLOW_THREADS
+  lock_mutex(&g->frame_lock);
+  free_accumulator(g);
+  g->accum_max = max_frames;
+  g->accum_mode = true;
+  unlock_mutex(&g->frame_lock);
+  Py_END_ALLOW_THREADS
+err: return handle_py_error();
+}
 
-  // Create buffer to receive frames
-  g->frame_buf = malloc(payload_size);
-  if (g->frame_buf == NULL)
-  {
-    PyErr_SetString(PyExc_MemoryError, "Failed to allocate memory for frame buffer");
-    goto err1;
-  }
-  packet_payload_size = packet_size - GVSP_TOTAL_HEADER_SIZE;
-  if (packet_payload_size <= 0)
+static const char DOC_STOP_ACCUMULATE[] = "Stop summing frames and get mean and standard deviation of each pixel.\n\n"
+":param g: GVSP instance\n"
+":returns: Number of frames, mean and standard deviation (numpy.ndarray of float64, None if no frames were accumulated)\n";
+static PyObject * stop_accumulate(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  errno = 0;
+  uint64_t *sum;
+  uint64_t *sumsq;
+  ulong count, rows, cols, i;
+  double mean, var;
+  PyObject *mean_py;
+  PyObject *std_py;
+
+  // Parse arguments
+  struct gvsp *g = get_gvsp(args, kwargs);
+  if (g == NULL) goto err;
+
+  // Take the sums so the receive loop is not held while converting
+  Py_BEGIN_ALLOW_THREADS
+  lock_mutex(&g->frame_lock);
+  g->accum_mode = false;
+  sum = g->accum_sum;
+  sumsq = g->accum_sumsq;
+  count = g->accum_count;
+  rows = g->accum_rows;
+  cols = g->accum_cols;
+  g->accum_sum = NULL;
+  g->accum_sumsq = NULL;
+  free_accumulator(g);
+  unlock_mutex(&g->frame_lock);
+  Py_END_ALLOW_THREADS
+
+  if (count == 0)
   {
-    PyErr_SetString(PyExc_ValueError, "Packet size must be greater than 0 (without headers)");
-    goto err2;
+    free(sum);
+    free(sumsq);
+    return Py_BuildValue("(kOO)", 0ul, Py_None, Py_None);
   }
-  if (payload_size % packet_payload_size != 0)
+  npy_intp nds[] = {rows, cols};
+  mean_py = PyArray_SimpleNew(2, nds, NPY_FLOAT64);
+  std_py = PyArray_SimpleNew(2, nds, NPY_FLOAT64);
+  if (mean_py == NULL || std_py == NULL)
   {
-    PyErr_SetString(PyExc_ValueError, "Payload size must be multiple of packet size");
-    goto err2;
+    Py_XDECREF(mean_py);
+    Py_XDECREF(std_py);
+    free(sum);
+    free(sumsq);
+    goto err;
   }
-  g->payload_size = payload_size;
-  g->packet_size = packet_payload_size;
-  g->packet_count = payload_size / g->packet_size;
-
-  if (g->verbose)
+  double *mean_out = PyArray_DATA((PyArrayObject*)mean_py);
+  double *std_out = PyArray_DATA((PyArrayObject*)std_py);
+  for (i = 0; i < rows * cols; i++)
   {
-    printf("GVSP: Packet size: %ld, packet count: %ld\n", g->packet_size, g->packet_count);
-    printf("GVSP: Frame buffer created, %ld bytes\n", payload_size);
+    mean = (double)sum[i] / count;
+    var = (double)sumsq[i] / count - mean * mean;
+    mean_out[i] = mean;
+    std_out[i] = var > 0.0 ? sqrt(var) : 0.0;
   }
-  return PyLong_FromLong(0);
-err2: free(g->frame_buf);
-err1: return handle_py_error();
+  free(sum);
+  free(sumsq);
+  return Py_BuildValue("(kNN)", count, mean_py, std_py);
+err: return handle_py_error();
 }
 
-static const char DOC_FREE_BUFFER[] = "Release the frame buffer.\n\n"
+static const char DOC_SET_CALIBRATION[] = "Calibrate frames to reflectance with dark and white references, can be changed while receiving.\n\n"
+"When enabled, the frame callback gets an extra keyword argument 'reflectance': numpy.ndarray of\n"
+"(raw - dark) / (white - dark) with the shape of the references. Parts of multi-part frames are\n"
+"stacked along the spectral axis. Pixels where white is not above dark get 0. Frames that do not\n"
+"match the references are passed without reflectance.\n\n"
 ":param g: GVSP instance\n"
+":param dark: Dark reference (2D array, spectral x spatial), None to turn calibration off\n"
+":param white: White reference of the same shape\n"
+":param dtype: Output type, numpy.float32 or numpy.uint16\n"
+":param scale: Value of reflectance 1.0 in uint16 output\n"
 ":returns: None\n"
-":raises ConnectionError: GVSP is receiving frames, buffer cannot be freed\n"
-":raises MemoryError: Buffer has already been freed\n";
-static PyObject * free_buffer(PyObject *self, PyObject *args, PyObject *kwargs)
+":raises ValueError: Invalid references or output type\n";
+static PyObject * set_calibration(PyObject *self, PyObject *args, PyObject *kwargs)
 {
   errno = 0;
+  PyArrayObject *dark_arr = NULL;
+  PyArrayObject *white_arr = NULL;
+  struct calibration *c = NULL;
+  struct calibration *old;
+  ulong i, n;
+  float range;
 
   // Parse arguments
-  struct gvsp *g = get_gvsp(args, kwargs);
+  PyObject *g_caps;
+  PyObject *dark_py = Py_None;
+  PyObject *white_py = Py_None;
+  PyArray_Descr *dtype = NULL;
+  float scale = 10000.0f;
+  static char *kwlist[] = {"g", "dark", "white", "dtype", "scale", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OOO&f", kwlist, &g_caps, &dark_py, &white_py, PyArray_DescrConverter2, &dtype, &scale)) goto err;
+  struct gvsp *g = PyCapsule_GetPointer(g_caps, "gvsp");
   if (g == NULL) goto err;
 
-  // Check state of GVSP
-  if (is_receiving(g)) goto err;
-  if (has_no_buffer(g)) goto err;
+  if (dark_py != Py_None)
+  {
+    int typenum = dtype == NULL ? NPY_FLOAT32 : dtype->type_num;
+    if (typenum != NPY_FLOAT32 && typenum != NPY_UINT16)
+    {
+      PyErr_SetString(PyExc_ValueError, "Output type must be float32 or uint16");
+      goto err;
+    }
+    dark_arr = (PyArrayObject*)PyArray_FROMANY(dark_py, NPY_FLOAT32, 2, 2, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (dark_arr == NULL) goto err;
+    white_arr = (PyArrayObject*)PyArray_FROMANY(white_py, NPY_FLOAT32, 2, 2, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (white_arr == NULL) goto err;
+    if (!PyArray_SAMESHAPE(dark_arr, white_arr))
+    {
+      PyErr_SetString(PyExc_ValueError, "Dark and white references must have the same shape");
+      goto err;
+    }
 
-  // Free buffer and reset related values
-  g->payload_size = 0;
-  g->packet_size = 0;
-  g->packet_count = 0;
-  free(g->frame_buf);
-  g->frame_buf = NULL;
+    // References are converted before locking, the receive loop keeps running
+    c = calloc(1, sizeof (struct calibration));
+    if (c == NULL)
+    {
+      PyErr_SetString(PyExc_MemoryError, "Failed to allocate memory for calibration");
+      goto err;
+    }
+    c->rows = PyArray_DIM(dark_arr, 0);
+    c->cols = PyArray_DIM(dark_arr, 1);
+    c->typenum = typenum;
+    n = c->rows * c->cols;
+    c->dark = malloc(n * sizeof (float));
+    c->gain = malloc(n * sizeof (float));
+    if (c->dark == NULL || c->gain == NULL)
+    {
+      PyErr_SetString(PyExc_MemoryError, "Failed to allocate memory for calibration");
+      goto err;
+    }
+    float *dark = PyArray_DATA(dark_arr);
+    float *white = PyArray_DATA(white_arr);
+    for (i = 0; i < n; i++)
+    {
+      range = white[i] - dark[i];
+      c->dark[i] = dark[i];
+      c->gain[i] = range > 0.0f ? (typenum == NPY_UINT16 ? scale : 1.0f) / range : 0.0f;
+    }
+  }
 
-  if (g->verbose) printf("GVSP: Frame buffer freed\n");
-err: return handle_py_error();
+  Py_BEGIN_ALLOW_THREADS
+  lock_mutex(&g->frame_lock);
+  old = g->calib;
+  g->calib = c;
+  unlock_mutex(&g->frame_lock);
+  Py_END_ALLOW_THREADS
+  free_calibration(old);
+  c = NULL;
+
+err:
+  free_calibration(c);
+  Py_XDECREF(dark_arr);
+  Py_XDECREF(white_arr);
+  Py_XDECREF(dtype);
+  return handle_py_error();
 }
 
-static const char DOC_START_RECEIVE[] = "Start listening incoming GVSP packets.\n\n"
+static const char DOC_SET_BAD_PIXELS[] = "Replace defective pixels of every frame by interpolating their neighbours, can be changed while receiving.\n\n"
+"A bad pixel gets the mean of the nearest good pixels on both sides along the spatial axis, or\n"
+"along the spectral axis if there are none within a few pixels. Pixels without good neighbours are\n"
+"left as they are. Parts of multi-part frames are stacked along the spectral axis. Frames are\n"
+"corrected before preview, accumulation and calibration.\n\n"
 ":param g: GVSP instance\n"
-":param addr: IP address of the camera as string\n"
-":returns: None\n"
-":raises ConnectionError: GVSP is already receiving frames or there is no socket to receive frames\n"
-":raises MemoryError: There is no buffer\n";
-static PyObject * start_receive(PyObject *self, PyObject *args, PyObject *kwargs)
+":param mask: Bad pixel map (2D array of bool, spectral x spatial), None to turn correction off\n"
+":returns: Number of pixels that cannot be corrected\n"
+":raises ValueError: Invalid map\n";
+static PyObject * set_bad_pixels(PyObject *self, PyObject *args, PyObject *kwargs)
 {
   errno = 0;
+  PyArrayObject *mask_arr = NULL;
+  struct bad_pixels *b = NULL;
+  struct bad_pixels *old;
+  ulong uncorrected = 0;
+  ulong i, row, col;
+  long n1, n2;
 
   // Parse arguments
   PyObject *g_caps;
-  char *ip_str;
-  static char *kwlist[] = {"g", "addr", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Os", kwlist, &g_caps, &ip_str)) goto err;
+  PyObject *mask_py = Py_None;
+  static char *kwlist[] = {"g", "mask", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O", kwlist, &g_caps, &mask_py)) goto err;
   struct gvsp *g = PyCapsule_GetPointer(g_caps, "gvsp");
   if (g == NULL) goto err;
 
-  // Check state of GVSP
-  if (is_receiving(g)) goto err;
-  if (has_no_socket(g)) goto err;
-  if (has_no_buffer(g)) goto err;
+  if (mask_py != Py_None)
+  {
+    mask_arr = (PyArrayObject*)PyArray_FROMANY(mask_py, NPY_BOOL, 2, 2, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (mask_arr == NULL) goto err;
+    const bool *mask = PyArray_DATA(mask_arr);
 
-  // Send dummy packet to traverse firewall
-  if (open_connection(g, ip_str) < 0) goto err;
+    // Neighbours are found before locking, the receive loop keeps running
+    b = calloc(1, sizeof (struct bad_pixels));
+    if (b == NULL)
+    {
+      PyErr_SetString(PyExc_MemoryError, "Failed to allocate memory for bad pixels");
+      goto err;
+    }
+    b->rows = PyArray_DIM(mask_arr, 0);
+    b->cols = PyArray_DIM(mask_arr, 1);
+    for (i = 0; i < b->rows * b->cols; i++) b->count += mask[i] != 0;
+    b->pixels = malloc((b->count + 1) * 3 * sizeof (ulong));
+    if (b->pixels == NULL)
+    {
+      PyErr_SetString(PyExc_MemoryError, "Failed to allocate memory for bad pixels");
+      goto err;
+    }
+    b->count = 0;
+    for (i = 0; i < b->rows * b->cols; i++)
+    {
+      if (!mask[i]) continue;
+      row = i / b->cols;
+      col = i % b->cols;
+      n1 = find_good_neighbour(mask, b->rows, b->cols, row, col, 0, -1);
+      n2 = find_good_neighbour(mask, b->rows, b->cols, row, col, 0, 1);
+      if (n1 < 0 && n2 < 0)
+      {
+        n1 = find_good_neighbour(mask, b->rows, b->cols, row, col, -1, 0);
+        n2 = find_good_neighbour(mask, b->rows, b->cols, row, col, 1, 0);
+      }
+      if (n1 < 0 && n2 < 0)
+      {
+        uncorrected++;
+        continue;
+      }
+      b->pixels[b->count * 3] = i;
+      b->pixels[b->count * 3 + 1] = n1 >= 0 ? n1 : n2;
+      b->pixels[b->count * 3 + 2] = n2 >= 0 ? n2 : n1;
+      b->count++;
+    }
+  }
 
-  // Start listening for incoming packets
-  g->recv_en = true;
-  init_receive(g);
+  Py_BEGIN_ALLOW_THREADS
+  lock_mutex(&g->frame_lock);
+  old = g->bad;
+  g->bad = b;
+  unlock_mutex(&g->frame_lock);
+  Py_END_ALLOW_THREADS
+  free_bad_pixels(old);
+  Py_XDECREF(mask_arr);
+  return PyLong_FromUnsignedLong(uncorrected);
+
+err:
+  free_bad_pixels(b);
+  Py_XDECREF(mask_arr);
+  return handle_py_error();
+}
 
-err: return handle_py_error();
+// Single band of a selection: int or an integer like numpy.int64. Integer arrays have __index__
+// too but are band groups.
+bool is_band_index(PyObject *item)
+{
+  return PyIndex_Check(item) && !PySequence_Check(item);
 }
 
-static const char DOC_STOP_RECEIVE[] = "Stop listening packets.\n\n"
+static const char DOC_SET_BANDS[] = "Keep only selected bands of the frames, can be changed while receiving.\n\n"
+"Frames are passed as one numpy.ndarray (bands x spatial) of the selected bands, also multi-part\n"
+"frame sets whose bands are counted over all parts. An output band is either one band of the frame\n"
+"or the average of a group of bands (binning), rounded to the type of the frame. Bad pixels are\n"
+"corrected before selection, preview bands, accumulation and calibration refer to the selected\n"
+"bands. Frames without the selected bands are passed as they are.\n\n"
 ":param g: GVSP instance\n"
+":param bands: Sequence of band indexes or sequences of them (e.g. range) to average, None for all bands\n"
 ":returns: None\n"
-":raises ConnectionError: Already stopped receiving frames\n";
-static PyObject * stop_receive(PyObject *self, PyObject *args, PyObject *kwargs)
+":raises ValueError: Empty selection or negative index\n";
+static PyObject * set_bands(PyObject *self, PyObject *args, PyObject *kwargs)
 {
   errno = 0;
+  PyObject *bands_fast = NULL;
+  PyObject *group_fast = NULL;
+  struct band_selection *b = NULL;
+  struct band_selection *old;
+  Py_ssize_t i, j, total = 0;
 
   // Parse arguments
-  struct gvsp *g = get_gvsp(args, kwargs);
+  PyObject *g_caps;
+  PyObject *bands_py = Py_None;
+  static char *kwlist[] = {"g", "bands", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O", kwlist, &g_caps, &bands_py)) goto err;
+  struct gvsp *g = PyCapsule_GetPointer(g_caps, "gvsp");
   if (g == NULL) goto err;
 
-  // Check state of GVSP
-  if (is_not_receiving(g)) goto err;
+  if (bands_py != Py_None)
+  {
+    bands_fast = PySequence_Fast(bands_py, "Bands must be a sequence");
+    if (bands_fast == NULL) goto err;
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(bands_fast);
+    for (i = 0; i < count; i++)
+    {
+      PyObject *item = PySequence_Fast_GET_ITEM(bands_fast, i);
+      if (is_band_index(item)) total++;
+      else
+      {
+        Py_ssize_t n = PySequence_Size(item);
+        if (n < 0) goto err;
+        total += n;
+      }
+    }
+    b = calloc(1, sizeof (struct band_selection));
+    if (b == NULL)
+    {
+      PyErr_SetString(PyExc_MemoryError, "Failed to allocate memory for band selection");
+      goto err;
+    }
+    b->count = count;
+    b->starts = malloc((count + 1) * sizeof (ulong));
+    b->indexes = malloc((total + 1) * sizeof (ulong));
+    if (b->starts == NULL || b->indexes == NULL)
+    {
+      PyErr_SetString(PyExc_MemoryError, "Failed to allocate memory for band selection");
+      goto err;
+    }
 
-  lock_mutex(&g->en_lock);
-  g->recv_en = false;
-  unlock_mutex(&g->en_lock);
-  PyThreadState *tstate = PyEval_SaveThread();
-#if defined IS_UNIX
-  pthread_join(g->recv_thread, NULL);
-#elif defined IS_WIN32
-  WaitForSingleObject(g->recv_thread, INFINITE);
-#endif
-  PyEval_RestoreThread(tstate);
-  // Only single thread should be running now
+    total = 0;
+    for (i = 0; i < count; i++)
+    {
+      PyObject *item = PySequence_Fast_GET_ITEM(bands_fast, i);
+      b->starts[i] = total;
+      group_fast = is_band_index(item) ? PyTuple_Pack(1, item) : PySequence_Fast(item, "Band group must be a sequence");
+      if (group_fast == NULL) goto err;
+      for (j = 0; j < PySequence_Fast_GET_SIZE(group_fast); j++)
+      {
+        PyObject *index_py = PyNumber_Index(PySequence_Fast_GET_ITEM(group_fast, j));
+        if (index_py == NULL) goto err;
+        long index = PyLong_AsLong(index_py);
+        Py_DECREF(index_py);
+        if (index == -1 && PyErr_Occurred()) goto err;
+        if (index < 0)
+        {
+          PyErr_SetString(PyExc_ValueError, "Band index must not be negative");
+          goto err;
+        }
+        b->indexes[total++] = index;
+        if ((ulong)index > b->max_index) b->max_index = index;
+      }
+      if (total == (Py_ssize_t)b->starts[i])
+      {
+        PyErr_SetString(PyExc_ValueError, "Band group must not be empty");
+        goto err;
+      }
+      Py_CLEAR(group_fast);
+    }
+    b->starts[count] = total;
+    if (count == 0)
+    {
+      PyErr_SetString(PyExc_ValueError, "No bands selected");
+      goto err;
+    }
+    Py_CLEAR(bands_fast);
+  }
 
-  if (g->verbose) printf("GVSP: Stopped listening incoming packets\n");
-err: return handle_py_error();
+  Py_BEGIN_ALLOW_THREADS
+  lock_mutex(&g->frame_lock);
+  old = g->selection;
+  g->selection = b;
+  unlock_mutex(&g->frame_lock);
+  Py_END_ALLOW_THREADS
+  free_band_selection(old);
+  b = NULL;
+
+err:
+  free_band_selection(b);
+  Py_XDECREF(bands_fast);
+  Py_XDECREF(group_fast);
+  return handle_py_error();
 }
 
-static const char DOC_FRAME_CB[] = "Set a callback function to get frames.\n\n"
+// Nonzero buckets of a histogram as a dict, GIL must be held
+PyObject * hist_to_dict(struct histogram *h)
+{
+  npy_intp nds[] = {0};
+  ulong i;
+  ulong j = 0;
+  PyObject *values_py;
+  PyObject *counts_py;
+  for (i = 0; i < HIST_BUCKETS; i++)
+  {
+    if (h->counts[i] != 0) nds[0]++;
+  }
+  values_py = PyArray_SimpleNew(1, nds, NPY_UINT64);
+  counts_py = PyArray_SimpleNew(1, nds, NPY_UINT64);
+  if (values_py == NULL || counts_py == NULL)
+  {
+    Py_XDECREF(values_py);
+    Py_XDECREF(counts_py);
+    return NULL;
+  }
+  for (i = 0; i < HIST_BUCKETS; i++)
+  {
+    if (h->counts[i] != 0)
+    {
+      *(uint64_t*)PyArray_GETPTR1((PyArrayObject*)values_py, j) = hist_value(i);
+      *(uint64_t*)PyArray_GETPTR1((PyArrayObject*)counts_py, j) = h->counts[i];
+      j++;
+    }
+  }
+  return Py_BuildValue("{sNsNsKsKsKsK}", "values", values_py, "counts", counts_py,
+    "total", (unsigned long long)h->total, "sum", (unsigned long long)h->sum,
+    "min", (unsigned long long)h->min, "max", (unsigned long long)h->max);
+}
+
+static const char DOC_GET_HISTOGRAMS[] = "Get histograms of packet arrival times measured by the receive loop.\n\n"
+"Histograms are log-linear (HDR): value error is at most 1/32 (about 3 %). 'packet_gap' is the time\n"
+"between consecutive packets of a block (leader to trailer), 'frame_interval' is the time between\n"
+"consecutive leaders. Both contain 'values' (smallest value of each nonempty bucket in ns, numpy.ndarray),\n"
+"'counts' (numpy.ndarray), 'total' (number of values), 'sum', 'min' and 'max' (exact, in ns).\n"
+"Replayed packets are not measured.\n\n"
 ":param g: GVSP instance\n"
-":param callback: Function to call when a frame is received or None\n"
-":returns: None\n"
-":raises TypeError: Callback is not a function or None\n";
-static PyObject * set_frame_cb(PyObject *self, PyObject *args, PyObject *kwargs)
+":returns: Dict with keys 'packet_gap' and 'frame_interval'\n";
+static PyObject * get_histograms(PyObject *self, PyObject *args, PyObject *kwargs)
 {
   errno = 0;
+  struct histogram *gaps = NULL;
+  struct histogram *intervals = NULL;
+  PyObject *result = NULL;
 
   // Parse arguments
-  PyObject *g_caps;
-  PyObject *cb;
-  static char *kwlist[] = {"g", "callback", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO", kwlist, &g_caps, &cb)) goto err;
-  struct gvsp *g = PyCapsule_GetPointer(g_caps, "gvsp");
+  struct gvsp *g = get_gvsp(args, kwargs);
   if (g == NULL) goto err;
-  if (!PyCallable_Check(cb) && cb != NULL) {
-    PyErr_SetString(PyExc_TypeError, "Callback function must be callable");
+
+  // Copy histograms to keep the receive loop running while converting
+  gaps = malloc(sizeof (struct histogram));
+  intervals = malloc(sizeof (struct histogram));
+  if (gaps == NULL || intervals == NULL)
+  {
+    PyErr_SetString(PyExc_MemoryError, "Failed to allocate memory for histograms");
     goto err;
   }
+  Py_BEGIN_ALLOW_THREADS
+  lock_mutex(&g->frame_lock);
+  memcpy(gaps, &g->packet_gaps, sizeof (struct histogram));
+  memcpy(intervals, &g->frame_intervals, sizeof (struct histogram));
+  unlock_mutex(&g->frame_lock);
+  Py_END_ALLOW_THREADS
+
+  result = Py_BuildValue("{sNsN}", "packet_gap", hist_to_dict(gaps), "frame_interval", hist_to_dict(intervals));
+  free(gaps);
+  free(intervals);
+  return result;
+err:
+  free(gaps);
+  free(intervals);
+  return handle_py_error();
+}
 
-  // Set callback function
-  Py_XINCREF(cb);
+static const char DOC_RESET_HISTOGRAMS[] = "Clear histograms of packet arrival times.\n\n"
+":param g: GVSP instance\n"
+":returns: None\n";
+static PyObject * reset_histograms(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  errno = 0;
+
+  // Parse arguments
+  struct gvsp *g = get_gvsp(args, kwargs);
+  if (g == NULL) goto err;
+
+  Py_BEGIN_ALLOW_THREADS
   lock_mutex(&g->frame_lock);
-  Py_XDECREF(g->frame_cb);
-  g->frame_cb = cb;
+  hist_reset(&g->packet_gaps);
+  hist_reset(&g->frame_intervals);
   unlock_mutex(&g->frame_lock);
+  Py_END_ALLOW_THREADS
 
-  if (g->verbose) printf("GVSP: Frame callback function set\n");
 err: return handle_py_error();
 }
 
@@ -1035,6 +3189,20 @@ static PyMethodDef gvspmethods[] = {
   { "start_receive", (PyCFunction)start_receive, METH_VARARGS | METH_KEYWORDS, DOC_START_RECEIVE },
   { "stop_receive", (PyCFunction)stop_receive, METH_VARARGS | METH_KEYWORDS, DOC_STOP_RECEIVE },
   { "set_frame_cb", (PyCFunction)set_frame_cb, METH_VARARGS | METH_KEYWORDS, DOC_FRAME_CB },
+  { "get_histograms", (PyCFunction)get_histograms, METH_VARARGS | METH_KEYWORDS, DOC_GET_HISTOGRAMS },
+  { "reset_histograms", (PyCFunction)reset_histograms, METH_VARARGS | METH_KEYWORDS, DOC_RESET_HISTOGRAMS },
+  { "receive_test_packet", (PyCFunction)receive_test_packet, METH_VARARGS | METH_KEYWORDS, DOC_RECEIVE_TEST_PACKET },
+  { "set_chunk_mode", (PyCFunction)set_chunk_mode, METH_VARARGS | METH_KEYWORDS, DOC_SET_CHUNK_MODE },
+  { "set_preview", (PyCFunction)set_preview, METH_VARARGS | METH_KEYWORDS, DOC_SET_PREVIEW },
+  { "start_accumulate", (PyCFunction)start_accumulate, METH_VARARGS | METH_KEYWORDS, DOC_START_ACCUMULATE },
+  { "stop_accumulate", (PyCFunction)stop_accumulate, METH_VARARGS | METH_KEYWORDS, DOC_STOP_ACCUMULATE },
+  { "set_calibration", (PyCFunction)set_calibration, METH_VARARGS | METH_KEYWORDS, DOC_SET_CALIBRATION },
+  { "set_bad_pixels", (PyCFunction)set_bad_pixels, METH_VARARGS | METH_KEYWORDS, DOC_SET_BAD_PIXELS },
+  { "set_bands", (PyCFunction)set_bands, METH_VARARGS | METH_KEYWORDS, DOC_SET_BANDS },
+  { "set_timestamp_mode", (PyCFunction)set_timestamp_mode, METH_VARARGS | METH_KEYWORDS, DOC_SET_TIMESTAMP_MODE },
+  { "start_pcap", (PyCFunction)start_pcap, METH_VARARGS | METH_KEYWORDS, DOC_START_PCAP },
+  { "stop_pcap", (PyCFunction)stop_pcap, METH_VARARGS | METH_KEYWORDS, DOC_STOP_PCAP },
+  { "replay_pcap", (PyCFunction)replay_pcap, METH_VARARGS | METH_KEYWORDS, DOC_REPLAY_PCAP },
   { "set_verbose", (PyCFunction)set_verbose, METH_VARARGS | METH_KEYWORDS, DOC_SET_VERBOSE },
   { "set_warnings", (PyCFunction)set_warnings, METH_VARARGS | METH_KEYWORDS, DOC_SET_WARNINGS },
   { NULL, NULL, 0, NULL }
@@ -1048,5 +3216,12 @@ PyMODINIT_FUNC
 PyInit_gvsp(void)
 {
   import_array();
+  PyObject *chunk_fields = Py_BuildValue("[(ss)(ss)(ss)]", "id", "u4", "length", "u4", "value", "u8");
+  if (chunk_fields == NULL || !PyArray_DescrConverter(chunk_fields, &chunk_descr))
+  {
+    Py_XDECREF(chunk_fields);
+    return NULL;
+  }
+  Py_DECREF(chunk_fields);
   return PyModule_Create(&gvspmodule);
 }
\ No newline at end of file
@@ -0,0 +1,256 @@
+"""
+  GVCP message channel. Camera sends asynchronous events (EVENT_CMD and EVENTDATA_CMD) to the host
+  on a socket of its own, so events do not compete with control requests. Events are acknowledged
+  and passed to subscribed callbacks.
+"""
+import socket
+import threading
+from collections import deque
+from typing import Callable
+
+from spectralcam.utils import *
+from spectralcam.exceptions import *
+from spectralcam.gige.gvcp import GVCP, GVCP_KEY, REG_GVCP_CAPABILITY, GVCP_HEADER_SIZE, EVENT_CMD, EVENT_ACK, EVENTDATA_CMD, EVENTDATA_ACK
+
+# Message channel bootstrap registers
+REG_MESSAGE_CHANNELS = 0x00000900
+REG_MCP = 0x00000B00
+REG_MCDA = 0x00000B10
+REG_MCTT = 0x00000B14
+REG_MCRC = 0x00000B18
+VAL_CAPABILITY_EVENT = 0x00000008
+VAL_CAPABILITY_EVENTDATA = 0x00000010
+
+# Standard event IDs, error events are 0x8000 + status code, device specific events 0x9000 - 0xFFFF
+GEV_EVENT_TRIGGER = 0x0001
+GEV_EVENT_START_OF_EXPOSURE = 0x0002
+GEV_EVENT_END_OF_EXPOSURE = 0x0003
+GEV_EVENT_START_OF_TRANSFER = 0x0004
+GEV_EVENT_END_OF_TRANSFER = 0x0005
+GEV_EVENT_ERROR = 0x8000
+GEV_EVENT_DEVICE_SPECIFIC = 0x9000
+
+EVENT_SIZE = 16
+EVENT_EXT_SIZE = 24 # extended ID (64-bit block ID)
+FLAG_EXTENDED_ID = 0x10
+
+class GVCPEvent:
+  """Event received from the message channel."""
+
+  def __init__(self, event_id: int, stream_channel: int, block_id: int, timestamp: int, data: bytes = None) -> None:
+    self.event_id = event_id
+    self.stream_channel = stream_channel
+    """Index of the stream channel the event relates to, 0xFFFF if none"""
+    self.block_id = block_id
+    """ID of the block (frame) the event relates to, 0 if none"""
+    self.timestamp = timestamp
+    """Device timestamp in ticks"""
+    self.data = data
+    """Event data of EVENTDATA_CMD, None for EVENT_CMD"""
+
+  def __str__(self) -> str:
+    text = f"{self.__class__.__name__}:\n"
+    text += f"  Event ID:       0x{self.event_id:04x}\n"
+    text += f"  Stream channel: {self.stream_channel}\n"
+    text += f"  Block ID:       {self.block_id}\n"
+    text += f"  Timestamp:      {self.timestamp}"
+    if self.data != None:
+      text += f"\n  Data length:    {len(self.data)}"
+    return text
+
+def parse_events(data: bytes) -> tuple[int, int, bool, list[GVCPEvent]]:
+  """
+  Parse EVENT_CMD or EVENTDATA_CMD packet.
+
+  :param data: Received packet
+  :returns: Command, request ID, acknowledge requested, events
+  :raises ValueError: Invalid packet
+  """
+  if len(data) < GVCP_HEADER_SIZE or data[0] != GVCP_KEY:
+    raise ValueError("GVCP ERROR: Invalid message channel packet")
+  flag = data[1]
+  cmd = bytes_to_uint16(data[2:4])
+  length = bytes_to_uint16(data[4:6])
+  req_id = bytes_to_uint16(data[6:8])
+  payload = data[GVCP_HEADER_SIZE:GVCP_HEADER_SIZE + length]
+  if len(payload) != length or cmd not in (EVENT_CMD, EVENTDATA_CMD):
+    raise ValueError("GVCP ERROR: Invalid message channel packet")
+  size = EVENT_EXT_SIZE if flag & FLAG_EXTENDED_ID else EVENT_SIZE
+
+  def parse(item: bytes, event_data: bytes = None) -> GVCPEvent:
+    event_id = bytes_to_uint16(item[2:4])
+    stream_channel = bytes_to_uint16(item[4:6])
+    if size == EVENT_EXT_SIZE:
+      block_id = (bytes_to_uint32(item[8:12]) << 32) | bytes_to_uint32(item[12:16])
+      timestamp = (bytes_to_uint32(item[16:20]) << 32) | bytes_to_uint32(item[20:24])
+    else:
+      block_id = bytes_to_uint16(item[6:8])
+      timestamp = (bytes_to_uint32(item[8:12]) << 32) | bytes_to_uint32(item[12:16])
+    return GVCPEvent(event_id, stream_channel, block_id, timestamp, event_data)
+
+  if cmd == EVENTDATA_CMD:
+    if len(payload) < size:
+      raise ValueError("GVCP ERROR: Event data packet is too short")
+    events = [parse(payload[:size], payload[size:])]
+  else:
+    events = [parse(payload[i:i + size]) for i in range(0, len(payload) - size + 1, size)]
+  return cmd, req_id, bool(flag & 0x01), events
+
+class MessageChannel:
+  """
+  Receiver for the GVCP message channel. Call open() to tell the camera where to send events and
+  subscribe() to get them. Callbacks are called from the receiver thread.
+  """
+
+  def __init__(self, gvcp: GVCP) -> None:
+    self.gvcp = gvcp
+    self.verbose = False
+    self.timeout = 0.2
+    """Time (in seconds) the camera waits for an acknowledgement before resending an event"""
+    self.retries = 3
+    """Number of times the camera resends an event"""
+    self._soc = None
+    self._thread = None
+    self._stop = threading.Event()
+    self._subscribers = {}
+    self._subscribers_lock = threading.Lock()
+    self._recent = deque(maxlen=32)
+    self.event_count = 0
+
+  @property
+  def is_open(self) -> bool:
+    """Message channel is open."""
+    return self._soc != None
+
+  def is_supported(self) -> bool:
+    """
+    Check if the camera has a message channel and supports EVENT_CMD.
+
+    :returns: True if events are supported
+    :raises NotConnectedError: No connection
+    :raises AckError: Problem with an acknowledgement from the camera
+    """
+    capability = self.gvcp.readreg(REG_GVCP_CAPABILITY, int)
+    if not capability & VAL_CAPABILITY_EVENT:
+      return False
+    return self.gvcp.readreg(REG_MESSAGE_CHANNELS, int) > 0
+
+  def open(self, host_addr: str) -> int:
+    """
+    Open a socket for events and set it as message channel destination on the camera.
+
+    :param host_addr: IP address of the host network interface connected to the camera
+    :returns: UDP port of the message channel
+    :raises NotConnectedError: No connection
+    :raises IsConnectedError: Message channel is already open
+    :raises NotImplementedError: Camera does not support events
+    :raises AckError: Problem with an acknowledgement from the camera
+    """
+    if self.is_open:
+      raise IsConnectedError("GVCP ERROR: Message channel is already open")
+    if not self.is_supported():
+      raise NotImplementedError("GVCP ERROR: Device does not support message channel events")
+    self._soc = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    self._soc.bind((host_addr, 0))
+    self._soc.settimeout(0.1)
+    port = self._soc.getsockname()[1]
+    self._stop.clear()
+    self._thread = threading.Thread(target=self._receive, daemon=True)
+    self._thread.start()
+    try:
+      self.gvcp.writereg(REG_MCTT, round(self.timeout * 1000))
+      self.gvcp.writereg(REG_MCRC, self.retries)
+      self.gvcp.writereg(REG_MCDA, ip_to_uint32(host_addr))
+      self.gvcp.writereg(REG_MCP, port)
+    except:
+      self._close_socket()
+      raise
+    if self.verbose:
+      print(f"GVCP: Message channel open on port {port}")
+    return port
+
+  def close(self) -> None:
+    """
+    Stop events from the camera and close the socket.
+
+    :returns: None
+    """
+    if not self.is_open:
+      return
+    try:
+      if self.gvcp.connected:
+        self.gvcp.writereg(REG_MCP, 0)
+    finally:
+      self._close_socket()
+    if self.verbose:
+      print("GVCP: Message channel closed")
+
+  def subscribe(self, callback: Callable[[GVCPEvent], None], event_id: int = None) -> None:
+    """
+    Call a function when an event is received.
+
+    :param callback: Function called with GVCPEvent
+    :param event_id: Event ID, all events if not given
+    :returns: None
+    """
+    with self._subscribers_lock:
+      self._subscribers.setdefault(event_id, []).append(callback)
+
+  def unsubscribe(self, callback: Callable[[GVCPEvent], None], event_id: int = None) -> None:
+    """
+    Stop calling a subscribed function.
+
+    :param callback: Subscribed function
+    :param event_id: Event ID the function was subscribed with
+    :returns: None
+    """
+    with self._subscribers_lock:
+      if callback in self._subscribers.get(event_id, []):
+        self._subscribers[event_id].remove(callback)
+
+  def _receive(self) -> None:
+    soc = self._soc
+    while not self._stop.is_set():
+      try:
+        data, addr = soc.recvfrom(ETH_MAX_MTU)
+      except socket.timeout:
+        continue
+      except OSError:
+        break
+      try:
+        cmd, req_id, ack, events = parse_events(data)
+      except ValueError as err:
+        if self.verbose:
+          print(err)
+        continue
+      if ack:
+        ack_cmd = EVENTDATA_ACK if cmd == EVENTDATA_CMD else EVENT_ACK
+        soc.sendto(uint16_to_bytes(0) + uint16_to_bytes(ack_cmd) + uint16_to_bytes(0) + uint16_to_bytes(req_id), addr)
+
+      # Camera resends the event if the acknowledgement is lost
+      if (addr, req_id) in self._recent:
+        continue
+      self._recent.append((addr, req_id))
+      for event in events:
+        self.event_count += 1
+        if self.verbose:
+          print(f"GVCP: Received event 0x{event.event_id:04x}")
+        self._dispatch(event)
+
+  def _dispatch(self, event: GVCPEvent) -> None:
+    with self._subscribers_lock:
+      callbacks = self._subscribers.get(event.event_id, []) + self._subscribers.get(None, [])
+    for callback in callbacks:
+      try:
+        callback(event)
+      except Exception as err:
+        print(f"GVCP WARNING: Event callback failed: {err}")
+
+  def _close_socket(self) -> None:
+    self._stop.set()
+    if self._thread != None and self._thread != threading.current_thread():
+      self._thread.join()
+    self._thread = None
+    if self._soc != None:
+      self._soc.close()
+    self._soc = None
@@ -1,7 +1,11 @@
+import sys
 from setuptools import setup, Extension
 # For this to work, you might need to remove noexec option from /tmp on linux systems
 import numpy
 
+# Per-pixel loops of the receiver (calibration, accumulation, preview) need to be vectorized
+optimize = ["/O2"] if sys.platform == "win32" else ["-O3"]
+
 setup(
   setup_requires = ["setuptools>=40.8", "wheel", "numpy>=1.21"],
   python_requires = ">=3.7, <3.11",
@@ -9,7 +13,8 @@ setup(
     Extension(
       "gvsp",
       sources = ["./gvsp.c"],
-      include_dirs = [numpy.get_include()]
+      include_dirs = [numpy.get_include()],
+      extra_compile_args = optimize
     )
   ]
 )
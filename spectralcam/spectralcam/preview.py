@@ -1,6 +1,8 @@
-import time
+import multiprocessing
+import queue
 from collections import deque
-from threading import Event, Lock, Thread
+from multiprocessing.shared_memory import SharedMemory
+from threading import Lock
 from typing import Union
 
 import numpy as np
@@ -14,7 +16,15 @@ from vispy.util.transforms import ortho
 class PreviewWindow(app.Canvas):
     """Actual preview window class. Creates a vispy canvas on a window to display frames from a camera."""
 
-    def __init__(self, width: int, height: int, title: str, display_rate: float = 30.0):
+    def __init__(
+        self,
+        width: int,
+        height: int,
+        title: str,
+        display_rate: float = 30.0,
+        max_rows: Union[None, int] = None,
+        ring: Union[None, "PreviewRing"] = None,
+    ):
         super().__init__(
             title=title,
             size=(width, height),
@@ -25,12 +35,21 @@ class PreviewWindow(app.Canvas):
 
         self._background_color = "gray"
         self._width, self._height = width, height
-        self._row = self._height - 1
+        self._row = self._height - 1  # Texture row of the next line
+        self._filled = 0
+        # Rows are queued by the acquisition thread and drawn by the display timer. Only the latest
+        # rows are kept, so a slow display drops preview rows instead of holding up the receiver.
+        self._pending = deque(maxlen=height)
+        self.max_rows = max_rows
+        """Maximum number of rows drawn per update, more rows are averaged together. None for window height."""
+        self.dropped_rows = 0
+        """Number of rows dropped because the display did not keep up"""
+        self._ring = ring
         self._is_dragging = False
         self._origin = [0, 0]
         self._display_rate = display_rate
         self._timer = app.Timer(
-            1.0 / self._display_rate, connect=self.update, start=True
+            1.0 / self._display_rate, connect=self._on_timer, start=True
         )
 
         self._buffers = []
@@ -52,12 +71,14 @@ class PreviewWindow(app.Canvas):
       }
     """
 
+        # Texture is a ring buffer of rows, u_offset moves the newest row to the top
         fragment_shader = """
       varying vec2 v_texcoord;
       uniform sampler2D texture;
+      uniform float u_offset;
       void main()
       {
-        gl_FragColor = texture2D(texture, v_texcoord);
+        gl_FragColor = texture2D(texture, vec2(v_texcoord.x, fract(v_texcoord.y + u_offset)));
       }
     """
 
@@ -75,10 +96,14 @@ class PreviewWindow(app.Canvas):
             [[0.0, 1.0], [1.0, 1.0], [0.0, 0.0], [1.0, 0.0]]
         )
 
-        self._texture = np.zeros((self._height, self._width, 3), dtype="uint8")
+        self._texture = gloo.Texture2D(
+            np.zeros((self._height, self._width, 3), dtype="uint8"),
+            interpolation="nearest",
+        )
 
         self._program["u_model"] = np.eye(4, dtype=np.float32)
         self._program["u_view"] = np.eye(4, dtype=np.float32)
+        self._program["u_offset"] = 0.0
         self._program["texture"] = self._texture
 
         self._coordinate = [0, 0]
@@ -111,25 +136,58 @@ class PreviewWindow(app.Canvas):
                 _buffer.queue()
         self._buffers.clear()
 
+    def on_close(self, event):
+        self._timer.stop()
+
     def on_draw(self, event):
         gloo.clear(color=self._background_color)
         self._program.draw("triangle_strip")
 
     def push_row(self, row: np.ndarray) -> None:
-        """Add new row to the preview window."""
-        if len(row) != self._width:
-            multiplier = self._width / len(row)
-            if multiplier.is_integer():
-                row = np.repeat(row, multiplier, 0)
-            else:
-                raise ValueError("Preview row length is invalid")
-        if self._row >= 0:
-            self._texture[self._row] = row
-            self._row -= 1
+        """Queue new row to the preview window. Does not block, rows are drawn by the display timer."""
+        if len(row) != self._width and not (self._width / len(row)).is_integer():
+            raise ValueError("Preview row length is invalid")
+        if len(self._pending) == self._pending.maxlen:
+            self.dropped_rows += 1
+        self._pending.append(row)
+
+    def _on_timer(self, event) -> None:
+        if self._ring is not None:
+            self._pending.extend(self._ring.read())
+        count = len(self._pending)
+        if count == 0:
+            return
+        rows = [self._pending.popleft() for _ in range(count)]
+        # Aggregate rows to match the display rate
+        max_rows = min(self.max_rows or self._height, self._height)
+        step = -(-count // max_rows)
+        if step > 1:
+            self.dropped_rows += count % step
+            rows = rows[count % step :]
+        block = np.stack(rows)
+        if step > 1:
+            block = block.reshape(-1, step, *block.shape[1:]).mean(axis=1)
+        if block.shape[1] != self._width:
+            block = np.repeat(block, self._width // block.shape[1], 1)
+        self._upload(np.asarray(block[::-1], dtype=np.uint8))
+        self.update()
+
+    def _upload(self, block: np.ndarray) -> None:
+        # Texture is a ring buffer with the newest row at the lowest index, upload in max two parts
+        count = len(block)
+        top = self._row - count + 1
+        if top >= 0:
+            self._texture.set_data(block, offset=(top, 0), copy=True)
         else:
-            self._texture = np.roll(self._texture, 1, 0)
-            self._texture[0] = row
-        self._program["texture"] = self._texture
+            self._texture.set_data(block[-top:], offset=(0, 0), copy=True)
+            self._texture.set_data(
+                block[:-top], offset=(top + self._height, 0), copy=True
+            )
+        newest = top % self._height
+        self._filled = min(self._filled + count, self._height)
+        if self._filled == self._height:
+            self._program["u_offset"] = newest / self._height
+        self._row = (newest - 1) % self._height
 
     def apply_magnification(self):
         canvas_w, canvas_h = self.physical_size
@@ -194,114 +252,233 @@ PREVIEW_CREATE = 1
 PREVIEW_DESTROY = 2
 PREVIEW_SHOW = 3
 PREVIEW_HIDE = 4
+PREVIEW_QUIT = 5
+
+RING_HEADER_SIZE = 16  # Write count and visible flag (uint64)
+COMMAND_INTERVAL = 0.05  # Seconds between command checks of the preview process
+
+
+class PreviewRing:
+    """
+    Ring of preview rows in shared memory. The acquisition process writes rows and the preview
+    process reads the latest ones. There is no lock, a reader that falls a whole ring behind skips
+    the oldest rows.
+    """
+
+    def __init__(self, width: int, height: int, name: Union[None, str] = None) -> None:
+        """
+        :param width: Maximum number of pixels in a row
+        :param height: Number of rows in the ring
+        :param name: Name of an existing ring to attach to, a new ring is created if not given
+        """
+        self.width, self.height = width, height
+        size = RING_HEADER_SIZE + 4 * height + height * width * 3
+        self._owner = name is None
+        self._shm = SharedMemory(name=name, create=self._owner, size=size)
+        buf = self._shm.buf
+        self._header = np.ndarray((2,), np.uint64, buf, 0)
+        self._lengths = np.ndarray((height,), np.uint32, buf, RING_HEADER_SIZE)
+        self._rows = np.ndarray(
+            (height, width, 3), np.uint8, buf, RING_HEADER_SIZE + 4 * height
+        )
+        self._read = 0
+        self.dropped_rows = 0
+        """Number of rows the reader has skipped"""
+
+    @property
+    def name(self) -> str:
+        """Name of the shared memory block."""
+        return self._shm.name
+
+    @property
+    def visible(self) -> bool:
+        """Preview window of the ring is visible."""
+        return bool(self._header[1])
+
+    @visible.setter
+    def visible(self, value: bool) -> None:
+        self._header[1] = int(value)
+
+    def write(self, row: np.ndarray) -> None:
+        """
+        Add row to the ring. Only one process may write to a ring.
+
+        :param row: Row of pixels, length must divide the width of the ring
+        :raises ValueError: Invalid row length
+        """
+        length = len(row)
+        if length == 0 or self.width % length != 0:
+            raise ValueError("Preview row length is invalid")
+        count = int(self._header[0])
+        slot = count % self.height
+        self._rows[slot, :length] = row
+        self._lengths[slot] = length
+        self._header[0] = count + 1
+
+    def read(self) -> list[np.ndarray]:
+        """
+        Get rows written after the previous read.
+
+        :returns: Copies of the rows, oldest first
+        """
+        count = int(self._header[0])
+        # Slot of the next write may be overwritten while it is read
+        start = max(self._read, count - self.height + 1)
+        self.dropped_rows += start - self._read
+        rows = []
+        for i in range(start, count):
+            slot = i % self.height
+            rows.append(self._rows[slot, : self._lengths[slot]].copy())
+        self._read = count
+        return rows
+
+    def close(self) -> None:
+        """Detach from the shared memory. Ring is removed when its creator closes it."""
+        if self._shm is None:
+            return
+        # Views must be released before the memory is unmapped
+        self._header = self._lengths = self._rows = None
+        self._shm.close()
+        if self._owner:
+            self._shm.unlink()
+        self._shm = None
+
+
+def _preview_process(cmds: multiprocessing.Queue) -> None:
+    """Main function of the preview process. Runs the Qt event loop of all preview windows."""
+    windows: dict[int, tuple[PreviewWindow, PreviewRing]] = {}
+
+    def check_commands(event) -> None:
+        while True:
+            try:
+                cmd, *args = cmds.get_nowait()
+            except queue.Empty:
+                break
+            if cmd == PREVIEW_QUIT:
+                app.quit()
+                return
+            key = args[0]
+            if cmd == PREVIEW_CREATE and key not in windows:
+                name, width, height, title = args[1:]
+                ring = PreviewRing(width, height, name)
+                windows[key] = (PreviewWindow(width, height, title, ring=ring), ring)
+            elif key not in windows:
+                print(
+                    "WARNING: Cannot complete the command, a preview window is probably not created."
+                )
+            elif cmd == PREVIEW_DESTROY:
+                window, ring = windows.pop(key)
+                window.close()
+                ring.close()
+            elif cmd == PREVIEW_SHOW:
+                windows[key][0].show()
+            elif cmd == PREVIEW_HIDE:
+                windows[key][0].native.hide()
+        # Acquisition skips preview rows of hidden windows
+        for window, ring in windows.values():
+            ring.visible = window.native.isVisible()
+
+    timer = app.Timer(COMMAND_INTERVAL, connect=check_commands, start=True)
+    app.run()
+    timer.stop()
+    for window, ring in windows.values():
+        ring.close()
 
 
 class Preview:
-    """Class to control the preview window."""
+    """Class to control the preview window. Window runs in the preview process of the factory."""
 
-    def __init__(self, params: tuple[int, int, str], event: Event, lock: Lock) -> None:
+    def __init__(self, params: tuple[int, int, str], factory: "PreviewFactory", key: int) -> None:
         self._params = params
-        self._cmds = deque()
-        self._event = event
-        self._lock = lock
-        self._preview: Union[None, PreviewWindow] = None
-        self._cmds.appendleft(PREVIEW_CREATE)
-        self._event.set()
+        self._factory = factory
+        self._key = key
+        self._shown = False
+        width, height, _ = params
+        self._ring = PreviewRing(width, height)
 
     def close(self) -> None:
         """Close the window permanently. All resources reserved by the window instance will be freed."""
-        self._lock.acquire()
-        self._cmds.appendleft(PREVIEW_DESTROY)
-        self._event.set()
-        self._lock.release()
+        self._factory._remove(self)
+        self._ring.close()
 
     def show(self) -> None:
         """Make the window visible on screen."""
-        self._lock.acquire()
-        self._cmds.appendleft(PREVIEW_SHOW)
-        self._event.set()
-        self._lock.release()
+        self._shown = True
+        self._factory._send(PREVIEW_SHOW, self._key, start=True)
 
     def hide(self) -> None:
         """Hide the window from screen."""
-        self._lock.acquire()
-        self._cmds.appendleft(PREVIEW_HIDE)
-        self._event.set()
-        self._lock.release()
-
-    def getcmd(self) -> Union[None, int]:
-        if len(self._cmds) > 0:
-            return self._cmds.pop()
-        else:
-            return None
+        self._shown = False
+        self._ring.visible = False
+        self._factory._send(PREVIEW_HIDE, self._key)
 
     def is_visible(self) -> bool:
         """Returns true when the window is visible on the screen."""
-        return self._preview != None and self._preview.native.isVisible()
+        return self._ring.visible
 
     def push_row(self, row: np.ndarray) -> None:
         """
-        Add new row of pixels to the preview.
+        Add new row of pixels to the preview. Row is copied to shared memory, this never waits for
+        the preview process.
 
         :param row: Row of pixels to add
         """
-        self._preview.push_row(row)
+        self._ring.write(row)
+
+    def _create_cmd(self) -> tuple:
+        width, height, title = self._params
+        return (PREVIEW_CREATE, self._key, self._ring.name, width, height, title)
 
 
 class PreviewFactory:
     """
-    Starts a separate thread to handle preview windows. Only one instance of this should be created
+    Runs preview windows in a separate process, which is started when the first window is shown.
+    Rows are passed to it in shared memory, so drawing never competes with acquisition for the GIL
+    and a crashed preview cannot stop a recording. Only one instance of this should be created
     during a program lifecycle.
 
-    QT does not support multiple threads very well, or like, at all...
+    QT does not support multiple threads very well, or like, at all... In its own process it runs in
+    the main thread. The process is started with spawn, so scripts showing previews need the
+    ``if __name__ == "__main__":`` guard. Programs that never show a preview never start it.
     """
 
     def __init__(self) -> None:
         self._instances: list[Preview] = []
-        self._event = Event()
         self._lock = Lock()
-        self._quit = False
-        self._thread = None  # Thread(target=self._loop)
-        # self._thread.start()
-
-    def _loop(self):
-        while True:
-            visible_count = 0
-            if self._quit:
-                for instance in self._instances:
-                    instance._preview.native.destroy()
-                    instance._preview.app.process_events()
-                break
-            self._lock.acquire()
-            for instance in self._instances:
-                if self._event.is_set():
-                    while True:
-                        cmd = instance.getcmd()
-                        if cmd == None:
-                            break
-                        elif cmd == PREVIEW_CREATE and instance._preview == None:
-                            width, height, title = instance._params
-                            instance._preview = PreviewWindow(width, height, title)
-                        elif cmd == PREVIEW_DESTROY and instance._preview != None:
-                            instance._preview.native.destroy()
-                            self._instances.remove(instance)
-                        elif cmd == PREVIEW_SHOW and instance._preview != None:
-                            instance._preview.native.show()
-                        elif cmd == PREVIEW_HIDE and instance._preview != None:
-                            instance._preview.native.hide()
-                        else:
-                            print(
-                                "WARNING: Cannot complete the command, a preview window is probably not created."
-                            )
-                if instance._preview != None and instance._preview.native.isVisible():
-                    instance._preview.app.process_events()
-                    visible_count += 1
-            self._event.clear()
-            self._lock.release()
-            if visible_count == 0:
-                self._event.wait()
-            else:
-                time.sleep(0.05)
+        self._context = multiprocessing.get_context("spawn")
+        self._cmds = None
+        self._process = None
+        self._next_key = 0
+
+    def _start(self) -> None:
+        if self._process is not None:
+            print("WARNING: Preview process has stopped, restarting it.")
+        self._cmds = self._context.Queue()
+        self._process = self._context.Process(
+            target=_preview_process, args=(self._cmds,), name="Preview", daemon=True
+        )
+        self._process.start()
+        # Windows are created again after a crash
+        for instance in self._instances:
+            self._cmds.put(instance._create_cmd())
+            if instance._shown:
+                self._cmds.put((PREVIEW_SHOW, instance._key))
+
+    def _send(self, *cmd, start: bool = False) -> None:
+        # Commands only change the state of the windows, a new process gets the state from _start
+        with self._lock:
+            if self._process is not None and self._process.is_alive():
+                self._cmds.put(cmd)
+            elif start:
+                self._start()
+
+    def _remove(self, instance: Preview) -> None:
+        with self._lock:
+            if instance not in self._instances:
+                return
+            self._instances.remove(instance)
+            if self._process is not None and self._process.is_alive():
+                self._cmds.put((PREVIEW_DESTROY, instance._key))
 
     def create(
         self, width: int = 640, height: int = 480, title: str = "Preview"
@@ -316,15 +493,28 @@ class PreviewFactory:
         :returns: Instance of preview class
         """
         params = (width, height, title)
-        instance = Preview(params, self._event, self._lock)
-        self._instances.append(instance)
+        with self._lock:
+            instance = Preview(params, self, self._next_key)
+            self._next_key += 1
+            self._instances.append(instance)
+        self._send(*instance._create_cmd())
         return instance
 
     def join(self):
         """
-        Close all window instances and shut down the thread. Call this only when you want to close the
-        whole python program.
+        Close all window instances and shut down the preview process. Call this only when you want to
+        close the whole python program.
         """
-        self._event.set()
-        self._quit = True
-        self._thread.join()
+        with self._lock:
+            if self._process is not None:
+                if self._process.is_alive():
+                    self._cmds.put((PREVIEW_QUIT,))
+                    self._process.join(timeout=2.0)
+                if self._process.is_alive():
+                    self._process.terminate()
+                    self._process.join()
+                self._cmds.close()
+                self._process = None
+            for instance in self._instances:
+                instance._ring.close()
+            self._instances.clear()
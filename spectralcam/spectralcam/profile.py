@@ -0,0 +1,81 @@
+"""
+  Declarative camera configuration profiles. A profile is a table of GenICam feature names and
+  values, e.g. a camera section of a TOML file:
+
+    [cameras.hsi]
+    ExposureTime = 2000.0
+    AcquisitionFrameRate = 20.0
+
+  Profiles are applied with FXBase.apply_profile which writes only the features that differ.
+"""
+import math
+
+try:
+  import tomllib
+except ImportError:
+  # Python < 3.11
+  try:
+    import tomli as tomllib
+  except ImportError:
+    tomllib = None
+
+def load_profile(path: str, section: str = None) -> dict:
+  """
+  Load a configuration profile from a TOML file.
+
+  :param path: Path of the TOML file
+  :param section: Dotted name of the table holding the profile (e.g. "cameras.hsi"), whole file if not given
+  :returns: Profile (feature names and values)
+  :raises ImportError: No TOML parser, install tomli on Python < 3.11
+  :raises KeyError: Section not found
+  :raises ValueError: Invalid profile
+  """
+  if tomllib == None:
+    raise ImportError("TOML parser not found, install tomli")
+  with open(path, "rb") as file:
+    profile = tomllib.load(file)
+  if section != None:
+    for key in section.split("."):
+      profile = profile[key]
+  check_profile(profile)
+  return profile
+
+def check_profile(profile: dict) -> None:
+  """
+  Check that a profile contains only feature values (no nested tables or arrays).
+
+  :param profile: Profile (feature names and values)
+  :returns: None
+  :raises ValueError: Invalid profile
+  """
+  if type(profile) != dict:
+    raise ValueError("Profile must be a table of feature names and values")
+  for name, value in profile.items():
+    if type(value) not in (bool, int, float, str):
+      raise ValueError(f"Invalid value of feature {name} in profile: {value}")
+
+def values_equal(current: any, value: any) -> bool:
+  """
+  Compare a feature value read from a camera with a profile value. Floats are compared with
+  relative tolerance as the camera rounds them to the register precision.
+
+  :param current: Value read from the camera
+  :param value: Value in the profile
+  :returns: True if the values are equal
+  """
+  if type(current) == float or type(value) == float:
+    try:
+      return math.isclose(float(current), float(value), rel_tol=1e-6, abs_tol=1e-9)
+    except (TypeError, ValueError):
+      return False
+  return current == value
+
+def profile_diff(profile: dict, snapshot: dict) -> dict:
+  """
+  Get features of a profile that differ from the current state of the camera.
+
+  :param profile: Profile (feature names and values)
+  :param snapshot: Current values of the features
+  :returns: Differing features and their profile values
+  """
+  return {name: value for name, value in profile.items() if name not in snapshot or not values_equal(snapshot[name], value)}
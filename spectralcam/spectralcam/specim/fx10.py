@@ -21,35 +21,35 @@ class FX10(FXBase):
     """
     self._check_connection()
 
-    trigger_interleave = self.get("Trigger_Interleave")
-    if not trigger_interleave:
-      self.set("Trigger_Interleave", True)
-
-    en_aber_correction = self.get("AberCorrection_Enable")
-    if not en_aber_correction:
-      self.set("AberCorrection_Enable", True)
+    # Read current values at once and write only what needs to change
+    trigger_interleave, en_aber_correction, frame_start_trigger_mode, exposure_mode, en_frame_rate, acquisition_mode = self.get_many([
+      "Trigger_Interleave",
+      "AberCorrection_Enable",
+      "FrameStart_TriggerMode",
+      "ExposureMode",
+      "EnAcquisitionFrameRate",
+      "AcquisitionMode",
+    ])
 
     # TODO Temperature_Update, Temperature_FPGA, Temperature_Proc
 
-    frame_start_trigger_mode = self.get("FrameStart_TriggerMode")
+    settings = {}
+    if not trigger_interleave:
+      settings["Trigger_Interleave"] = True
+    if not en_aber_correction:
+      settings["AberCorrection_Enable"] = True
     if frame_start_trigger_mode != "Off":
-      self.set("FrameStart_TriggerMode", "Off")
-
-    exposure_mode = self.get("ExposureMode")
+      settings["FrameStart_TriggerMode"] = "Off"
     if exposure_mode != "Timed":
-      self.set("ExposureMode", "Timed")
-
-    en_frame_rate = self.get("EnAcquisitionFrameRate")
+      settings["ExposureMode"] = "Timed"
     if not en_frame_rate:
-      self.set("EnAcquisitionFrameRate", True)
-
-    self.set("ExposureTime", exposure_time)
-    self.set("AcquisitionFrameRate", frame_rate)
-    self.set("GevSCPD", 10000) # Packet send delay in 10 nano seconds
-
-    acquisition_mode = self.get("AcquisitionMode")
+      settings["EnAcquisitionFrameRate"] = True
+    settings["ExposureTime"] = exposure_time
+    settings["AcquisitionFrameRate"] = frame_rate
+    settings["GevSCPD"] = 10000 # Packet send delay in 10 nano seconds
     if acquisition_mode != "Continuous":
-      self.set("AcquisitionMode", "Continuous")
+      settings["AcquisitionMode"] = "Continuous"
+    self.set_many(settings)
 
     pulse_len = 200
     self.set("MotorShutter_PulseRev", pulse_len)
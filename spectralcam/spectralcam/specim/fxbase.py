@@ -1,5 +1,6 @@
 from collections import deque
-from typing import Union
+from typing import Callable, Union
+import operator
 import time
 from threading import Event
 import threading
@@ -9,10 +10,15 @@ from genicam.genapi import NodeMap
 from genicam.genapi import IValue, ICategory, ICommand, IEnumeration
 
 from spectralcam.utils import *
-from spectralcam.gige import GVCP, GVCPDiscoveryAck, PortGVCP, GVCP_PORT, gvsp
+from spectralcam.gige import GVCP, GVCPDiscoveryAck, PortGVCP, DeviceDescription, GVCP_PORT, gvsp
+from spectralcam.gige import MessageChannel, GVCPEvent
+from spectralcam.gige import REG_SCPS0, VAL_SCPS_FIRE_TEST, VAL_SCPS_DO_NOT_FRAGMENT, VAL_SCPS_PACKET_SIZE
 from spectralcam.preview import PreviewFactory
 from spectralcam.gentl import GCDeviceInfo, DiscoverableGigeDevice
 from spectralcam.exceptions import *
+from spectralcam.cache import DeviceDescriptionCache, ProfileCache, BadPixelCache
+from spectralcam.profile import check_profile, profile_diff
+from spectralcam.badpixels import detect_bad_pixels
 
 class FXBase(DiscoverableGigeDevice):
   """
@@ -24,7 +30,7 @@ class FXBase(DiscoverableGigeDevice):
   in the future this class can be probably used as a base for such class.
   """
 
-  def __init__(self, dev_info: GCDeviceInfo, port: int = GVCP_PORT, preview_factory: PreviewFactory = None):
+  def __init__(self, dev_info: GCDeviceInfo, port: int = GVCP_PORT, preview_factory: PreviewFactory = None, use_cache: bool = True):
 
     # GVSP
     self._gvsp_port = 0
@@ -35,6 +41,25 @@ class FXBase(DiscoverableGigeDevice):
     self.buffer = deque()
     self.record = False
 
+    # Chunk data (per-frame metadata) of the recorded frames
+    self._chunk_mode = False
+    self.chunk_buffer = deque()
+    self.chunk_record = None
+
+    # Device timestamps (from GVSP leaders) of the recorded frames
+    self._timestamp_mode = False
+    self.timestamp_buffer = deque()
+    self.timestamp_record = None
+    self.last_timestamp = None
+    """Device timestamp of the latest frame in ticks, frame_cb can read it to get the timestamp of its frame"""
+
+    # Reflectance calibrated by the receiver (see set_calibration)
+    self._calibration = None
+    self.reflectance_buffer = deque()
+    self.reflectance_record = None
+    self.last_reflectance = None
+    """Reflectance of the latest frame, frame_cb can read it to get the reflectance of its frame"""
+
     # Show messages in CLI
     self._verbose = False
     self.print_info = True
@@ -51,24 +76,37 @@ class FXBase(DiscoverableGigeDevice):
     if self._verbose:
       print("FX: Device info updated")
 
-    # Fetch device description file and create nodes
-    xml_str = self.gvcp.get_device_description_file()
-    gc_port = PortGVCP(self.gvcp)
+    # Fetch device description file (from cache if the camera is known) and create nodes
+    cache = DeviceDescriptionCache() if use_cache else None
+    xml_str = self.gvcp.get_device_description_file(cache=cache, device=self._info.device)
+    gc_port = PortGVCP(self.gvcp, DeviceDescription(xml_str))
     gc_xml = NodeMap()
     gc_xml.load_xml_from_string(xml_str)
     gc_xml.connect(gc_port)
+    self._gc_port = gc_port
     self._gc_xml = gc_xml
     if self._verbose:
       print("FX: Device description file fetched")
 
+    # Bands kept by the receiver (see select_bands)
+    self._bands = None
+
+    # Bad pixel map of the camera (see detect_bad_pixels)
+    self._bad_pixels = BadPixelCache().get(self._info.device.serial_number) if use_cache else None
+
     # Temperature monitoring
     self.en_temp_warning = True
     self.temp_update_rate = 30.0 # in seconds
     self.temp_fpga_warn = self.get("Temperature_FPGALowLimit") # in °C
     self.temp_pcb_warn = self.get("Temperature_ProcLowLimit") # in °C
     self._temp_stop = threading.Event()
-    self._temp_thread = threading.Thread(target=self._check_temperature_loop)
-    self._temp_thread.start()
+    self._temp_thread = None
+
+    # Events from the message channel, temperature is polled only if the camera has no temperature events
+    self.events = MessageChannel(self.gvcp)
+    if not self._subscribe_temperature_events():
+      self._temp_thread = threading.Thread(target=self._check_temperature_loop)
+      self._temp_thread.start()
 
     # Initialize preview
     self.preview = None
@@ -76,6 +114,8 @@ class FXBase(DiscoverableGigeDevice):
     self.red_band = round(spectral * 1/6)
     self.green_band = round(spectral * 3/6)
     self.blue_band = round(spectral * 5/6)
+    self.preview_gain = (1.0, 1.0, 1.0)
+    self.preview_offset = (0.0, 0.0, 0.0)
     if preview_factory != None:
       binning = self.get("BinningHorizontal")
       width = self.get("Width")
@@ -97,6 +137,7 @@ class FXBase(DiscoverableGigeDevice):
   @verbose.setter
   def verbose(self, value: bool) -> None:
     self.gvcp.verbose = value
+    self.events.verbose = value
     if self._gvsp_p != None:
       gvsp.set_verbose(self._gvsp_p, value)
     self._verbose = value
@@ -124,6 +165,9 @@ class FXBase(DiscoverableGigeDevice):
   frame_cb = None
   """Frame callback function. It is called every time a new frame is received."""
 
+  chunk_cb = None
+  """Chunk callback function. It is called with chunk data of every frame when chunks are enabled."""
+
   def close(self) -> None:
     """
     Close all related resources to the camera.
@@ -139,8 +183,11 @@ class FXBase(DiscoverableGigeDevice):
           time.sleep(0.05) # Weird behaviour of FX17 camera...
         self.close_stream()
       self._temp_stop.set()
-      self._temp_thread.join()
+      if self._temp_thread != None:
+        self._temp_thread.join()
+      self.events.close()
       self.gvcp.disconnect()
+      self.invalidate_cache()
     if self.preview != None:
       self.preview.hide()
     if self._verbose:
@@ -308,10 +355,149 @@ class FXBase(DiscoverableGigeDevice):
     else:
       feature_obj.value = value
 
-  def open_stream(self) -> None:
+  def get_many(self, features: list[Union[str, IValue]]) -> list[any]:
+    """
+    Read values of several features. Registers of the features are read first with as few
+    concatenated READREG commands as possible, so this is much faster than calling get() for each.
+
+    :param features: Camera features or their names
+    :returns: Values of the features in the same order
+    :raises NotConnectedError: No connection
+    :raises TypeError: Invalid feature
+    :raises AckError: Problem with an acknowledgement from the camera
+    """
+    self._check_connection()
+    self._gc_port.prefetch(self._feature_addresses(features))
+    try:
+      return [self.get(feature) for feature in features]
+    finally:
+      self._gc_port.end_prefetch()
+
+  def set_many(self, values: dict[Union[str, IValue], any]) -> None:
+    """
+    Write values of several features in the given order. Registers needed to check the values are
+    read first and the register writes are sent with as few concatenated WRITEREG commands as
+    possible, so this is much faster than calling set() for each.
+
+    :param values: Values by camera feature or it's name
+    :returns: None
+    :raises NotConnectedError: No connection
+    :raises TypeError: Invalid feature
+    :raises AckError: Problem with an acknowledgement from the camera
+    """
+    self._check_connection()
+    self._gc_port.prefetch(self._feature_addresses(values.keys()))
+    self._gc_port.begin_batch()
+    try:
+      for feature, value in values.items():
+        self.set(feature, value)
+    finally:
+      self._gc_port.end_prefetch()
+      self._gc_port.end_batch()
+
+  def snapshot(self, features: list[str]) -> dict:
+    """
+    Read current values of features with batched reads (see get_many).
+
+    :param features: Names of the camera features
+    :returns: Values by feature name
+    :raises NotConnectedError: No connection
+    :raises AckError: Problem with an acknowledgement from the camera
+    """
+    features = list(features)
+    return dict(zip(features, self.get_many(features)))
+
+  def apply_profile(self, profile: dict, use_cache: bool = True, trust_cache: bool = False) -> dict:
+    """
+    Apply a configuration profile (see spectralcam.profile.load_profile). Current values are read
+    with batched reads and only the differing features are written, in dependency order (e.g.
+    binning before width). Features that depend on a written feature are written too as their
+    values may change.
+
+    :param profile: Feature names and values
+    :param use_cache: Save the applied profile to cache (per camera serial number)
+    :param trust_cache: Skip reading the camera if the same profile was the last one applied to it
+    :returns: Written features and values
+    :raises NotConnectedError: No connection
+    :raises ValueError: Invalid profile
+    :raises AckError: Problem with an acknowledgement from the camera
+    """
+    self._check_connection()
+    check_profile(profile)
+    serial = self._info.device.serial_number
+    cache = ProfileCache() if use_cache else None
+    if cache != None and trust_cache and cache.get(serial) == profile:
+      if self._verbose:
+        print("FX: Profile already applied")
+      return {}
+
+    description = self._gc_port.description
+    diff = profile_diff(profile, self.snapshot(profile.keys()))
+    order = description.dependency_order(list(profile.keys()))
+    written = set()
+    changes = {}
+    for name in order:
+      if name in diff or any(description.affected_by(name, other) for other in written):
+        changes[name] = profile[name]
+        written.add(name)
+    self.set_many(changes)
+    if cache != None:
+      cache.put(serial, profile)
+    if self._verbose:
+      print(f"FX: Profile applied, {len(changes)} features written")
+    return changes
+
+  def subscribe_event(self, event: Union[str, int], callback: Callable[[GVCPEvent], None]) -> None:
+    """
+    Call a function when the camera sends an event (e.g. temperature, overrun or acquisition events).
+    Message channel is opened and event notification enabled (EventSelector / EventNotification) if needed.
+
+    :param event: Event name (entry of EventSelector or event node in the device description file) or event ID
+    :param callback: Function called with GVCPEvent from the receiver thread
+    :returns: None
+    :raises NotConnectedError: No connection
+    :raises NotImplementedError: Camera does not support events
+    :raises ValueError: Unknown event
+    :raises AckError: Problem with an acknowledgement from the camera
+    """
+    self._check_connection()
+    if type(event) == int:
+      event_ids = [event]
+    else:
+      self._enable_event_notification(event)
+      event_ids = list(self._gc_port.description.find_events(event).values())
+      if len(event_ids) == 0:
+        raise ValueError(f"Unknown event: {event}")
+    if not self.events.is_open:
+      self.events.open(self._info.host_address)
+    for event_id in set(event_ids):
+      self.events.subscribe(callback, event_id)
+
+  def invalidate_cache(self, feature: Union[str, IValue] = None) -> None:
+    """
+    Drop cached register values so that the next read comes from the camera. Feature reads are
+    cached as the device description file allows, this is needed only if registers are changed
+    behind the cache (e.g. with gvcp.writereg).
+
+    :param feature: Camera feature or it's name, all features if not given
+    :returns: None
+    """
+    if feature == None:
+      self._gc_port.invalidate()
+      return
+    name = feature if type(feature) == str else feature.node.name
+    registers = self._gc_port.description.registers_of(name)
+    if len(registers) == 0:
+      self._gc_port.invalidate()
+    for reg_name in registers:
+      self._gc_port.invalidate(self._gc_port.description.registers[reg_name].address)
+
+  def open_stream(self, negotiate: bool = False, max_packet_size: int = 9000) -> None:
     """
     Open GVSP stream channel and start listening for incoming frames.
 
+    :param negotiate: Find the largest working packet size with negotiate_packet_size
+    :param max_packet_size: Largest packet size to try when negotiating, 9000 for jumbo frames
     :returns: None
     :raises NotConnectedError: No connection
     :raises AckError: Problem with an acknowledgement from the camera
@@ -322,16 +508,35 @@ class FXBase(DiscoverableGigeDevice):
     if self._verbose:
       print("FX: Opening stream channel...")
 
-    def handle_frame(frame, bit_depth):
+    def handle_frame(frame, bit_depth, chunks=None, timestamp=None, preview=None, reflectance=None):
       intercept = False
+      self.last_timestamp = timestamp
+      self.last_reflectance = reflectance
+      if chunks is not None and self.chunk_cb != None:
+        self.chunk_cb(chunks)
       if self.frame_cb != None:
         intercept = self.frame_cb(frame, bit_depth)
       if not intercept:
         if self.record:
           self.buffer.append(frame)
+          if chunks is not None:
+            self.chunk_buffer.append(chunks)
+          if timestamp is not None:
+            self.timestamp_buffer.append(timestamp)
+          if reflectance is not None:
+            self.reflectance_buffer.append(reflectance)
         if self.preview != None and self.preview.is_visible():
-          shift = bit_depth - 8
-          preview = np.array([frame[self.red_band], frame[self.green_band], frame[self.blue_band]]).swapaxes(0, 1) >> shift
+          if preview is None:
+            # Receiver did not make the row (see _update_preview)
+            red, green, blue = self.red_band, self.green_band, self.blue_band
+            if type(frame) == tuple:
+              # Multi-part frame set, parts are stacked along the spectral axis
+              frame = np.concatenate([part >> (depth - 8) for part, depth in zip(frame, bit_depth)])
+              bit_depth = 8
+              last = len(frame) - 1
+              red, green, blue = min(red, last), min(green, last), min(blue, last)
+            shift = bit_depth - 8
+            preview = np.array([frame[red], frame[green], frame[blue]]).swapaxes(0, 1) >> shift
           self.preview.push_row(preview)
 
     # Initialize GVSP module to receive frames
@@ -341,12 +546,102 @@ class FXBase(DiscoverableGigeDevice):
     self._gvsp_p, self._gvsp_port = gvsp.create_socket(host_addr)
     gvsp.set_frame_cb(self._gvsp_p, handle_frame)
     gvsp.create_buffer(self._gvsp_p, payload_size, packet_size)
+    gvsp.set_chunk_mode(self._gvsp_p, self._chunk_mode)
+    gvsp.set_timestamp_mode(self._gvsp_p, self._timestamp_mode)
+    self._update_preview()
+    if self._calibration != None:
+      gvsp.set_calibration(self._gvsp_p, *self._calibration)
+    if self._bad_pixels is not None:
+      try:
+        self._check_bad_pixel_map(self._bad_pixels)
+        gvsp.set_bad_pixels(self._gvsp_p, self._bad_pixels)
+      except ValueError as err:
+        print(f"WARNING: Bad pixels are not corrected: {err}")
+    if self._bands != None:
+      gvsp.set_bands(self._gvsp_p, self._bands)
 
     # Set receiver address and port
     self._set_gev_scda(ip_to_uint32(host_addr))
     self.set("GevSCPHostPort", self._gvsp_port)
     if self._verbose:
       print("FX: Stream channel open")
+    if negotiate:
+      self.negotiate_packet_size(max_packet_size)
+
+  def negotiate_packet_size(self, max_size: int = 9000, timeout: float = 0.2) -> int:
+    """
+    Find the largest packet size that reaches this host without fragmentation and start using it.
+    Camera is asked to send test packets (fire test packet and do not fragment bits of GevSCPS) at
+    increasing sizes, the size between the largest received and the smallest lost packet is then
+    narrowed down by bisection. Bigger packets mean less per-packet overhead in the receiver, but
+    jumbo frames must be enabled on the network card (and switches) for sizes over 1500.
+
+    :param max_size: Largest packet size to try
+    :param timeout: Time to wait for each test packet in seconds
+    :returns: Packet size in use
+    :raises NotConnectedError: No connection
+    :raises StreamClosedError: Stream channel is not open
+    :raises ConnectionError: Acquiring is active
+    :raises AckError: Problem with an acknowledgement from the camera
+    """
+    self._check_stream_channel()
+    if self._is_acquiring:
+      raise ConnectionError("Cannot negotiate packet size while acquiring")
+    camera_addr = self._info.device.current_ip
+    scps = self.gvcp.readreg(REG_SCPS0, int)
+    flags = scps & ~(VAL_SCPS_FIRE_TEST | VAL_SCPS_PACKET_SIZE)
+    current = scps & VAL_SCPS_PACKET_SIZE
+    inc = 4
+    try:
+      inc = max(self.get_node("GevSCPSPacketSize").inc, inc)
+    except (AttributeError, TypeError):
+      pass
+
+    def probe(size):
+      try:
+        self.gvcp.writereg(REG_SCPS0, flags | VAL_SCPS_FIRE_TEST | VAL_SCPS_DO_NOT_FRAGMENT | size)
+      except AckError:
+        # Camera does not accept the size
+        return False
+      return gvsp.receive_test_packet(self._gvsp_p, camera_addr, size, timeout) >= size
+
+    if not probe(current):
+      if self._verbose:
+        print(f"FX: No test packet of {current} bytes received, keeping packet size")
+      self.gvcp.writereg(REG_SCPS0, scps)
+      self._gc_port.invalidate(REG_SCPS0)
+      return current
+
+    # Increase size until a packet is lost, then bisect
+    good = current
+    bad = None
+    for size in [1500, 3000, 4500, 6000, 7500, max_size]:
+      size = size // inc * inc
+      if size <= good or size > max_size:
+        continue
+      if probe(size):
+        good = size
+      else:
+        bad = size
+        break
+    while bad != None and bad - good > max(inc, 32):
+      size = (good + bad) // 2 // inc * inc
+      if size <= good:
+        break
+      if probe(size):
+        good = size
+      else:
+        bad = size
+
+    # Use the new size
+    self.gvcp.writereg(REG_SCPS0, flags | good)
+    self._gc_port.invalidate(REG_SCPS0)
+    if good != current:
+      gvsp.free_buffer(self._gvsp_p)
+      gvsp.create_buffer(self._gvsp_p, self.get("PayloadSize"), good)
+    if self._verbose:
+      print(f"FX: Packet size {good} bytes")
+    return good
 
   def close_stream(self) -> None:
     """
@@ -389,7 +684,7 @@ class FXBase(DiscoverableGigeDevice):
     """
     Stop acquiring frames.
 
-    :returns: Numpy array of recorded frames or None if recording was not turned on
+    :returns: Numpy array of recorded frames (tuple of arrays with multi-part payload) or None if recording was not turned on
     :raises NotConnectedError: No connection
     :raises StreamClosedError: Stream channel is not open
     :raises AckError: Problem with an acknowledgement from the camera
@@ -401,9 +696,7 @@ class FXBase(DiscoverableGigeDevice):
     gvsp.stop_receive(self._gvsp_p)
     self._is_acquiring = False
     if self.record:
-      record = np.array(self.buffer)
-      self.buffer.clear()
-      return record
+      return self._take_record()
     else:
       return None
 
@@ -445,6 +738,384 @@ class FXBase(DiscoverableGigeDevice):
     time.sleep(pulse_len / 1000)
     return record
 
+  def dark_ref_accumulate(self, frame_count: int = 200) -> tuple[np.ndarray, np.ndarray]:
+    """
+    Acquire dark reference by averaging frames in the receiver. Frames are not stored, so any number
+    of them can be averaged. Parts of multi-part frames are stacked along the spectral axis.
+
+    :param frame_count: Number of frames to average, default is 200
+    :returns: Mean dark frame and noise map (standard deviation of each pixel), arrays of float64
+    :raises NotConnectedError: No connection
+    :raises StreamClosedError: Stream channel is not open
+    :raises AckError: Problem with an acknowledgement from the camera
+    """
+    self._check_stream_channel()
+    if self._verbose:
+      print("FX: Accumulating dark reference data")
+
+    ready = Event()
+    frame_no = 0
+    old_cb = self.frame_cb
+    pulse_len = 200
+
+    def handle_count(frame, bit_depth):
+      nonlocal frame_no
+      frame_no += 1
+      if frame_no == frame_count:
+        ready.set()
+      # Frames are summed before the callback, nothing to keep
+      return True
+
+    self.frame_cb = handle_count
+    self.set("MotorShutter_PulseFwd", pulse_len)
+    time.sleep(pulse_len / 1000)
+    gvsp.start_accumulate(self._gvsp_p, frame_count)
+    self.start_acquire(False)
+
+    ready.wait()
+    self.stop_acquire()
+    count, mean, noise = gvsp.stop_accumulate(self._gvsp_p)
+    self.frame_cb = old_cb
+    self.set("MotorShutter_PulseRev", pulse_len)
+    time.sleep(pulse_len / 1000)
+    if self._verbose:
+      print(f"FX: Averaged {count} dark frames")
+    return mean, noise
+
+  def start_pcap(self, path: str) -> None:
+    """
+    Start saving raw GVSP packets to a pcap file, e.g. to reproduce corrupted frames offline.
+
+    :param path: Path of the pcap file, existing file will be overwritten
+    :returns: None
+    :raises NotConnectedError: No connection
+    :raises StreamClosedError: Stream channel is not open
+    :raises ConnectionError: Packet capture is already active
+    :raises OSError: File cannot be opened
+    """
+    self._check_stream_channel()
+    if self._verbose:
+      print(f"FX: Saving raw packets to {path}")
+    gvsp.start_pcap(self._gvsp_p, path)
+
+  def stop_pcap(self) -> None:
+    """
+    Stop saving raw GVSP packets.
+
+    :returns: None
+    :raises NotConnectedError: No connection
+    :raises StreamClosedError: Stream channel is not open
+    :raises ConnectionError: Packet capture is not active
+    """
+    self._check_stream_channel()
+    if self._verbose:
+      print("FX: Stopped saving raw packets")
+    gvsp.stop_pcap(self._gvsp_p)
+
+  def replay_pcap(self, path: str, record: bool = False) -> Union[None, np.ndarray]:
+    """
+    Decode packets saved by start_pcap (or captured with Wireshark) as if they were received now.
+    Frames go through frame_cb and the preview as usual. Camera configuration must match the
+    configuration used for the recording.
+
+    :param path: Path of the pcap or pcapng file
+    :param record: Record frames and return them
+    :returns: Numpy array of recorded frames (tuple of arrays with multi-part payload) or None if recording was not turned on
+    :raises NotConnectedError: No connection
+    :raises StreamClosedError: Stream channel is not open
+    :raises ConnectionError: Acquiring is active
+    :raises OSError: File cannot be read
+    :raises ValueError: File format is not supported
+    """
+    self._check_stream_channel()
+    if self._verbose:
+      print(f"FX: Replaying raw packets from {path}")
+    self.record = record
+    count = gvsp.replay_pcap(self._gvsp_p, path)
+    if self._verbose:
+      print(f"FX: Replayed {count} packets")
+    if record:
+      self.record = False
+      return self._take_record()
+    else:
+      return None
+
+  def get_jitter(self, percentiles: tuple[float, ...] = (50, 90, 99, 99.9)) -> dict:
+    """
+    Get timing statistics of received packets, e.g. to tune GevSCPD (packet delay) and packet size
+    for a NIC. 'packet_gap' is the time between consecutive packets of a frame and 'frame_interval'
+    the time between consecutive frames. Times are measured by the receive thread since the stream
+    channel was opened or reset_jitter was called, percentiles are accurate to about 3 %.
+
+    :param percentiles: Percentiles to calculate
+    :returns: Dict with keys 'packet_gap' and 'frame_interval', each a dict with 'count' and 'min',
+      'max', 'mean' and percentiles (keys are the given percentiles) in microseconds
+    :raises NotConnectedError: No connection
+    :raises StreamClosedError: Stream channel is not open
+    """
+    self._check_stream_channel()
+    jitter = {}
+    for name, hist in gvsp.get_histograms(self._gvsp_p).items():
+      total = hist["total"]
+      stats = {"count": total}
+      if total > 0:
+        stats["min"] = hist["min"] / 1000
+        stats["max"] = hist["max"] / 1000
+        stats["mean"] = hist["sum"] / total / 1000
+        cumulative = np.cumsum(hist["counts"])
+        for p in percentiles:
+          i = min(np.searchsorted(cumulative, total * p / 100), len(cumulative) - 1)
+          stats[p] = int(hist["values"][i]) / 1000
+      jitter[name] = stats
+    return jitter
+
+  def reset_jitter(self) -> None:
+    """
+    Clear timing statistics of received packets.
+
+    :returns: None
+    :raises NotConnectedError: No connection
+    :raises StreamClosedError: Stream channel is not open
+    """
+    self._check_stream_channel()
+    gvsp.reset_histograms(self._gvsp_p)
+
+  def enable_chunks(self, enable: bool = True) -> None:
+    """
+    Turn chunk data mode on or off. In chunk mode the camera appends metadata (e.g. exposure time,
+    frame counter, encoder values) to every frame and it is parsed by the receiver. Chunks are
+    delivered to chunk_cb as a numpy structured array (fields id, length and value) and recorded
+    chunks are saved to chunk_record by stop_acquire. Chunks to include are selected with the
+    camera's ChunkSelector and ChunkEnable features.
+
+    :param enable: True to turn chunk mode on, False to turn it off
+    :returns: None
+    :raises NotConnectedError: No connection
+    :raises ConnectionError: Stream channel is open (PayloadSize changes with chunk mode)
+    :raises AckError: Problem with an acknowledgement from the camera
+    """
+    self._check_connection()
+    if self.is_stream_open:
+      raise ConnectionError("Cannot change chunk mode while stream channel is open")
+    if not self._set_optional("ChunkModeActive", enable) and enable and self._verbose:
+      print("FX: ChunkModeActive not found, chunks are parsed if the camera sends them")
+    self._chunk_mode = enable
+
+  def enable_timestamps(self, enable: bool = True) -> None:
+    """
+    Turn frame timestamps on or off. Device timestamp of every frame (in ticks, see
+    timestamp_frequency) is taken from the GVSP leader and set to last_timestamp before frame_cb is
+    called. Recorded timestamps are saved to timestamp_record by stop_acquire.
+
+    :param enable: True to turn timestamps on, False to turn them off
+    :returns: None
+    """
+    self._timestamp_mode = enable
+    if self._gvsp_p != None:
+      gvsp.set_timestamp_mode(self._gvsp_p, enable)
+
+  def set_calibration(self, dark: Union[None, np.ndarray], white: np.ndarray = None, dtype: type = np.float32, scale: float = 10000.0) -> None:
+    """
+    Calibrate frames to reflectance (raw - dark) / (white - dark) in the receiver. References can be
+    changed during acquisition. Reflectance of every frame is set to last_reflectance before frame_cb
+    is called and recorded reflectance is saved to reflectance_record by stop_acquire. Parts of
+    multi-part frames are stacked along the spectral axis.
+
+    :param dark: Dark reference (spectral x spatial of the selected bands, e.g. mean of dark_ref_accumulate), None to turn calibration off
+    :param white: White reference of the same shape
+    :param dtype: Type of reflectance, numpy.float32 or numpy.uint16 (scaled)
+    :param scale: Value of reflectance 1.0 with numpy.uint16
+    :returns: None
+    :raises ValueError: Invalid references or type
+    """
+    calibration = (dark, white, dtype, scale) if dark is not None else None
+    if self._gvsp_p != None:
+      if calibration != None:
+        gvsp.set_calibration(self._gvsp_p, *calibration)
+      else:
+        gvsp.set_calibration(self._gvsp_p, None)
+    self._calibration = calibration
+
+  def select_bands(self, bands: Union[None, list]) -> None:
+    """
+    Keep only some spectral bands of the frames. Selection is done by the receiver, so only the
+    selected bands are recorded, previewed and calibrated (preview bands and calibration references
+    refer to the selected bands). Bands of multi-part frames are counted over all parts and the
+    selected bands are passed as one frame. Selection can be changed during acquisition. Calibration
+    references were taken with the previous selection, so changing it turns calibration off.
+
+    :param bands: Band indexes, a group of bands (e.g. range(40, 44)) is averaged to one band. None to keep all bands.
+    :returns: None
+    :raises ValueError: Invalid selection
+    """
+    if self._verbose:
+      print("FX: Selecting bands")
+
+    def band_item(band):
+      # Integers like numpy.int64 are single bands, sequences (also numpy arrays) are groups
+      try:
+        return operator.index(band)
+      except TypeError:
+        return [operator.index(index) for index in band]
+
+    bands = [band_item(band) for band in bands] if bands != None else None
+    if self._gvsp_p != None:
+      gvsp.set_bands(self._gvsp_p, bands)
+    if bands != self._bands and self._calibration != None:
+      print("WARNING: Band selection changed, calibration is turned off until new references are set")
+      self.set_calibration(None)
+    self._bands = bands
+
+  @property
+  def bad_pixels(self) -> Union[None, np.ndarray]:
+    """Bad pixel map (spectral x spatial, True for bad pixels) corrected by the receiver, None if correction is off"""
+    return self._bad_pixels
+
+  def set_bad_pixels(self, mask: Union[None, np.ndarray], save: bool = False) -> None:
+    """
+    Replace bad pixels in every frame by interpolating their good neighbours (spatial, or spectral
+    if the neighbouring columns are bad too). Map can be changed during acquisition.
+
+    :param mask: Bad pixel map (spectral x spatial, True for bad pixels) of the frames sent by the camera, before band selection. None to turn correction off
+    :param save: Save the map to cache for this camera (or remove it from cache if mask is None)
+    :returns: None
+    :raises ValueError: Invalid map or map does not match the frames of the camera
+    """
+    if mask is not None:
+      mask = np.asarray(mask, dtype=bool)
+      self._check_bad_pixel_map(mask)
+    if self._gvsp_p != None:
+      uncorrected = gvsp.set_bad_pixels(self._gvsp_p, mask)
+      if uncorrected > 0 and self._verbose:
+        print(f"FX: {uncorrected} bad pixels have no good neighbours")
+    self._bad_pixels = mask
+    if save:
+      cache = BadPixelCache()
+      if mask is None:
+        cache.remove(self._info.device.serial_number)
+      else:
+        cache.put(self._info.device.serial_number, mask)
+
+  def detect_bad_pixels(self, frame_count: int = 200, white: np.ndarray = None, save: bool = True, **thresholds) -> np.ndarray:
+    """
+    Find hot, noisy and dead pixels (see spectralcam.badpixels.detect_bad_pixels) and start
+    correcting them. Dark statistics are measured with the shutter closed on all bands, correction
+    and band selection are off meanwhile.
+
+    :param frame_count: Number of dark frames to average, default is 200
+    :param white: Mean frame of a white reference (all bands) to detect dead pixels, optional
+    :param save: Save the map to cache, it is loaded automatically when the camera is opened again
+    :param thresholds: hot_sigma, noise_factor and dead_fraction of detect_bad_pixels
+    :returns: Bad pixel map (spectral x spatial, True for bad pixels)
+    :raises NotConnectedError: No connection
+    :raises StreamClosedError: Stream channel is not open
+    :raises AckError: Problem with an acknowledgement from the camera
+    """
+    self._check_stream_channel()
+    gvsp.set_bad_pixels(self._gvsp_p, None)
+    # Map is for the full frame, bands are selected after correction
+    gvsp.set_bands(self._gvsp_p, None)
+    try:
+      dark, noise = self.dark_ref_accumulate(frame_count)
+    except:
+      # Keep the previous map
+      self.set_bad_pixels(self._bad_pixels)
+      raise
+    finally:
+      gvsp.set_bands(self._gvsp_p, self._bands)
+    mask = detect_bad_pixels(dark, noise, white, **thresholds)
+    if self._verbose:
+      print(f"FX: {np.count_nonzero(mask)} bad pixels found")
+    self.set_bad_pixels(mask, save)
+    return mask
+
+  @property
+  def timestamp_frequency(self) -> int:
+    """Device timestamp ticks per second"""
+    try:
+      return self.get("GevTimestampTickFrequency")
+    except AttributeError:
+      # Timestamps of PTP capable devices are in nanoseconds
+      return 1000000000
+
+  @property
+  def scheduled_action_support(self) -> bool:
+    """Camera can execute scheduled ACTION commands (at a given device timestamp)"""
+    return self.gvcp.supports("scheduled_action")
+
+  def get_timestamp(self) -> int:
+    """
+    Latch and read the current device timestamp.
+
+    :returns: Device timestamp in ticks
+    :raises NotConnectedError: No connection
+    :raises NotImplementedError: Camera has no timestamp latch
+    :raises AckError: Problem with an acknowledgement from the camera
+    """
+    self._check_connection()
+    for latch, value in (("GevTimestampControlLatch", "GevTimestampValue"), ("TimestampLatch", "TimestampLatchValue")):
+      if self._set_optional(latch, 1):
+        self.invalidate_cache(value)
+        return self.get(value)
+    raise NotImplementedError("Camera does not have a timestamp latch")
+
+  def enable_action_trigger(self, device_key: int, group_key: int, group_mask: int, enable: bool = True) -> None:
+    """
+    Trigger frames with GVCP ACTION commands (see GCInterface.gvcp_action). Action 1 of the camera
+    is set to the given keys and used as the frame start trigger, so one broadcasted (scheduled)
+    action triggers a frame on every camera configured with the same keys.
+
+    :param device_key: Device key (ActionDeviceKey)
+    :param group_key: Group key (ActionGroupKey)
+    :param group_mask: Group mask (ActionGroupMask)
+    :param enable: True to trigger with actions, False to turn frame start trigger off
+    :returns: None
+    :raises NotConnectedError: No connection
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises ValueError: Camera does not support action trigger
+    """
+    self._check_connection()
+    if not enable:
+      if not self._set_optional("FrameStart_TriggerMode", "Off"):
+        self._set_optional("TriggerSelector", "FrameStart")
+        self._set_optional("TriggerMode", "Off")
+      return
+    self._set_optional("ActionSelector", 1)
+    if not (self._set_optional("ActionDeviceKey", device_key) and self._set_optional("ActionGroupKey", group_key)):
+      raise ValueError("Camera does not support action trigger")
+    self._set_optional("ActionGroupMask", group_mask)
+    if self._set_optional("FrameStart_TriggerSource", "Action1"):
+      self.set("FrameStart_TriggerMode", "On")
+    else:
+      self._set_optional("TriggerSelector", "FrameStart")
+      self.set("TriggerSource", "Action1")
+      self.set("TriggerMode", "On")
+    if self._verbose:
+      print("FX: Frame start triggered by action 1")
+
+  def enable_multipart(self, enable: bool = True) -> None:
+    """
+    Turn multi-part payload (GigE Vision 2.1) on or off. With multi-part payload the camera can send
+    several regions (e.g. non-contiguous spectral band ranges, selected with RegionSelector) in one
+    block. Each part is decoded into its own array and frame_cb gets a tuple of frames and a tuple of
+    bit depths. stop_acquire returns a tuple of recorded arrays, one for each part. Single-part
+    payloads are decoded as before, so this only configures the camera.
+
+    :param enable: True to turn multi-part payload on, False to turn it off
+    :returns: None
+    :raises NotConnectedError: No connection
+    :raises ConnectionError: Stream channel is open
+    :raises AckError: Problem with an acknowledgement from the camera
+    :raises ValueError: Camera does not support multi-part payload
+    """
+    self._check_connection()
+    if self.is_stream_open:
+      raise ConnectionError("Cannot change payload mode while stream channel is open")
+    if enable:
+      self._set_optional("GevGVSPExtendedIDMode", "On")
+    if not self._set_optional("GevSCCFGMultiPartEnabled", enable) and enable:
+      raise ValueError("Camera does not support multi-part payload")
+
   def show_preview(self) -> None:
     """
     Open preview window.
@@ -483,6 +1154,20 @@ class FXBase(DiscoverableGigeDevice):
     self.red_band = red
     self.green_band = green
     self.blue_band = blue
+    self._update_preview()
+
+  def preview_levels(self, gain: tuple[float, float, float] = (1.0, 1.0, 1.0), offset: tuple[float, float, float] = (0.0, 0.0, 0.0)) -> None:
+    """
+    Set gain and offset of the R, G, and B bands of the preview window. Band values are scaled to
+    0-255 and then mapped with value * gain + offset.
+
+    :param gain: Gains of red, green and blue
+    :param offset: Offsets of red, green and blue (in 8-bit scale)
+    :returns: None
+    """
+    self.preview_gain = tuple(gain)
+    self.preview_offset = tuple(offset)
+    self._update_preview()
 
   def quick_init(self) -> None:
     """
@@ -504,18 +1189,114 @@ class FXBase(DiscoverableGigeDevice):
       print("FX: Monitoring temperature")
     while True:
       if self.en_temp_warning:
-        # genicam.genapi seems to have some problem with threads, cannot use self.get/set here :(
-        self.gvcp.writereg(0x00300068, 0) # Temperature_Update
-        fpga_temp = self.gvcp.readreg(0x00300050, float) # Temperature_FPGA
-        processor_temp = self.gvcp.readreg(0x00300040, float) # Temperature_Proc
-        if fpga_temp >= self.temp_fpga_warn:
-          print(f"WARNING: FPGA temperature over {self.temp_fpga_warn} °C")
-        if processor_temp >= self.temp_pcb_warn:
-          print(f"WARNING: Processor PCB temperature over {self.temp_pcb_warn} °C")
+        self._check_temperature()
       self._temp_stop.wait(self.temp_update_rate)
       if self._temp_stop.is_set():
         break
 
+  def _check_temperature(self, event: GVCPEvent = None) -> None:
+    if not self.en_temp_warning:
+      return
+    # genicam.genapi seems to have some problem with threads, cannot use self.get/set here :(
+    self.gvcp.writereg(0x00300068, 0) # Temperature_Update
+    fpga_temp = self.gvcp.readreg(0x00300050, float) # Temperature_FPGA
+    processor_temp = self.gvcp.readreg(0x00300040, float) # Temperature_Proc
+    self._gc_port.invalidate(0x00300050)
+    self._gc_port.invalidate(0x00300040)
+    if fpga_temp >= self.temp_fpga_warn:
+      print(f"WARNING: FPGA temperature over {self.temp_fpga_warn} °C")
+    if processor_temp >= self.temp_pcb_warn:
+      print(f"WARNING: Processor PCB temperature over {self.temp_pcb_warn} °C")
+
+  def _subscribe_temperature_events(self) -> bool:
+    # Temperature is checked when the camera reports a change instead of polling
+    if len(self._gc_port.description.find_events("Temperature")) == 0:
+      return False
+    try:
+      self.subscribe_event("Temperature", self._check_temperature)
+    except (NotImplementedError, AckError, OSError) as err:
+      if self._verbose:
+        print(f"FX: No temperature events, polling temperature ({err})")
+      return False
+    if self._verbose:
+      print("FX: Monitoring temperature events")
+    return True
+
+  def _enable_event_notification(self, name: str) -> None:
+    # Enable all EventSelector entries matching the name, if the camera has event selector
+    try:
+      selector = self.get_node("EventSelector")
+    except AttributeError:
+      selector = None
+    if selector == None or not isinstance(selector, IEnumeration):
+      return
+    for entry in selector.entries:
+      if name.lower() in entry.symbolic.lower():
+        self.set(selector, entry.symbolic)
+        self._set_optional("EventNotification", "On")
+
+  def _update_preview(self) -> None:
+    # Receiver makes the RGB row of the preview bands while decoding, only when there is a preview
+    if self._gvsp_p == None:
+      return
+    bands = (self.red_band, self.green_band, self.blue_band) if self.preview != None else None
+    gvsp.set_preview(self._gvsp_p, bands, self.preview_gain, self.preview_offset)
+
+  def _check_bad_pixel_map(self, mask: np.ndarray) -> None:
+    # Bands of multi-part frame sets depend on the regions, only the width can be checked then
+    bands = self.get("Height")
+    try:
+      if self.get("GevSCCFGMultiPartEnabled"):
+        bands = None
+    except AttributeError:
+      pass
+    width = self.get("Width")
+    if mask.ndim != 2 or mask.shape[1] != width or bands != None and mask.shape[0] != bands:
+      expected = f"({bands}, {width})" if bands != None else f"(bands, {width})"
+      raise ValueError(f"Bad pixel map of shape {mask.shape} does not match the frames {expected}")
+
+  def _set_optional(self, feature: str, value: any) -> bool:
+    try:
+      node = self.get_node(feature)
+    except AttributeError:
+      node = None
+    if node == None:
+      return False
+    self.set(node, value)
+    return True
+
+  def _feature_addresses(self, features: list[Union[str, IValue]]) -> list[int]:
+    # Addresses of the 4 byte registers GenAPI reads to access the features
+    description = self._gc_port.description
+    addresses = set()
+    for feature in features:
+      if type(feature) == str:
+        name = feature
+      elif isinstance(feature, IValue):
+        name = feature.node.name
+      else:
+        raise TypeError("Invalid feature type")
+      for reg_name in description.registers_read_by(name):
+        reg = description.registers[reg_name]
+        if reg.length == 4 and reg.address % 4 == 0:
+          addresses.add(reg.address)
+    return sorted(addresses)
+
+  def _take_record(self) -> Union[np.ndarray, tuple[np.ndarray, ...]]:
+    if len(self.buffer) > 0 and type(self.buffer[0]) == tuple:
+      # Multi-part frame sets, one array for each part
+      record = tuple(np.array(part) for part in zip(*self.buffer))
+    else:
+      record = np.array(self.buffer)
+    self.buffer.clear()
+    self.chunk_record = list(self.chunk_buffer) if self._chunk_mode else None
+    self.chunk_buffer.clear()
+    self.timestamp_record = np.array(self.timestamp_buffer, dtype=np.uint64) if self._timestamp_mode else None
+    self.timestamp_buffer.clear()
+    self.reflectance_record = np.array(self.reflectance_buffer) if self._calibration != None else None
+    self.reflectance_buffer.clear()
+    return record
+
   def _check_connection(self) -> None:
     if not self.is_open:
       raise NotConnectedError(f"Not connected, ")
@@ -529,3 +1310,4 @@ class FXBase(DiscoverableGigeDevice):
     # Error in FX17e device description XML, this register actually writable so we need to set it the hard way
     scda_addr = self.get_node("GevSCDAReg").address
     self.gvcp.writereg(scda_addr, address)
+    self._gc_port.invalidate(scda_addr)